@@ -0,0 +1,124 @@
+#include "transform.h"
+#include "chrono.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <malloc.h>
+
+// 1024 roots with 4 children each over 4 levels, deep enough that most transforms have a parent to gather from
+#define NUM_ROOTS 1024
+#define NUM_CHILDREN 4
+#define NUM_LEVELS 4
+// Each kernel runs at least this long, so timer resolution does not matter
+#define MIN_BENCH_MICROSECONDS 500000
+
+static uint32_t random_state = 1;
+
+static float get_random_float(float min, float max) {
+    random_state = random_state*1664525u + 1013904223u;
+    return min + (max - min)*(float)(random_state >> 8)/(float)(1u << 24);
+}
+
+static uint32_t add_random_transform(transform_store_t* store, uint32_t parent_index) {
+    return add_transform(
+        store, parent_index,
+        (vec3s) {{ get_random_float(-10.0f, 10.0f), get_random_float(-10.0f, 10.0f), get_random_float(-10.0f, 10.0f) }},
+        (versors) {{ get_random_float(-1.0f, 1.0f), get_random_float(-1.0f, 1.0f), get_random_float(-1.0f, 1.0f), get_random_float(0.1f, 1.0f) }},
+        get_random_float(0.5f, 2.0f)
+    );
+}
+
+typedef void (*bench_function_t)(transform_store_t* store, instance_t instances[]);
+
+static void compose_simd(transform_store_t* store, instance_t[]) {
+    compute_world_transforms(store);
+}
+
+static void compose_scalar(transform_store_t* store, instance_t[]) {
+    compute_world_transforms_scalar(store);
+}
+
+static void write_simd(transform_store_t* store, instance_t instances[]) {
+    write_world_transforms(store, 0, store->num_transforms, instances);
+}
+
+static void write_scalar(transform_store_t* store, instance_t instances[]) {
+    write_world_transforms_scalar(store, 0, store->num_transforms, instances);
+}
+
+// Single threaded, so the rate is per core
+static void run_bench(const char* name, bench_function_t function, transform_store_t* store, instance_t instances[]) {
+    function(store, instances);
+
+    size_t num_runs = 0;
+    microseconds_t start = get_current_microseconds();
+    microseconds_t elapsed;
+    do {
+        function(store, instances);
+        num_runs++;
+        elapsed = get_current_microseconds() - start;
+    } while (elapsed < MIN_BENCH_MICROSECONDS);
+
+    double transforms_per_second = (double)num_runs*(double)store->num_transforms*1000000.0/(double)elapsed;
+    printf("%-24s %8.1f M transforms/s per core (%zu runs of %u)\n", name, transforms_per_second/1000000.0, num_runs, store->num_transforms);
+}
+
+int main(void) {
+    uint32_t num_transforms = 0;
+    for (uint32_t level = 0, num_level_transforms = NUM_ROOTS; level < NUM_LEVELS; level++, num_level_transforms *= NUM_CHILDREN) {
+        num_transforms += num_level_transforms;
+    }
+
+    transform_store_t store;
+    if (init_transform_store(num_transforms, &store) != result_success) {
+        printf("Failed to create transform store\n");
+        return 1;
+    }
+
+    // Breadth first, the children of each level's transforms make up the next level
+    uint32_t level_begin = 0;
+    for (uint32_t i = 0; i < NUM_ROOTS; i++) {
+        add_random_transform(&store, NULL_UINT32);
+    }
+    for (uint32_t level = 1; level < NUM_LEVELS; level++) {
+        uint32_t level_end = store.num_transforms;
+        for (uint32_t parent = level_begin; parent < level_end; parent++) {
+            for (uint32_t i = 0; i < NUM_CHILDREN; i++) {
+                add_random_transform(&store, parent);
+            }
+        }
+        level_begin = level_end;
+    }
+
+    instance_t* instances = memalign(64, num_transforms*sizeof(instance_t));
+    float* scalar_positions = malloc(num_transforms*sizeof(float));
+    if (instances == NULL || scalar_positions == NULL) {
+        printf("Failed to allocate instances\n");
+        return 1;
+    }
+
+    // Both kernels have to agree up to rounding, FMA contracts differently than the scalar code
+    compute_world_transforms_scalar(&store);
+    for (uint32_t i = 0; i < num_transforms; i++) {
+        scalar_positions[i] = store.world_positions[0][i];
+    }
+    compute_world_transforms(&store);
+    float max_difference = 0.0f;
+    for (uint32_t i = 0; i < num_transforms; i++) {
+        max_difference = fmaxf(max_difference, fabsf(store.world_positions[0][i] - scalar_positions[i])/fmaxf(1.0f, fabsf(scalar_positions[i])));
+    }
+
+    printf("%u transforms in %u levels, %s kernels, max relative difference to scalar %g\n", num_transforms, store.num_levels, get_transform_kernel_name(), (double)max_difference);
+
+    run_bench("compose scalar", compose_scalar, &store, instances);
+    run_bench("compose", compose_simd, &store, instances);
+    run_bench("write instances scalar", write_scalar, &store, instances);
+    run_bench("write instances", write_simd, &store, instances);
+
+    free(scalar_positions);
+    free(instances);
+    term_transform_store(&store);
+
+    return 0;
+}
\ No newline at end of file
@@ -1,58 +1,202 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
-layout(binding = 1) uniform sampler2DArray color_sampler;
-layout(binding = 2) uniform sampler2DArray normal_sampler;
-layout(binding = 3) uniform sampler2DArray specular_sampler;
-layout(binding = 4) uniform sampler2DShadow shadow_sampler;
+layout(set = 1, binding = 0) uniform frame_uniforms_t {
+    mat4 view_projection;
+    mat4 shadow_view_projection;
+    vec4 camera_position;
+    uint instance_buffer_index;
+    uint material_buffer_index;
+    uint instance_order_buffer_index;
+    uint instance_order_offset;
 
-layout(location = 0) in vec3 frag_tex_coord;
+    // Light clusters, see light_cluster_pipeline.h
+    mat4 view;
+    vec2 light_cluster_tile_scale;
+    float light_cluster_depth_scale;
+    float light_cluster_depth_bias;
+    vec2 light_cluster_tan_half_fov;
+    float light_cluster_near;
+    float light_cluster_far;
+    uint light_buffer_index;
+    uint num_lights;
+    uint light_cluster_buffer_index;
+    uint light_cluster_offset;
+};
 
-// All in normal texture space
-layout(location = 1) in vec3 frag_vertex_to_camera_direction;
-layout(location = 2) in vec3 frag_light_direction;
-layout(location = 3) in vec3 frag_vertex_to_light_direction;
+struct material_t {
+    uint color_image_index;
+    uint normal_image_index;
+    uint specular_image_index;
+    uint sampler_index;
+};
+
+// Bindless table shared by all pipelines, see bindless.h
+layout(set = 0, binding = 0) uniform texture2D bindless_images[];
+layout(set = 0, binding = 1) uniform sampler bindless_samplers[];
+layout(set = 0, binding = 2, std430) readonly buffer material_buffer_t {
+    material_t materials[];
+} material_buffers[];
+
+// Mirrors light_t in asset.h
+struct light_t {
+    vec3 position;
+    float range;
+    vec3 color;
+    float spot_cos_outer;
+    vec3 direction;
+    float spot_cos_inner;
+};
+
+layout(set = 0, binding = 2, std430) readonly buffer light_buffer_t {
+    light_t lights[];
+} light_buffers[];
+
+// Each cluster is its number of lights followed by max_light_cluster_lights light indices, see light_cluster_pipeline_compute.comp
+layout(set = 0, binding = 2, std430) readonly buffer light_cluster_buffer_t {
+    uint light_cluster_words[];
+} light_cluster_buffers[];
+
+layout(set = 1, binding = 1) uniform sampler2DShadow shadow_sampler;
+
+layout(location = 0) in vec2 frag_tex_coord;
+
+// All in world space
+layout(location = 1) in vec3 frag_world_position;
+layout(location = 2) in vec3 frag_normal;
+layout(location = 3) in vec4 frag_tangent;
 layout(location = 4) in vec3 frag_shadow_norm_device_coord;
+layout(location = 5) flat in uint frag_material_index;
 
 layout(location = 0) out vec4 color;
 
-vec3 light_base_color = vec3(0.9, 0.95, 1.0);
-float ambient_base_scalar = 0.2;
+// Permutation switches, set per material variant by color_pipeline.c, disabled features are compiled out by the driver
+layout(constant_id = 0) const bool shadows_enabled = true;
+layout(constant_id = 1) const int pcf_kernel_size = 1;
+layout(constant_id = 2) const bool specular_enabled = true;
+layout(constant_id = 3) const bool normal_mapping_enabled = true;
+
+// The sun, the same direction the shadow map is rendered with, see light_direction and light_color in asset.c
+layout(constant_id = 4) const float light_direction_x = -0.8;
+layout(constant_id = 5) const float light_direction_y = -0.6;
+layout(constant_id = 6) const float light_direction_z = 0.4;
+layout(constant_id = 9) const float light_color_r = 0.9;
+layout(constant_id = 10) const float light_color_g = 0.95;
+layout(constant_id = 11) const float light_color_b = 1.0;
+
+layout(constant_id = 7) const float ambient_base_scalar = 0.2;
+layout(constant_id = 8) const float specular_intensity = 5.0;
+
+// See light_cluster_pipeline.h
+layout(constant_id = 12) const uint light_cluster_tiles_x = 16;
+layout(constant_id = 13) const uint light_cluster_tiles_y = 9;
+layout(constant_id = 14) const uint light_cluster_slices = 24;
+layout(constant_id = 15) const uint max_light_cluster_lights = 255;
+
+vec3 light_direction = normalize(vec3(light_direction_x, light_direction_y, light_direction_z));
+vec3 light_base_color = vec3(light_color_r, light_color_g, light_color_b);
 float diffuse_base_scalar = 1.6;
 float specular_base_scalar = 0.5;
 
-float specular_intensity = 5.0;
-
 float get_shadow_scalar() {
+	if (!shadows_enabled) { return 1.0; }
 	if (
 		abs(frag_shadow_norm_device_coord.x) > 1.0 ||
 		abs(frag_shadow_norm_device_coord.y) > 1.0 ||
 		abs(frag_shadow_norm_device_coord.z) > 1.0
 	) { return 0.0; }
 	vec2 shadow_tex_coord = (0.5 * frag_shadow_norm_device_coord.xy) + vec2(0.5);
-	return texture(shadow_sampler, vec3(shadow_tex_coord.xy, frag_shadow_norm_device_coord.z));
+	if (pcf_kernel_size <= 1) {
+		return texture(shadow_sampler, vec3(shadow_tex_coord.xy, frag_shadow_norm_device_coord.z));
+	}
+
+	// Box filter of pcf_kernel_size squared comparisons, each one is already bilinearly filtered by the sampler
+	vec2 texel_size = 1.0 / vec2(textureSize(shadow_sampler, 0));
+	int kernel_radius = pcf_kernel_size / 2;
+	float shadow_scalar = 0.0;
+	for (int x = -kernel_radius; x <= kernel_radius; x++) {
+		for (int y = -kernel_radius; y <= kernel_radius; y++) {
+			vec2 offset = vec2(x, y) * texel_size;
+			shadow_scalar += texture(shadow_sampler, vec3(shadow_tex_coord.xy + offset, frag_shadow_norm_device_coord.z));
+		}
+	}
+	return shadow_scalar / float(pcf_kernel_size * pcf_kernel_size);
+}
+
+// Material indices vary per instance, so lookups can diverge within a subgroup
+vec4 sample_material_image(uint image_index, uint sampler_index) {
+	return texture(sampler2D(bindless_images[nonuniformEXT(image_index)], bindless_samplers[nonuniformEXT(sampler_index)]), frag_tex_coord);
+}
+
+// Diffuse and specular of light arriving from vertex_to_light_direction with the given color at the fragment
+vec3 shade_light(vec3 vertex_to_light_direction, vec3 light_color, vec3 normal, vec3 vertex_to_camera_direction, vec3 base_color, vec3 specular_base_color) {
+	float cos_normal_to_vertex_to_light = clamp(dot(normal, vertex_to_light_direction), 0.0, 1.0);
+	vec3 color = cos_normal_to_vertex_to_light * diffuse_base_scalar * light_color * base_color;
+
+	if (specular_enabled && cos_normal_to_vertex_to_light > 0.0) {
+		vec3 reflection_direction = reflect(-vertex_to_light_direction, normal);
+		float specular_factor = clamp(dot(reflection_direction, vertex_to_camera_direction), 0.0, 1.0);
+		color += pow(specular_factor, specular_intensity) * cos_normal_to_vertex_to_light * specular_base_scalar * specular_base_color * light_color;
+	}
+	return color;
+}
+
+// The lights the light cluster pass found to reach the cluster of this fragment
+vec3 shade_clustered_lights(vec3 normal, vec3 vertex_to_camera_direction, vec3 base_color, vec3 specular_base_color) {
+	// The w of the clip position is the view depth for both projections
+	float view_depth = 1.0 / gl_FragCoord.w;
+	uvec2 tile = min(uvec2(gl_FragCoord.xy * light_cluster_tile_scale), uvec2(light_cluster_tiles_x - 1u, light_cluster_tiles_y - 1u));
+	uint slice = uint(clamp(log(view_depth) * light_cluster_depth_scale + light_cluster_depth_bias, 0.0, float(light_cluster_slices - 1u)));
+	uint cluster_index = light_cluster_offset + tile.x + light_cluster_tiles_x * (tile.y + light_cluster_tiles_y * slice);
+	uint cluster_start = cluster_index * (max_light_cluster_lights + 1u);
+
+	uint num_cluster_lights = light_cluster_buffers[light_cluster_buffer_index].light_cluster_words[cluster_start];
+	vec3 color = vec3(0.0);
+	for (uint i = 0u; i < num_cluster_lights; i++) {
+		uint light_index = light_cluster_buffers[light_cluster_buffer_index].light_cluster_words[cluster_start + 1u + i];
+		light_t light = light_buffers[light_buffer_index].lights[light_index];
+
+		vec3 vertex_to_light = light.position - frag_world_position;
+		float distance_squared = dot(vertex_to_light, vertex_to_light);
+		float range_squared = light.range * light.range;
+		if (distance_squared >= range_squared) { continue; }
+
+		// Inverse square falloff windowed to reach zero at the range, so the clusters a light is culled from would not have been lit by it
+		float window = 1.0 - (distance_squared * distance_squared) / (range_squared * range_squared);
+		float attenuation = (window * window) / max(distance_squared, 0.01);
+
+		vec3 vertex_to_light_direction = vertex_to_light * inversesqrt(max(distance_squared, 0.0001));
+		float spot_scalar = smoothstep(light.spot_cos_outer, light.spot_cos_inner, dot(-vertex_to_light_direction, light.direction));
+
+		color += shade_light(vertex_to_light_direction, attenuation * spot_scalar * light.color, normal, vertex_to_camera_direction, base_color, specular_base_color);
+	}
+	return color;
 }
 
 void main() {
-	vec3 base_color = texture(color_sampler, frag_tex_coord).rgb;
-	vec3 ambient_color = ambient_base_scalar * light_base_color * base_color;
+	material_t material = material_buffers[material_buffer_index].materials[frag_material_index];
 
-	float shadow_scalar = get_shadow_scalar();
+	vec3 base_color = sample_material_image(material.color_image_index, material.sampler_index).rgb;
+	vec3 ambient_color = ambient_base_scalar * light_base_color * base_color;
 
-	// All of this is done with normal texture (aka inverse normal space) space vectors
-	vec3 vertex_to_camera_direction = normalize(frag_vertex_to_camera_direction);
-	vec3 light_direction = normalize(frag_light_direction);
-	vec3 vertex_to_light_direction = normalize(frag_vertex_to_light_direction);
+	vec3 specular_base_color = vec3(0.0);
+	if (specular_enabled) {
+		specular_base_color = sample_material_image(material.specular_image_index, material.sampler_index).rgb;
+	}
 
-	vec3 normal = normalize(2.0 * (texture(normal_sampler, frag_tex_coord).xyz - vec3(0.5)));
-	float cos_normal_to_vertex_to_light = clamp(dot(normal, vertex_to_light_direction), 0.0, 1.0);
-	vec3 diffuse_color = shadow_scalar * cos_normal_to_vertex_to_light * diffuse_base_scalar * light_base_color * base_color;
+	vec3 vertex_to_camera_direction = normalize(camera_position.xyz - frag_world_position);
 
-	vec3 specular_color = vec3(0.0);
-	if (cos_normal_to_vertex_to_light > 0.0) {
-		vec3 reflection_direction = reflect(light_direction, normal);
-		float specular_factor = clamp(dot(reflection_direction, vertex_to_camera_direction), 0.0, 1.0);
-		specular_color = shadow_scalar * pow(specular_factor, specular_intensity) * cos_normal_to_vertex_to_light * specular_base_scalar * texture(specular_sampler, frag_tex_coord).rgb * light_base_color;
+	// The normal texture is in the space of the interpolated tangent frame, orthogonalized again after interpolation
+	vec3 normal = normalize(frag_normal);
+	if (normal_mapping_enabled) {
+		vec3 tangent = normalize(frag_tangent.xyz - dot(frag_tangent.xyz, normal) * normal);
+		vec3 bitangent = cross(normal, tangent) * -frag_tangent.w;
+		vec3 texture_normal = normalize(2.0 * (sample_material_image(material.normal_image_index, material.sampler_index).xyz - vec3(0.5)));
+		normal = normalize(mat3(tangent, bitangent, normal) * texture_normal);
 	}
 
-    color = vec4(ambient_color + diffuse_color + specular_color, 1.0);
+	vec3 sun_color = shade_light(-light_direction, get_shadow_scalar() * light_base_color, normal, vertex_to_camera_direction, base_color, specular_base_color);
+	vec3 clustered_color = shade_clustered_lights(normal, vertex_to_camera_direction, base_color, specular_base_color);
+
+    color = vec4(ambient_color + sun_color + clustered_color, 1.0);
 }
\ No newline at end of file
@@ -1,47 +1,69 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
 
-layout(push_constant, std430) uniform push_constants_t {
+// Written once per frame into a ring slot selected with a dynamic offset, see frame_uniforms.h
+layout(set = 1, binding = 0) uniform frame_uniforms_t {
     mat4 view_projection;
-    vec3 camera_position;
-	float layer_index;
+    mat4 shadow_view_projection;
+    vec4 camera_position;
+    uint instance_buffer_index;
+    uint material_buffer_index;
+    uint instance_order_buffer_index;
+    uint instance_order_offset;
 };
 
-layout(binding = 0) uniform shadow_uniform_constants_t {
-    mat4 shadow_view_projection;
+// Mirrors instance_t in asset.h, the rotation is a unit quaternion packed as four half floats
+struct instance_t {
+    vec3 position;
+    float scale;
+    uvec2 rotation;
+    uint material_index;
+    uint padding;
 };
 
-layout(location = 0) in mat4 model;
-layout(location = 4) in vec3 position;
-layout(location = 5) in vec3 normal;
-layout(location = 6) in vec4 tangent;
-layout(location = 7) in vec2 tex_coord;
+// Instances of all models in one buffer
+layout(set = 0, binding = 2, std430) readonly buffer instance_buffer_t {
+    instance_t instances[];
+} instance_buffers[];
 
-layout(location = 0) out vec3 frag_tex_coord;
+// Front to back order of the instances, each draw starts at its model's first instance so gl_InstanceIndex indexes this frame's slot directly
+layout(set = 0, binding = 2, std430) readonly buffer instance_order_buffer_t {
+    uint instance_indices[];
+} instance_order_buffers[];
 
-// All in normal texture space
-layout(location = 1) out vec3 frag_vertex_to_camera_direction;
-layout(location = 2) out vec3 frag_light_direction;
-layout(location = 3) out vec3 frag_vertex_to_light_direction;
-layout(location = 4) out vec3 frag_shadow_norm_device_coord;
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec4 tangent;
+layout(location = 3) in vec2 tex_coord;
 
-vec3 light_direction = normalize(vec3(-0.8, -0.6, 0.4));
-vec3 vertex_to_light_direction = -light_direction;
+layout(location = 0) out vec2 frag_tex_coord;
 
-void main() {
-	gl_Position = view_projection * model * vec4(position, 1.0);
+// All in world space, every light is shaded per fragment
+layout(location = 1) out vec3 frag_world_position;
+layout(location = 2) out vec3 frag_normal;
+layout(location = 3) out vec4 frag_tangent;
+layout(location = 4) out vec3 frag_shadow_norm_device_coord;
+layout(location = 5) flat out uint frag_material_index;
+
+// Depth has to match the depth prepass exactly for the EQUAL test, see depth_prepass_pipeline_vertex.vert
+invariant gl_Position;
 
-	vec3 unit_normal = normalize(normal);
-	vec3 unit_tangent = normalize(tangent.xyz);
+#include "rotation.glsl"
 
-	vec3 bitangent = cross(unit_normal, unit_tangent) * -tangent.w;
-	mat3 normal_texture_matrix = transpose(mat3(unit_tangent, bitangent, unit_normal)) * transpose(mat3(model)); // Transpose is inverse here since it is orthogonal
+void main() {
+	uint instance_index = instance_order_buffers[instance_order_buffer_index].instance_indices[instance_order_offset + gl_InstanceIndex];
+	instance_t instance = instance_buffers[instance_buffer_index].instances[instance_index];
+	mat3 rotation = get_rotation_matrix(normalize(vec4(unpackHalf2x16(instance.rotation.x), unpackHalf2x16(instance.rotation.y))));
 
-	vec3 world_position = (model * vec4(position, 1.0)).xyz;
+	vec3 world_position = rotation * (position * instance.scale) + instance.position;
+	gl_Position = view_projection * vec4(world_position, 1.0);
 
-	frag_tex_coord = vec3(tex_coord, layer_index);
-	frag_vertex_to_camera_direction = normal_texture_matrix * normalize(camera_position - world_position);
-	frag_light_direction = normal_texture_matrix * light_direction;
-	frag_vertex_to_light_direction = normal_texture_matrix * vertex_to_light_direction;
-	vec4 shadow_clip_position = shadow_view_projection * model * vec4(position, 1.0);
+	// Uniform scale leaves directions unchanged, so the rotation alone transforms them, the sign of the bitangent stays in w
+	frag_tex_coord = tex_coord;
+	frag_material_index = instance.material_index;
+	frag_world_position = world_position;
+	frag_normal = rotation * normalize(normal);
+	frag_tangent = vec4(rotation * normalize(tangent.xyz), tangent.w);
+	vec4 shadow_clip_position = shadow_view_projection * vec4(world_position, 1.0);
 	frag_shadow_norm_device_coord = shadow_clip_position.xyz / shadow_clip_position.w;
 }
\ No newline at end of file
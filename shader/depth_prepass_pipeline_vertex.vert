@@ -0,0 +1,46 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// Same frame uniforms and instances as the color pipeline, see color_pipeline_vertex.vert
+layout(set = 1, binding = 0) uniform frame_uniforms_t {
+    mat4 view_projection;
+    mat4 shadow_view_projection;
+    vec4 camera_position;
+    uint instance_buffer_index;
+    uint material_buffer_index;
+    uint instance_order_buffer_index;
+    uint instance_order_offset;
+};
+
+struct instance_t {
+    vec3 position;
+    float scale;
+    uvec2 rotation;
+    uint material_index;
+    uint padding;
+};
+
+layout(set = 0, binding = 2, std430) readonly buffer instance_buffer_t {
+    instance_t instances[];
+} instance_buffers[];
+
+layout(set = 0, binding = 2, std430) readonly buffer instance_order_buffer_t {
+    uint instance_indices[];
+} instance_order_buffers[];
+
+// Only the position stream is bound
+layout(location = 0) in vec3 position;
+
+// The color pass tests against this depth with EQUAL, so both compute gl_Position with the same invariant expression
+invariant gl_Position;
+
+#include "rotation.glsl"
+
+void main() {
+	uint instance_index = instance_order_buffers[instance_order_buffer_index].instance_indices[instance_order_offset + gl_InstanceIndex];
+	instance_t instance = instance_buffers[instance_buffer_index].instances[instance_index];
+	mat3 rotation = get_rotation_matrix(normalize(vec4(unpackHalf2x16(instance.rotation.x), unpackHalf2x16(instance.rotation.y))));
+
+	vec3 world_position = rotation * (position * instance.scale) + instance.position;
+	gl_Position = view_projection * vec4(world_position, 1.0);
+}
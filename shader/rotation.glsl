@@ -0,0 +1,18 @@
+// Rotation of a unit quaternion, included by the instanced vertex shaders and never compiled on its own
+mat3 get_rotation_matrix(vec4 rotation) {
+	vec3 q2 = rotation.xyz * 2.0;
+	float xx = rotation.x * q2.x;
+	float yy = rotation.y * q2.y;
+	float zz = rotation.z * q2.z;
+	float xy = rotation.x * q2.y;
+	float xz = rotation.x * q2.z;
+	float yz = rotation.y * q2.z;
+	float wx = rotation.w * q2.x;
+	float wy = rotation.w * q2.y;
+	float wz = rotation.w * q2.z;
+	return mat3(
+		1.0 - (yy + zz), xy + wz, xz - wy,
+		xy - wz, 1.0 - (xx + zz), yz + wx,
+		xz + wy, yz - wx, 1.0 - (xx + yy)
+	);
+}
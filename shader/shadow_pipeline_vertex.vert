@@ -1,12 +1,18 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
 
 layout(binding = 0) uniform shadow_uniform_constants_t {
     mat4 shadow_view_projection;
 };
 
-layout(location = 0) in mat4 model;
-layout(location = 4) in vec3 position;
+// Instance rate, see instance_t in asset.h, the half float rotation is converted by the vertex input
+layout(location = 0) in vec4 instance_position_scale;
+layout(location = 1) in vec4 instance_rotation;
+layout(location = 2) in vec3 position;
+
+#include "rotation.glsl"
 
 void main() {
-	gl_Position = shadow_view_projection * model * vec4(position, 1.0);
+	vec3 world_position = get_rotation_matrix(normalize(instance_rotation)) * (position * instance_position_scale.w) + instance_position_scale.xyz;
+	gl_Position = shadow_view_projection * vec4(world_position, 1.0);
 }
\ No newline at end of file
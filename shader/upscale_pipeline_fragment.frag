@@ -0,0 +1,18 @@
+#version 450
+
+// The scene image at full swapchain size, only its top left render_extent is rendered, see render_scale.h
+layout(set = 0, binding = 0) uniform sampler2D scene_sampler;
+
+layout(push_constant) uniform upscale_constants_t {
+    vec2 tex_coord_scale;
+    // Half a texel inside the rendered region, so bilinear filtering never reads what is outside of it
+    vec2 max_tex_coord;
+};
+
+layout(location = 0) in vec2 frag_tex_coord;
+
+layout(location = 0) out vec4 color;
+
+void main() {
+	color = texture(scene_sampler, min(frag_tex_coord * tex_coord_scale, max_tex_coord));
+}
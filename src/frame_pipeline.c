@@ -0,0 +1,76 @@
+#include "frame_pipeline.h"
+#include <stdalign.h>
+#include <pthread.h>
+
+#define NUM_FRAME_SNAPSHOTS 2
+
+alignas(64)
+static frame_snapshot_t snapshots[NUM_FRAME_SNAPSHOTS];
+// Slot the simulation writes next, the other one is the last published
+static uint32_t simulation_slot = 0;
+static bool snapshot_published = false;
+// Published but not taken yet, the render thread still uses the slot the simulation is about to write until then
+static bool snapshot_pending = false;
+static bool render_waiting = false;
+static bool stopped = false;
+static pthread_mutex_t pipeline_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pipeline_condition = PTHREAD_COND_INITIALIZER;
+
+frame_snapshot_t* begin_frame_snapshot(bool wait_for_render) {
+    pthread_mutex_lock(&pipeline_mutex);
+    while (!stopped && (snapshot_pending || (wait_for_render && !render_waiting))) {
+        pthread_cond_wait(&pipeline_condition, &pipeline_mutex);
+    }
+    bool running = !stopped;
+    pthread_mutex_unlock(&pipeline_mutex);
+
+    if (!running) {
+        return NULL;
+    }
+
+    // The render thread only reads the last published slot, so copying from it needs no lock
+    frame_snapshot_t* snapshot = &snapshots[simulation_slot];
+    if (snapshot_published) {
+        const frame_snapshot_t* published = &snapshots[(simulation_slot + 1) % NUM_FRAME_SNAPSHOTS];
+        *snapshot = *published;
+        snapshot->window_resized = false;
+        snapshot->instance_updates.num_ranges = 0;
+    }
+    return snapshot;
+}
+
+void publish_frame_snapshot(void) {
+    pthread_mutex_lock(&pipeline_mutex);
+    snapshot_published = true;
+    snapshot_pending = true;
+    simulation_slot = (simulation_slot + 1) % NUM_FRAME_SNAPSHOTS;
+    pthread_cond_broadcast(&pipeline_condition);
+    pthread_mutex_unlock(&pipeline_mutex);
+}
+
+const frame_snapshot_t* take_frame_snapshot(void) {
+    pthread_mutex_lock(&pipeline_mutex);
+    render_waiting = true;
+    pthread_cond_broadcast(&pipeline_condition);
+    while (!stopped && !snapshot_pending) {
+        pthread_cond_wait(&pipeline_condition, &pipeline_mutex);
+    }
+    render_waiting = false;
+
+    const frame_snapshot_t* snapshot = NULL;
+    if (!stopped) {
+        snapshot = &snapshots[(simulation_slot + 1) % NUM_FRAME_SNAPSHOTS];
+        snapshot_pending = false;
+        pthread_cond_broadcast(&pipeline_condition);
+    }
+    pthread_mutex_unlock(&pipeline_mutex);
+
+    return snapshot;
+}
+
+void stop_frame_pipeline(void) {
+    pthread_mutex_lock(&pipeline_mutex);
+    stopped = true;
+    pthread_cond_broadcast(&pipeline_condition);
+    pthread_mutex_unlock(&pipeline_mutex);
+}
\ No newline at end of file
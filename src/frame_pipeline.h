@@ -0,0 +1,36 @@
+#pragma once
+#include "vk/core.h"
+#include "vk/asset.h"
+#include "chrono.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <cglm/struct/mat4.h>
+#include <cglm/struct/vec4.h>
+
+// Everything the render thread needs from the simulation of a frame, not changed once published
+typedef struct {
+    // Sampled right before the input of the frame, present latency is measured from here
+    microseconds_t input_microseconds;
+    // GLFW only reports the window on the main thread, so the render thread sizes the swapchain by these
+    VkExtent2D window_extent;
+    bool window_resized;
+    present_policy_t present_policy;
+
+    mat4s view_projection;
+    // Separately as well for the light clusters, which are built in view space
+    mat4s view;
+    mat4s projection;
+    vec4s camera_position;
+    uint32_t instance_order[NUM_INSTANCES];
+    instance_updates_t instance_updates;
+} frame_snapshot_t;
+
+// The main thread simulates frame N + 1 while the render thread records and submits frame N, with one snapshot slot for each
+// Simulation side, returns a slot initialized from the last published snapshot once the render thread has taken that one, or NULL once stopped
+// With wait_for_render, it also waits until the render thread is ready for the next frame, so input is sampled as late as possible
+frame_snapshot_t* begin_frame_snapshot(bool wait_for_render);
+void publish_frame_snapshot(void);
+// Render side, blocks until a snapshot is published, returns NULL once stopped, the snapshot stays valid until the next call
+const frame_snapshot_t* take_frame_snapshot(void);
+// Callable from either side, the other side returns NULL from its next wait
+void stop_frame_pipeline(void);
\ No newline at end of file
@@ -1,6 +1,5 @@
 #include "input.h"
 #include "vk/core.h"
-#include "vk/color_pipeline.h"
 #include <cglm/struct/cam.h>
 #include <cglm/struct/vec2.h>
 #include <cglm/struct/vec3.h>
@@ -20,16 +19,24 @@ static vec3s cam_vel = {{ 0.0f, 0.0f, 0.0f }};
 static vec2s cam_rot = {{ -3.587656f, -0.225112f }};
 static vec2s cam_rot_vel = {{ 0.0f, 0.0f }};
 
+static bool present_policy_key_pressed = false;
+// Cycled by the P key and handed to the render thread, which owns the swapchain
+static present_policy_t requested_present_policy;
+
+// Window framebuffer size of the frame being simulated, the aspect of the last non-empty one is kept while minimized
+static VkExtent2D input_extent;
+static float input_aspect = 1.0f;
+
 static bool in_rotation_mode = false;
 static vec2s rotation_mode_cursor_position = {{ 0.0f, 0.0f }};
 static vec2s rotation_mode_norm_cursor_position = {{ 0.0f, 0.0f }};
 
 static bool is_cursor_position_out_of_bounds(vec2s cursor_position) {
-    return cursor_position.x < 0 || cursor_position.x >= swap_image_extent.width || cursor_position.y < 0.0f || cursor_position.y >= swap_image_extent.height;
+    return cursor_position.x < 0 || cursor_position.x >= input_extent.width || cursor_position.y < 0.0f || cursor_position.y >= input_extent.height;
 }
 
 static vec2s get_norm_cursor_position(float aspect, vec2s cursor_position) {
-    vec2s norm_cursor_position = glms_vec2_mul(cursor_position, (vec2s) {{ 1.0f/(float)swap_image_extent.width, 1.0f/(float)swap_image_extent.height }});
+    vec2s norm_cursor_position = glms_vec2_mul(cursor_position, (vec2s) {{ 1.0f/(float)input_extent.width, 1.0f/(float)input_extent.height }});
     norm_cursor_position.x *= aspect;
     return norm_cursor_position;
 }
@@ -77,12 +84,43 @@ static vec2s get_desired_rotational_velocity(float aspect) {
     return glms_vec2_scale(glms_vec2_sub(rotation_mode_norm_cursor_position, get_norm_cursor_position(aspect, cursor_position)), ROT_SPEED);
 }
 
-void handle_input(float) {
-    float aspect = (float)swap_image_extent.width/(float)swap_image_extent.height;
+// Right handed with a 0 to 1 depth range like glms_perspective, but depth goes from 1 at the near plane to 0 at infinity
+static mat4s get_reverse_infinite_perspective(float fovy, float aspect, float near) {
+    float f = 1.0f/tanf(fovy*0.5f);
+    return (mat4s) {{
+        { f/aspect, 0.0f, 0.0f, 0.0f },
+        { 0.0f, f, 0.0f, 0.0f },
+        { 0.0f, 0.0f, 0.0f, -1.0f },
+        { 0.0f, 0.0f, near, 0.0f }
+    }};
+}
+
+void init_input(void) {
+    requested_present_policy = present_policy;
+}
+
+present_policy_t get_requested_present_policy(void) {
+    return requested_present_policy;
+}
+
+void handle_input(float, frame_snapshot_t* snapshot) {
+    // P cycles through the present policies, each press once
+    bool present_policy_key_down = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+    if (present_policy_key_down && !present_policy_key_pressed) {
+        requested_present_policy = (present_policy_t)((requested_present_policy + 1) % NUM_PRESENT_POLICIES);
+    }
+    present_policy_key_pressed = present_policy_key_down;
+    snapshot->present_policy = requested_present_policy;
+
+    input_extent = snapshot->window_extent;
+    if (input_extent.width > 0 && input_extent.height > 0) {
+        input_aspect = (float)input_extent.width/(float)input_extent.height;
+    }
 
-    mat4s projection = glms_perspective(M_TAU / 5.0f, aspect, 0.01f, 300.0f);
+    // Without reverse depth the far plane has to stay close enough for the depth precision to hold up
+    mat4s projection = reverse_depth_enabled ? get_reverse_infinite_perspective(M_TAU / 5.0f, input_aspect, 0.01f) : glms_perspective(M_TAU / 5.0f, input_aspect, 0.01f, 300.0f);
 
-    vec2s desired_rot_vel = get_desired_rotational_velocity(aspect);
+    vec2s desired_rot_vel = get_desired_rotational_velocity(input_aspect);
     cam_rot_vel = glms_vec2_lerp(cam_rot_vel, desired_rot_vel, 0.2f);
 
     cam_rot = glms_vec2_add(cam_rot, cam_rot_vel);
@@ -126,8 +164,10 @@ void handle_input(float) {
 
     mat4s view = glms_look(cam_pos, cam_forward, (vec3s) {{ 0.0f, -1.0f, 0.0f }});
     
-    color_pipeline_push_constants.view_projection = glms_mat4_mul(projection, view);
-    color_pipeline_push_constants.camera_position = cam_pos;
+    snapshot->view_projection = glms_mat4_mul(projection, view);
+    snapshot->view = view;
+    snapshot->projection = projection;
+    snapshot->camera_position = glms_vec4(cam_pos, 1.0f);
 
     // printf("%ff, %ff, %ff, %ff, %ff, %ff, %ff, %ff\n", cam_pos.x, cam_pos.y, cam_pos.z, cam_forward.x, cam_forward.y, cam_forward.z, cam_rot.x, cam_rot.y);
 }
\ No newline at end of file
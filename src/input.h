@@ -1,3 +1,9 @@
 #pragma once
+#include "frame_pipeline.h"
 
-void handle_input(float delta);
\ No newline at end of file
+// Called once the core is initialized, before the first frame is simulated
+void init_input(void);
+// The policy the P key selected last, which the render thread switches to with the next snapshot
+present_policy_t get_requested_present_policy(void);
+// Writes the camera and the requested present policy of the frame into its snapshot, window_extent has to be set already
+void handle_input(float delta, frame_snapshot_t* snapshot);
\ No newline at end of file
@@ -0,0 +1,370 @@
+#define _GNU_SOURCE
+#include "job.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdalign.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+// Power of two, a push to a full deque runs the job right away instead
+#define JOB_DEQUE_SIZE 1024
+// Rounds without finding a job before a worker sleeps until more are pushed
+#define NUM_IDLE_SPINS 64
+
+typedef struct {
+    job_function_t function;
+    void* context;
+    uint32_t first;
+    uint32_t end;
+    // Set for batches of run_jobs, graph batches finish their node instead
+    job_counter_t* counter;
+    job_graph_t* graph;
+    uint32_t node_index;
+} job_t;
+
+// Chase-Lev deque, the owning thread pushes and pops at the bottom while other threads steal from the top
+// A thief copies the job before claiming it, the owner only overwrites that slot after the top has moved past it, so a torn copy always fails the claim
+typedef struct {
+    alignas(64) atomic_int_fast64_t top;
+    alignas(64) atomic_int_fast64_t bottom;
+    job_t jobs[JOB_DEQUE_SIZE];
+} job_deque_t;
+
+alignas(64)
+static uint32_t num_threads = 1;
+static job_deque_t* deques = NULL;
+static pthread_t worker_threads[MAX_JOB_THREADS];
+static uint32_t num_started_workers = 0;
+// The initializing thread is 0, the reserved ones and then the workers follow, other threads have no deque and run what they push right away
+static _Thread_local uint32_t thread_index = NULL_UINT32;
+static uint32_t num_reserved_threads = 0;
+static atomic_uint_least32_t num_claimed_threads = 0;
+
+// Only a hint for sleeping, jobs run inline because a deque was full are not counted
+static atomic_uint_least32_t num_queued_jobs = 0;
+static atomic_uint_least32_t num_sleeping_workers = 0;
+static atomic_bool stopping = false;
+static pthread_mutex_t sleep_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_condition = PTHREAD_COND_INITIALIZER;
+
+static bool push_deque(job_deque_t* deque, const job_t* job) {
+    int_fast64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int_fast64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top >= JOB_DEQUE_SIZE) {
+        return false;
+    }
+
+    deque->jobs[bottom & (JOB_DEQUE_SIZE - 1)] = *job;
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+    return true;
+}
+
+static bool pop_deque(job_deque_t* deque, job_t* job) {
+    int_fast64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int_fast64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return false;
+    }
+
+    *job = deque->jobs[bottom & (JOB_DEQUE_SIZE - 1)];
+    if (top < bottom) {
+        return true;
+    }
+
+    // The last job, thieves may be claiming it as well
+    bool claimed = atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return claimed;
+}
+
+static bool steal_deque(job_deque_t* deque, job_t* job) {
+    int_fast64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int_fast64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom) {
+        return false;
+    }
+
+    job_t stolen_job = deque->jobs[top & (JOB_DEQUE_SIZE - 1)];
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return false;
+    }
+    *job = stolen_job;
+    return true;
+}
+
+static bool take_job(job_t* job) {
+    if (deques == NULL) {
+        return false;
+    }
+
+    bool owner = thread_index < num_threads;
+    bool taken = owner && pop_deque(&deques[thread_index], job);
+    // Starting after this thread spreads the thieves over the other deques
+    uint32_t start = owner ? thread_index : 0;
+    for (uint32_t i = owner ? 1 : 0; !taken && i < num_threads; i++) {
+        taken = steal_deque(&deques[(start + i) % num_threads], job);
+    }
+
+    if (taken) {
+        atomic_fetch_sub(&num_queued_jobs, 1);
+    }
+    return taken;
+}
+
+static void execute_job(const job_t* job);
+
+static void push_job(const job_t* job) {
+    if (deques == NULL || thread_index >= num_threads || !push_deque(&deques[thread_index], job)) {
+        execute_job(job);
+        return;
+    }
+
+    // Pairs with the sleeping worker counting itself before checking for jobs, so one of the two sees the other
+    atomic_fetch_add(&num_queued_jobs, 1);
+    if (atomic_load(&num_sleeping_workers) > 0) {
+        pthread_mutex_lock(&sleep_mutex);
+        pthread_cond_signal(&wake_condition);
+        pthread_mutex_unlock(&sleep_mutex);
+    }
+}
+
+static void finish_graph_node(job_graph_t* graph, uint32_t node_index);
+
+static void start_graph_node(job_graph_t* graph, uint32_t node_index) {
+    const job_graph_node_t* node = &graph->nodes[node_index];
+    if (!graph->nodes_enabled[node_index] || node->num_items == 0) {
+        finish_graph_node(graph, node_index);
+        return;
+    }
+
+    uint32_t num_batches = (node->num_items + node->batch_size - 1)/node->batch_size;
+    atomic_store(&graph->num_remaining_batches[node_index], num_batches);
+    for (uint32_t first = 0; first < node->num_items; first += node->batch_size) {
+        push_job(&(job_t) {
+            .function = node->function,
+            .context = graph->context,
+            .first = first,
+            .end = node->num_items - first < node->batch_size ? node->num_items : first + node->batch_size,
+            .graph = graph,
+            .node_index = node_index
+        });
+    }
+}
+
+static void finish_graph_node(job_graph_t* graph, uint32_t node_index) {
+    // Dependents are started before the node counts as finished, so the graph's counter can not reach zero while there is still work
+    for (uint32_t i = 0; i < graph->num_dependents[node_index]; i++) {
+        uint32_t dependent = graph->dependents[node_index][i];
+        if (atomic_fetch_sub(&graph->num_remaining_dependencies[dependent], 1) == 1) {
+            start_graph_node(graph, dependent);
+        }
+    }
+
+    atomic_fetch_sub(&graph->counter.num_pending, 1);
+}
+
+static void execute_job(const job_t* job) {
+    job->function(job->context, job->first, job->end);
+
+    if (job->graph != NULL) {
+        if (atomic_fetch_sub(&job->graph->num_remaining_batches[job->node_index], 1) == 1) {
+            finish_graph_node(job->graph, job->node_index);
+        }
+    } else {
+        atomic_fetch_sub(&job->counter->num_pending, 1);
+    }
+}
+
+static void* run_worker_thread(void* arg) {
+    thread_index = (uint32_t)(uintptr_t)arg;
+
+    uint32_t num_idle_spins = 0;
+    while (!atomic_load(&stopping)) {
+        job_t job;
+        if (take_job(&job)) {
+            execute_job(&job);
+            num_idle_spins = 0;
+            continue;
+        }
+
+        if (++num_idle_spins < NUM_IDLE_SPINS) {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&sleep_mutex);
+        atomic_fetch_add(&num_sleeping_workers, 1);
+        while (atomic_load(&num_queued_jobs) == 0 && !atomic_load(&stopping)) {
+            pthread_cond_wait(&wake_condition, &sleep_mutex);
+        }
+        atomic_fetch_sub(&num_sleeping_workers, 1);
+        pthread_mutex_unlock(&sleep_mutex);
+        num_idle_spins = 0;
+    }
+
+    return NULL;
+}
+
+const char* init_job_system(uint32_t num_added_threads) {
+    // The initializing thread runs jobs while it waits, so one core is left for it
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t num_workers = num_cores > 1 ? (uint32_t)num_cores - 1 : 0;
+    num_reserved_threads = num_added_threads;
+
+    // JOB_WORKER_THREADS=0 runs every job on the thread that waits for it, to compare against
+    const char* num_workers_env = getenv("JOB_WORKER_THREADS");
+    if (num_workers_env != NULL) {
+        num_workers = (uint32_t)strtoul(num_workers_env, NULL, 10);
+    }
+    if (num_reserved_threads > MAX_JOB_THREADS - 1) {
+        return "Too many job threads reserved\n";
+    }
+    if (num_workers > MAX_JOB_THREADS - 1 - num_reserved_threads) {
+        num_workers = MAX_JOB_THREADS - 1 - num_reserved_threads;
+    }
+
+    uint32_t num_deques = 1 + num_reserved_threads + num_workers;
+    deques = aligned_alloc(alignof(job_deque_t), num_deques*sizeof(job_deque_t));
+    if (deques == NULL) {
+        return "Failed to allocate job deques\n";
+    }
+    for (uint32_t i = 0; i < num_deques; i++) {
+        atomic_init(&deques[i].top, 0);
+        atomic_init(&deques[i].bottom, 0);
+    }
+
+    // Set before any worker starts, thieves go over every deque
+    thread_index = 0;
+    num_threads = num_deques;
+    for (uint32_t i = 0; i < num_workers; i++) {
+        if (pthread_create(&worker_threads[i], NULL, run_worker_thread, (void*)(uintptr_t)(1 + num_reserved_threads + i)) != 0) {
+            return "Failed to start job worker thread\n";
+        }
+        num_started_workers++;
+    }
+
+    printf("Job system running on %u worker threads\n", num_workers);
+
+    return NULL;
+}
+
+result_t add_job_thread(void) {
+    uint32_t index = atomic_fetch_add(&num_claimed_threads, 1);
+    if (index >= num_reserved_threads || deques == NULL) {
+        return result_failure;
+    }
+
+    thread_index = 1 + index;
+    return result_success;
+}
+
+uint32_t get_num_job_threads(void) {
+    return num_threads;
+}
+
+void run_jobs(job_function_t function, void* context, uint32_t num_items, uint32_t batch_size, job_counter_t* counter) {
+    if (num_items == 0) {
+        return;
+    }
+
+    uint32_t num_batches = (num_items + batch_size - 1)/batch_size;
+    atomic_fetch_add(&counter->num_pending, num_batches);
+    for (uint32_t first = 0; first < num_items; first += batch_size) {
+        push_job(&(job_t) {
+            .function = function,
+            .context = context,
+            .first = first,
+            .end = num_items - first < batch_size ? num_items : first + batch_size,
+            .counter = counter
+        });
+    }
+}
+
+void wait_for_job_counter(job_counter_t* counter) {
+    while (atomic_load(&counter->num_pending) != 0) {
+        job_t job;
+        if (take_job(&job)) {
+            execute_job(&job);
+        } else {
+            // What is left is running on other threads
+            sched_yield();
+        }
+    }
+}
+
+void term_job_system(void) {
+    pthread_mutex_lock(&sleep_mutex);
+    atomic_store(&stopping, true);
+    pthread_cond_broadcast(&wake_condition);
+    pthread_mutex_unlock(&sleep_mutex);
+
+    for (uint32_t i = 0; i < num_started_workers; i++) {
+        pthread_join(worker_threads[i], NULL);
+    }
+    num_started_workers = 0;
+
+    free(deques);
+    deques = NULL;
+    num_threads = 1;
+    atomic_store(&num_claimed_threads, 0);
+}
+
+result_t compile_job_graph(uint32_t num_nodes, const job_graph_node_t nodes[], job_graph_t* graph) {
+    if (num_nodes > MAX_JOB_GRAPH_NODES) {
+        return result_failure;
+    }
+
+    graph->num_nodes = num_nodes;
+    graph->nodes = nodes;
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        graph->num_dependents[i] = 0;
+    }
+
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        const job_graph_node_t* node = &nodes[i];
+        if (node->batch_size == 0 || node->num_dependencies > MAX_JOB_GRAPH_DEPENDENCIES) {
+            return result_failure;
+        }
+
+        for (uint32_t j = 0; j < node->num_dependencies; j++) {
+            uint32_t dependency = node->dependencies[j];
+            if (dependency >= i) {
+                return result_failure;
+            }
+            graph->dependents[dependency][graph->num_dependents[dependency]++] = i;
+        }
+    }
+
+    atomic_init(&graph->counter.num_pending, 0);
+
+    return result_success;
+}
+
+void start_job_graph(job_graph_t* graph, const bool nodes_enabled[], void* context) {
+    graph->context = context;
+    atomic_store(&graph->counter.num_pending, graph->num_nodes);
+
+    // Everything is reset before the first node starts, as nodes may finish while later roots are still being started
+    for (uint32_t i = 0; i < graph->num_nodes; i++) {
+        graph->nodes_enabled[i] = nodes_enabled == NULL || nodes_enabled[i];
+        atomic_store(&graph->num_remaining_dependencies[i], graph->nodes[i].num_dependencies);
+    }
+
+    for (uint32_t i = 0; i < graph->num_nodes; i++) {
+        if (graph->nodes[i].num_dependencies == 0) {
+            start_graph_node(graph, i);
+        }
+    }
+}
+
+void run_job_graph(job_graph_t* graph, const bool nodes_enabled[], void* context) {
+    start_job_graph(graph, nodes_enabled, context);
+    wait_for_job_counter(&graph->counter);
+}
\ No newline at end of file
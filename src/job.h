@@ -0,0 +1,67 @@
+#pragma once
+#include "result.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// Including the thread that calls init_job_system and the ones added later, which run jobs whenever they wait on them
+#define MAX_JOB_THREADS 64
+#define MAX_JOB_GRAPH_NODES 32
+#define MAX_JOB_GRAPH_DEPENDENCIES 4
+
+// Runs items [first, end) of a job, jobs over many items are split into batches that run on different threads
+typedef void (*job_function_t)(void* context, uint32_t first, uint32_t end);
+
+// Batches or graph nodes still to finish, zero initialize before the first use
+typedef struct {
+    atomic_uint_least32_t num_pending;
+} job_counter_t;
+
+// Fixed worker threads with a work stealing deque each, JOB_WORKER_THREADS overrides the count of one less than the number of cores
+// Deques for num_added_threads more threads are reserved, so threads started later can push jobs as well
+const char* init_job_system(uint32_t num_added_threads);
+// Claims one of the reserved deques for the calling thread
+result_t add_job_thread(void);
+// Worker threads, the thread that initialized the system and the reserved ones
+uint32_t get_num_job_threads(void);
+// Pushes batches of up to batch_size items to the deque of the calling thread, other threads steal them from there
+// Threads without a deque run them right away
+void run_jobs(job_function_t function, void* context, uint32_t num_items, uint32_t batch_size, job_counter_t* counter);
+// Runs queued jobs of any thread until the counter reaches zero, so waiting within a job does not block a worker
+void wait_for_job_counter(job_counter_t* counter);
+// Every counter and graph has to have been waited on
+void term_job_system(void);
+
+// A node runs once all of its dependencies have finished, split into batches like run_jobs
+typedef struct {
+    const char* name;
+    job_function_t function;
+    uint32_t num_items;
+    uint32_t batch_size;
+    uint32_t num_dependencies;
+    // Indices of earlier nodes, so a graph can not have cycles
+    uint32_t dependencies[MAX_JOB_GRAPH_DEPENDENCIES];
+} job_graph_node_t;
+
+typedef struct {
+    uint32_t num_nodes;
+    const job_graph_node_t* nodes;
+    uint32_t num_dependents[MAX_JOB_GRAPH_NODES];
+    uint32_t dependents[MAX_JOB_GRAPH_NODES][MAX_JOB_GRAPH_NODES];
+
+    // Reset by every run
+    void* context;
+    bool nodes_enabled[MAX_JOB_GRAPH_NODES];
+    atomic_uint_least32_t num_remaining_dependencies[MAX_JOB_GRAPH_NODES];
+    atomic_uint_least32_t num_remaining_batches[MAX_JOB_GRAPH_NODES];
+    // Nodes of the current run not finished yet
+    job_counter_t counter;
+} job_graph_t;
+
+// The nodes have to outlive the graph
+result_t compile_job_graph(uint32_t num_nodes, const job_graph_node_t nodes[], job_graph_t* graph);
+// Starts the nodes without dependencies, wait_for_job_counter on the graph's counter before running it again
+// Disabled nodes finish right away, so their dependents still run
+void start_job_graph(job_graph_t* graph, const bool nodes_enabled[], void* context);
+// Starts the graph and runs jobs until it has finished
+void run_job_graph(job_graph_t* graph, const bool nodes_enabled[], void* context);
\ No newline at end of file
@@ -1,46 +1,304 @@
 #include "vk/core.h"
 #include "vk/render.h"
+#include "vk/render_scale.h"
+#include "vk/asset.h"
 #include "input.h"
 #include "chrono.h"
+#include "job.h"
+#include "frame_pipeline.h"
+#include "transform.h"
+#include "util.h"
 #include <stdbool.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <math.h>
+#include <cglm/struct/vec3.h>
+
+// The main thread simulates frame N + 1 while this thread records and submits frame N, see frame_pipeline.h
+static pthread_t render_thread;
+// Set by the render thread when a frame fails, read after it has been joined
+static const char* render_msg = NULL;
+
+// CPU time the render thread spends per frame excluding the frame limiter sleep, compared between builds with and without validation
+static size_t num_frames = 0;
+static microseconds_t total_frame_microseconds = 0;
+static microseconds_t max_frame_microseconds = 0;
+
+// The snapshot being simulated, begun before events are polled so the input it samples is as recent as possible
+static frame_snapshot_t* snapshot = NULL;
+static bool snapshot_simulated = false;
+// Zero extent as of the last sample, the render thread skips frames until the window is restored
+static bool window_minimized = false;
+
+static void* run_render_thread(void*) {
+    if (add_job_thread() != result_success) {
+        render_msg = "Failed to add render thread to job system\n";
+        stop_frame_pipeline();
+        return NULL;
+    }
+
+    while (true) {
+        // Time waiting for the previous present or for the simulation does not count as CPU time either
+        pace_vulkan_frame();
+        const frame_snapshot_t* frame_snapshot = take_frame_snapshot();
+        if (frame_snapshot == NULL) {
+            return NULL;
+        }
+
+        microseconds_t start = get_current_microseconds();
+        bool frame_drawn;
+        const char* msg = draw_vulkan_frame(frame_snapshot, &frame_drawn);
+        if (msg != NULL) {
+            render_msg = msg;
+            stop_frame_pipeline();
+            return NULL;
+        }
+        microseconds_t frame_microseconds = get_current_microseconds() - start;
+
+        // Skipped frames return right after a signaled fence without presenting, so nothing else would keep this loop from spinning
+        microseconds_t remaining_microseconds = (1000000l/60l) - frame_microseconds;
+        if (!frame_drawn) {
+            if (remaining_microseconds > 0) {
+                sleep_microseconds(remaining_microseconds);
+            }
+            continue;
+        }
+
+        num_frames++;
+        total_frame_microseconds += frame_microseconds;
+        if (frame_microseconds > max_frame_microseconds) {
+            max_frame_microseconds = frame_microseconds;
+        }
+
+        if (frame_microseconds > (1000000l/60l)) {
+            printf("%f\n", (double)frame_microseconds/1000000.0);
+        }
+
+        // FIFO modes are already paced by the display, the limiter only caps the ones that never block
+        bool present_mode_paced = present_mode == VK_PRESENT_MODE_FIFO_KHR || present_mode == VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+        if (!present_mode_paced && remaining_microseconds > 0) {
+            sleep_microseconds(remaining_microseconds);
+        }
+    }
+}
+
+// GLFW only reports the window on the main thread, the render thread resizes the swapchain by what the snapshot carries
+static void sample_window(frame_snapshot_t* frame_snapshot) {
+    int width;
+    int height;
+    glfwGetFramebufferSize(window, &width, &height);
+    frame_snapshot->window_extent = (VkExtent2D) { (uint32_t)width, (uint32_t)height };
+    window_minimized = width == 0 || height == 0;
+    frame_snapshot->window_resized = window_resized;
+    window_resized = false;
+}
+
+// Some platforms block in glfwPollEvents for as long as the window is being resized, publishing the last simulated state with the new size from here keeps the contents following it
+static void window_refresh(GLFWwindow*) {
+    if (snapshot == NULL || !snapshot_simulated) {
+        return;
+    }
+
+    // The window size is the input of this frame, measuring from the last simulated input would count the time spent resizing as latency
+    snapshot->input_microseconds = get_current_microseconds();
+    sample_window(snapshot);
+    publish_frame_snapshot();
+    // Waits only until the render thread takes the frame, which paces the refreshes while glfwPollEvents is blocked
+    snapshot = begin_frame_snapshot(false);
+}
+
+// Same layout as the grid init_vulkan_assets places, one root transform per cube
+#define CUBE_GRID_SIZE 9
+#define NUM_GRID_CUBES (CUBE_GRID_SIZE*CUBE_GRID_SIZE)
+static transform_store_t cube_transforms;
+// Material indices stay as zero initialized, write_world_transforms only writes the transforms
+static instance_t cube_instances[NUM_GRID_CUBES];
+
+static result_t init_cube_grid(void) {
+    if (init_transform_store(NUM_GRID_CUBES, &cube_transforms) != result_success) {
+        return result_failure;
+    }
+    for (float x = -4.0f; x <= 4.0f; x++) {
+        for (float y = -4.0f; y <= 4.0f; y++) {
+            if (add_transform(&cube_transforms, NULL_UINT32, (vec3s) {{ x * 8.0f, 1.0f, y * 8.0f }}, glms_quat_identity(), 1.0f) == NULL_UINT32) {
+                return result_failure;
+            }
+        }
+    }
+    return result_success;
+}
+
+// The cubes bob in a wave and turn, so instances change every frame
+static result_t simulate_cube_grid(float seconds) {
+    uint32_t i = 0;
+    for (float x = -4.0f; x <= 4.0f; x++) {
+        for (float y = -4.0f; y <= 4.0f; y++, i++) {
+            float phase = 2.0f*seconds + 0.5f*(x + y);
+            float height = 1.5f + 0.5f*sinf(phase);
+            set_local_transform(&cube_transforms, i, (vec3s) {{ x * 8.0f, height, y * 8.0f }}, glms_quatv(0.5f*phase, (vec3s) {{ 0.0f, 1.0f, 0.0f }}), 1.0f);
+        }
+    }
+
+    compute_world_transforms(&cube_transforms);
+    write_world_transforms(&cube_transforms, 0, NUM_GRID_CUBES, cube_instances);
+    return update_instances(first_instances_array[0], NUM_GRID_CUBES, cube_instances);
+}
+
+// The simulation of a frame once input has been handled, the sort reads the positions the cube grid writes and the updates are taken once they are final
+// Sorting and taking the updates touch separate state, so they run alongside each other
+typedef enum {
+    simulation_cube_grid_job,
+    simulation_sort_job,
+    simulation_take_updates_job,
+    NUM_SIMULATION_JOBS
+} simulation_job_t;
+
+typedef struct {
+    float seconds;
+    frame_snapshot_t* snapshot;
+    // Written by the cube grid job
+    result_t cube_grid_result;
+} simulation_jobs_context_t;
+
+static void run_cube_grid_job(void* context, uint32_t, uint32_t);
+static void run_sort_job(void* context, uint32_t, uint32_t);
+static void run_take_updates_job(void* context, uint32_t, uint32_t);
+
+static const job_graph_node_t simulation_job_nodes[NUM_SIMULATION_JOBS] = {
+    [simulation_cube_grid_job] = { .name = "cube grid", .function = run_cube_grid_job, .num_items = 1, .batch_size = 1 },
+    [simulation_sort_job] = {
+        .name = "sort instances",
+        .function = run_sort_job,
+        .num_items = 1,
+        .batch_size = 1,
+        .num_dependencies = 1,
+        .dependencies = { simulation_cube_grid_job }
+    },
+    [simulation_take_updates_job] = {
+        .name = "take instance updates",
+        .function = run_take_updates_job,
+        .num_items = 1,
+        .batch_size = 1,
+        .num_dependencies = 1,
+        .dependencies = { simulation_cube_grid_job }
+    }
+};
+
+static job_graph_t simulation_job_graph;
+
+static void run_cube_grid_job(void* context, uint32_t, uint32_t) {
+    simulation_jobs_context_t* jobs = context;
+    jobs->cube_grid_result = simulate_cube_grid(jobs->seconds);
+}
+
+static void run_sort_job(void* context, uint32_t, uint32_t) {
+    const simulation_jobs_context_t* jobs = context;
+    sort_instances_front_to_back(glms_vec3(jobs->snapshot->camera_position), jobs->snapshot->instance_order);
+}
+
+static void run_take_updates_job(void* context, uint32_t, uint32_t) {
+    const simulation_jobs_context_t* jobs = context;
+    take_instance_updates(&jobs->snapshot->instance_updates);
+}
 
 int main(void) {
-    const char* msg = init_vulkan_core();
+    // Asset loading already runs jobs, GLFW and input stay on this thread since GLFW requires events to be handled on the main thread
+    // One more deque is reserved for the render thread, which runs the frame job graph
+    const char* msg = init_job_system(1);
+    if (msg != NULL) {
+        printf("%s", msg);
+        return 1;
+    }
+
+    msg = init_vulkan_core();
     if (msg != NULL) {
         printf("%s", msg);
         return 1;
     }
 
-    microseconds_t program_start = get_current_microseconds();
+    if (init_cube_grid() != result_success) {
+        printf("Failed to create cube transforms\n");
+        return 1;
+    }
 
-    float delta = 1.0f/60.0f;
-    while (!glfwWindowShouldClose(window)) {
-        microseconds_t start = get_current_microseconds() - program_start;
-        glfwPollEvents();
+    if (compile_job_graph(NUM_SIMULATION_JOBS, simulation_job_nodes, &simulation_job_graph) != result_success) {
+        printf("Failed to compile simulation job graph\n");
+        return 1;
+    }
 
-        handle_input(delta);
+    init_input();
+    glfwSetWindowRefreshCallback(window, window_refresh);
 
-        msg = draw_vulkan_frame();
-        if (msg != NULL) {
-            printf("%s", msg);
-            return 1;
+    if (pthread_create(&render_thread, NULL, run_render_thread, NULL) != 0) {
+        printf("Failed to start render thread\n");
+        return 1;
+    }
+
+    microseconds_t start_microseconds = get_current_microseconds();
+    microseconds_t previous_input_microseconds = start_microseconds;
+    while (!glfwWindowShouldClose(window)) {
+        // The low latency policy samples input only once the render thread is ready to draw it, otherwise while it draws the previous frame
+        snapshot = begin_frame_snapshot(get_requested_present_policy() == present_policy_low_latency);
+        if (snapshot == NULL) {
+            break;
         }
-        microseconds_t end = get_current_microseconds() - program_start;
-        microseconds_t delta_microseconds = end - start;
-        delta = (float)delta_microseconds/1000000.0f;
 
-        if (delta > (1.0f/60.0f)) {
-            printf("%f\n", delta);
+        // Nothing is drawn while minimized, so wait for the restore instead of simulating frames no one sees
+        if (window_minimized) {
+            glfwWaitEventsTimeout(0.1);
+        } else {
+            glfwPollEvents();
+        }
+        // Stopped while a refresh waited for the render thread
+        if (snapshot == NULL) {
+            break;
         }
 
-        microseconds_t remaining_microseconds = (1000000l/60l) - delta_microseconds;
-        if (remaining_microseconds > 0) {
-            sleep_microseconds(remaining_microseconds);
+        microseconds_t input_microseconds = get_current_microseconds();
+        float delta = (float)(input_microseconds - previous_input_microseconds)/1000000.0f;
+        previous_input_microseconds = input_microseconds;
+
+        snapshot->input_microseconds = input_microseconds;
+        sample_window(snapshot);
+        handle_input(delta, snapshot);
+        simulation_jobs_context_t simulation_jobs_context = {
+            .seconds = (float)(input_microseconds - start_microseconds)/1000000.0f,
+            .snapshot = snapshot
+        };
+        run_job_graph(&simulation_job_graph, NULL, &simulation_jobs_context);
+        if (simulation_jobs_context.cube_grid_result != result_success) {
+            msg = "Failed to update instances\n";
+            break;
         }
+
+        publish_frame_snapshot();
+        snapshot_simulated = true;
+    }
+
+    stop_frame_pipeline();
+    pthread_join(render_thread, NULL);
+    if (msg != NULL) {
+        printf("%s", msg);
+        return 1;
+    }
+    if (render_msg != NULL) {
+        printf("%s", render_msg);
+        return 1;
+    }
+
+    if (num_frames > 0) {
+        printf("Average frame time %ldus, max %ldus over %zu frames (validation layers %s)\n", total_frame_microseconds / (microseconds_t)num_frames, max_frame_microseconds, num_frames, validation_enabled ? "enabled" : "disabled");
+    }
+    if (present_latency.num_presents > 0) {
+        printf("Average input to present latency %ldus, max %ldus over %zu presents (present policy %s)\n", present_latency.total_microseconds / (microseconds_t)present_latency.num_presents, present_latency.max_microseconds, present_latency.num_presents, present_policy_infos[present_policy].name);
+    }
+    if (gpu_scene_time.num_frames > 0) {
+        printf("Average GPU scene time %ldus, max %ldus over %zu frames (final render scale %.2f)\n", gpu_scene_time.total_microseconds / (microseconds_t)gpu_scene_time.num_frames, gpu_scene_time.max_microseconds, gpu_scene_time.num_frames, (double)render_scale);
     }
 
+    term_transform_store(&cube_transforms);
     term_vulkan_all();
+    term_job_system();
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,162 @@
+#include "mipmap.h"
+#include "util.h"
+#include <math.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdalign.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define LINEAR_TO_SRGB_TABLE_SIZE 16384
+
+alignas(64)
+static float srgb_to_linear_table[256];
+static uint8_t linear_to_srgb_table[LINEAR_TO_SRGB_TABLE_SIZE];
+static pthread_once_t srgb_tables_once = PTHREAD_ONCE_INIT;
+
+static void init_srgb_tables(void) {
+    for (size_t i = 0; i < 256; i++) {
+        float value = (float)i / 255.0f;
+        srgb_to_linear_table[i] = value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+    }
+    for (size_t i = 0; i < LINEAR_TO_SRGB_TABLE_SIZE; i++) {
+        float value = (float)i / (float)(LINEAR_TO_SRGB_TABLE_SIZE - 1);
+        float srgb_value = value <= 0.0031308f ? value * 12.92f : (1.055f * powf(value, 1.0f / 2.4f)) - 0.055f;
+        linear_to_srgb_table[i] = (uint8_t)((srgb_value * 255.0f) + 0.5f);
+    }
+}
+
+uint32_t get_num_mip_levels(uint32_t width, uint32_t height) {
+    uint32_t num_mip_levels = 1;
+    for (uint32_t size = max_uint32(width, height); size > 1; size /= 2) {
+        num_mip_levels++;
+    }
+    return num_mip_levels;
+}
+
+size_t get_mip_chain_layout(uint32_t width, uint32_t height, uint32_t num_mip_levels, uint32_t num_layers, uint32_t num_pixel_bytes, mip_level_t levels[]) {
+    // Buffer to image copy offsets have to be a multiple of both 4 and the texel size
+    size_t alignment = 4ul * num_pixel_bytes;
+
+    size_t offset = 0;
+    for (uint32_t i = 0; i < num_mip_levels; i++) {
+        levels[i] = (mip_level_t) {
+            .width = width,
+            .height = height,
+            .offset = offset
+        };
+
+        offset += (size_t)width * height * num_pixel_bytes * num_layers;
+        offset = offset % alignment == 0 ? offset : offset + (alignment - (offset % alignment));
+
+        if (width > 1) { width /= 2; }
+        if (height > 1) { height /= 2; }
+    }
+
+    return offset;
+}
+
+static void sum_rows(const uint8_t* row0, const uint8_t* row1, uint16_t* sums, size_t num_bytes) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= num_bytes; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(row0 + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(row1 + i));
+        _mm_storeu_si128((__m128i*)(sums + i), _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)));
+        _mm_storeu_si128((__m128i*)(sums + i + 8), _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= num_bytes; i += 8) {
+        vst1q_u16(sums + i, vaddl_u8(vld1_u8(row0 + i), vld1_u8(row1 + i)));
+    }
+#endif
+    for (; i < num_bytes; i++) {
+        sums[i] = (uint16_t)(row0[i] + row1[i]);
+    }
+}
+
+static void sum_linear_rows(const uint8_t* row0, const uint8_t* row1, float* sums, size_t num_bytes, uint32_t num_pixel_bytes) {
+    for (size_t i = 0; i < num_bytes; i++) {
+        if (num_pixel_bytes == 4 && i % 4 == 3) {
+            sums[i] = (float)(row0[i] + row1[i]) / 255.0f;
+        } else {
+            sums[i] = srgb_to_linear_table[row0[i]] + srgb_to_linear_table[row1[i]];
+        }
+    }
+}
+
+static void downsample(
+    const uint8_t* src, const mip_level_t* src_level,
+    uint8_t* dst, const mip_level_t* dst_level,
+    uint32_t num_pixel_bytes, bool srgb, uint16_t* row_sums, float* linear_row_sums
+) {
+    size_t src_row_bytes = (size_t)src_level->width * num_pixel_bytes;
+
+    for (uint32_t y = 0; y < dst_level->height; y++) {
+        const uint8_t* row0 = src + ((size_t)(2 * y) * src_row_bytes);
+        const uint8_t* row1 = src + ((size_t)clamp_uint32((2 * y) + 1, 0, src_level->height - 1) * src_row_bytes);
+        uint8_t* dst_row = dst + ((size_t)y * dst_level->width * num_pixel_bytes);
+
+        if (srgb) {
+            sum_linear_rows(row0, row1, linear_row_sums, src_row_bytes, num_pixel_bytes);
+        } else {
+            sum_rows(row0, row1, row_sums, src_row_bytes);
+        }
+
+        for (uint32_t x = 0; x < dst_level->width; x++) {
+            size_t i0 = (size_t)(2 * x) * num_pixel_bytes;
+            size_t i1 = (size_t)clamp_uint32((2 * x) + 1, 0, src_level->width - 1) * num_pixel_bytes;
+            uint8_t* dst_pixel = dst_row + ((size_t)x * num_pixel_bytes);
+
+            for (size_t c = 0; c < num_pixel_bytes; c++) {
+                if (!srgb) {
+                    dst_pixel[c] = (uint8_t)((row_sums[i0 + c] + row_sums[i1 + c] + 2) >> 2);
+                    continue;
+                }
+
+                float average = 0.25f * (linear_row_sums[i0 + c] + linear_row_sums[i1 + c]);
+                if (num_pixel_bytes == 4 && c == 3) {
+                    dst_pixel[c] = (uint8_t)((average * 255.0f) + 0.5f);
+                } else {
+                    dst_pixel[c] = linear_to_srgb_table[(size_t)((average * (float)(LINEAR_TO_SRGB_TABLE_SIZE - 1)) + 0.5f)];
+                }
+            }
+        }
+    }
+}
+
+void generate_mip_chain(void* chain, uint32_t num_mip_levels, uint32_t num_layers, uint32_t num_pixel_bytes, bool srgb, const mip_level_t levels[]) {
+    if (num_mip_levels <= 1) {
+        return;
+    }
+
+    if (srgb) {
+        pthread_once(&srgb_tables_once, init_srgb_tables);
+    }
+
+    size_t num_row_bytes = (size_t)levels[0].width * num_pixel_bytes;
+    uint16_t* row_sums = memalign(64, num_row_bytes*sizeof(uint16_t));
+    float* linear_row_sums = memalign(64, num_row_bytes*sizeof(float));
+
+    for (uint32_t i = 1; i < num_mip_levels; i++) {
+        const mip_level_t* src_level = &levels[i - 1];
+        const mip_level_t* dst_level = &levels[i];
+
+        size_t num_src_layer_bytes = (size_t)src_level->width * src_level->height * num_pixel_bytes;
+        size_t num_dst_layer_bytes = (size_t)dst_level->width * dst_level->height * num_pixel_bytes;
+
+        for (uint32_t j = 0; j < num_layers; j++) {
+            const uint8_t* src = (const uint8_t*)chain + src_level->offset + (j * num_src_layer_bytes);
+            uint8_t* dst = (uint8_t*)chain + dst_level->offset + (j * num_dst_layer_bytes);
+
+            downsample(src, src_level, dst, dst_level, num_pixel_bytes, srgb, row_sums, linear_row_sums);
+        }
+    }
+
+    free(row_sums);
+    free(linear_row_sums);
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    size_t offset;
+} mip_level_t;
+
+// Enough for any 32 bit extent
+#define MAX_MIP_LEVELS 32
+
+uint32_t get_num_mip_levels(uint32_t width, uint32_t height);
+
+// Levels are stored one after another, each level holding every layer tightly packed, so a single buffer to image copy region can upload a whole level
+size_t get_mip_chain_layout(uint32_t width, uint32_t height, uint32_t num_mip_levels, uint32_t num_layers, uint32_t num_pixel_bytes, mip_level_t levels[]);
+
+// Expects level 0 of every layer to already be written, fills in the rest with a 2x2 box filter (averaged in linear space when srgb is set, alpha is always linear)
+void generate_mip_chain(void* chain, uint32_t num_mip_levels, uint32_t num_layers, uint32_t num_pixel_bytes, bool srgb, const mip_level_t levels[]);
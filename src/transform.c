@@ -0,0 +1,387 @@
+#include "transform.h"
+#include "util.h"
+#include <malloc.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdalign.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TRANSFORM_AVX2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TRANSFORM_NEON
+#endif
+
+// Every array starts on its own cache line
+#define TRANSFORM_ARRAY_ALIGNMENT 16
+
+result_t init_transform_store(uint32_t max_transforms, transform_store_t* store) {
+    size_t num_array_elements = (max_transforms + TRANSFORM_ARRAY_ALIGNMENT - 1) & ~(size_t)(TRANSFORM_ARRAY_ALIGNMENT - 1);
+    // Parent indices and the 16 local and world components, all 4 bytes
+    uint8_t* data = memalign(64, 17*num_array_elements*sizeof(float));
+    if (data == NULL) {
+        return result_failure;
+    }
+
+    *store = (transform_store_t) { .max_transforms = max_transforms };
+
+    size_t array_bytes = num_array_elements*sizeof(float);
+    store->parent_indices = (uint32_t*)data;
+    float* arrays = (float*)(data + array_bytes);
+    for (size_t i = 0; i < 3; i++) {
+        store->local_positions[i] = &arrays[(0 + i)*num_array_elements];
+        store->world_positions[i] = &arrays[(8 + i)*num_array_elements];
+    }
+    for (size_t i = 0; i < 4; i++) {
+        store->local_rotations[i] = &arrays[(3 + i)*num_array_elements];
+        store->world_rotations[i] = &arrays[(11 + i)*num_array_elements];
+    }
+    store->local_scales = &arrays[7*num_array_elements];
+    store->world_scales = &arrays[15*num_array_elements];
+
+    return result_success;
+}
+
+void set_local_transform(transform_store_t* store, uint32_t transform_index, vec3s position, versors rotation, float scale) {
+    versors unit_rotation = glms_quat_normalize(rotation);
+    for (size_t i = 0; i < 3; i++) {
+        store->local_positions[i][transform_index] = position.raw[i];
+    }
+    for (size_t i = 0; i < 4; i++) {
+        store->local_rotations[i][transform_index] = unit_rotation.raw[i];
+    }
+    store->local_scales[transform_index] = scale;
+}
+
+uint32_t add_transform(transform_store_t* store, uint32_t parent_index, vec3s position, versors rotation, float scale) {
+    if (store->num_transforms == store->max_transforms) {
+        return NULL_UINT32;
+    }
+
+    uint32_t level = 0;
+    if (parent_index != NULL_UINT32) {
+        if (parent_index >= store->num_transforms) {
+            return NULL_UINT32;
+        }
+        while (store->level_ends[level] <= parent_index) {
+            level++;
+        }
+        level++;
+    }
+
+    // Breadth first, so a transform either joins the last level or starts the next one
+    if (store->num_levels > 0 && level + 1 < store->num_levels) {
+        return NULL_UINT32;
+    }
+    if (level == store->num_levels) {
+        if (level == MAX_TRANSFORM_LEVELS) {
+            return NULL_UINT32;
+        }
+        store->num_levels++;
+    }
+
+    uint32_t transform_index = store->num_transforms++;
+    store->level_ends[level] = store->num_transforms;
+    store->parent_indices[transform_index] = parent_index;
+    set_local_transform(store, transform_index, position, rotation, scale);
+
+    return transform_index;
+}
+
+void term_transform_store(transform_store_t* store) {
+    free(store->parent_indices);
+    *store = (transform_store_t) { 0 };
+}
+
+// World rotation is the parent's times the local one, world position is the local position scaled and rotated by the parent and then moved to it
+static void compose_transforms_scalar(transform_store_t* store, uint32_t begin, uint32_t end) {
+    for (uint32_t i = begin; i < end; i++) {
+        uint32_t parent = store->parent_indices[i];
+
+        float parent_scale = store->world_scales[parent];
+        float ax = store->world_rotations[0][parent];
+        float ay = store->world_rotations[1][parent];
+        float az = store->world_rotations[2][parent];
+        float aw = store->world_rotations[3][parent];
+
+        float bx = store->local_rotations[0][i];
+        float by = store->local_rotations[1][i];
+        float bz = store->local_rotations[2][i];
+        float bw = store->local_rotations[3][i];
+
+        store->world_rotations[0][i] = aw*bx + ax*bw + ay*bz - az*by;
+        store->world_rotations[1][i] = aw*by - ax*bz + ay*bw + az*bx;
+        store->world_rotations[2][i] = aw*bz + ax*by - ay*bx + az*bw;
+        store->world_rotations[3][i] = aw*bw - ax*bx - ay*by - az*bz;
+        store->world_scales[i] = parent_scale*store->local_scales[i];
+
+        float vx = parent_scale*store->local_positions[0][i];
+        float vy = parent_scale*store->local_positions[1][i];
+        float vz = parent_scale*store->local_positions[2][i];
+
+        // v + w*t + cross(q, t) with t = 2*cross(q, v)
+        float tx = 2.0f*(ay*vz - az*vy);
+        float ty = 2.0f*(az*vx - ax*vz);
+        float tz = 2.0f*(ax*vy - ay*vx);
+
+        store->world_positions[0][i] = store->world_positions[0][parent] + vx + aw*tx + (ay*tz - az*ty);
+        store->world_positions[1][i] = store->world_positions[1][parent] + vy + aw*ty + (az*tx - ax*tz);
+        store->world_positions[2][i] = store->world_positions[2][parent] + vz + aw*tz + (ax*ty - ay*tx);
+    }
+}
+
+static void write_transforms_scalar(const transform_store_t* store, uint32_t begin, uint32_t end, instance_t instances[]) {
+    for (uint32_t i = begin; i < end; i++) {
+        instance_t* instance = &instances[i - begin];
+        instance->position = (vec3s) {{ store->world_positions[0][i], store->world_positions[1][i], store->world_positions[2][i] }};
+        instance->scale = store->world_scales[i];
+        for (size_t j = 0; j < 4; j++) {
+            instance->rotation[j] = pack_half_float(store->world_rotations[j][i]);
+        }
+    }
+}
+
+#ifdef TRANSFORM_AVX2
+__attribute__((target("avx2,fma")))
+static void compose_transforms_avx2(transform_store_t* store, uint32_t begin, uint32_t end) {
+    const __m256 two = _mm256_set1_ps(2.0f);
+
+    uint32_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        // Parents are in earlier levels, so their world transforms are final
+        __m256i parents = _mm256_loadu_si256((const __m256i*)&store->parent_indices[i]);
+
+        __m256 parent_scale = _mm256_i32gather_ps(store->world_scales, parents, 4);
+        __m256 ax = _mm256_i32gather_ps(store->world_rotations[0], parents, 4);
+        __m256 ay = _mm256_i32gather_ps(store->world_rotations[1], parents, 4);
+        __m256 az = _mm256_i32gather_ps(store->world_rotations[2], parents, 4);
+        __m256 aw = _mm256_i32gather_ps(store->world_rotations[3], parents, 4);
+
+        __m256 bx = _mm256_loadu_ps(&store->local_rotations[0][i]);
+        __m256 by = _mm256_loadu_ps(&store->local_rotations[1][i]);
+        __m256 bz = _mm256_loadu_ps(&store->local_rotations[2][i]);
+        __m256 bw = _mm256_loadu_ps(&store->local_rotations[3][i]);
+
+        _mm256_storeu_ps(&store->world_rotations[0][i], _mm256_fnmadd_ps(az, by, _mm256_fmadd_ps(ay, bz, _mm256_fmadd_ps(ax, bw, _mm256_mul_ps(aw, bx)))));
+        _mm256_storeu_ps(&store->world_rotations[1][i], _mm256_fmadd_ps(az, bx, _mm256_fmadd_ps(ay, bw, _mm256_fnmadd_ps(ax, bz, _mm256_mul_ps(aw, by)))));
+        _mm256_storeu_ps(&store->world_rotations[2][i], _mm256_fmadd_ps(az, bw, _mm256_fnmadd_ps(ay, bx, _mm256_fmadd_ps(ax, by, _mm256_mul_ps(aw, bz)))));
+        _mm256_storeu_ps(&store->world_rotations[3][i], _mm256_fnmadd_ps(az, bz, _mm256_fnmadd_ps(ay, by, _mm256_fnmadd_ps(ax, bx, _mm256_mul_ps(aw, bw)))));
+        _mm256_storeu_ps(&store->world_scales[i], _mm256_mul_ps(parent_scale, _mm256_loadu_ps(&store->local_scales[i])));
+
+        __m256 vx = _mm256_mul_ps(parent_scale, _mm256_loadu_ps(&store->local_positions[0][i]));
+        __m256 vy = _mm256_mul_ps(parent_scale, _mm256_loadu_ps(&store->local_positions[1][i]));
+        __m256 vz = _mm256_mul_ps(parent_scale, _mm256_loadu_ps(&store->local_positions[2][i]));
+
+        __m256 tx = _mm256_mul_ps(two, _mm256_fmsub_ps(ay, vz, _mm256_mul_ps(az, vy)));
+        __m256 ty = _mm256_mul_ps(two, _mm256_fmsub_ps(az, vx, _mm256_mul_ps(ax, vz)));
+        __m256 tz = _mm256_mul_ps(two, _mm256_fmsub_ps(ax, vy, _mm256_mul_ps(ay, vx)));
+
+        __m256 px = _mm256_i32gather_ps(store->world_positions[0], parents, 4);
+        __m256 py = _mm256_i32gather_ps(store->world_positions[1], parents, 4);
+        __m256 pz = _mm256_i32gather_ps(store->world_positions[2], parents, 4);
+
+        _mm256_storeu_ps(&store->world_positions[0][i], _mm256_add_ps(_mm256_add_ps(px, vx), _mm256_fmadd_ps(aw, tx, _mm256_fmsub_ps(ay, tz, _mm256_mul_ps(az, ty)))));
+        _mm256_storeu_ps(&store->world_positions[1][i], _mm256_add_ps(_mm256_add_ps(py, vy), _mm256_fmadd_ps(aw, ty, _mm256_fmsub_ps(az, tx, _mm256_mul_ps(ax, tz)))));
+        _mm256_storeu_ps(&store->world_positions[2][i], _mm256_add_ps(_mm256_add_ps(pz, vz), _mm256_fmadd_ps(aw, tz, _mm256_fmsub_ps(ax, ty, _mm256_mul_ps(ay, tx)))));
+    }
+
+    compose_transforms_scalar(store, i, end);
+}
+
+// Rotations are converted with F16C, everything else is only rearranged from structure of arrays into instances
+__attribute__((target("avx2,f16c")))
+static void write_transforms_avx2(const transform_store_t* store, uint32_t begin, uint32_t end, instance_t instances[]) {
+    uint32_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        alignas(16) uint16_t halves[4][8];
+        for (size_t j = 0; j < 4; j++) {
+            _mm_store_si128((__m128i*)halves[j], _mm256_cvtps_ph(_mm256_loadu_ps(&store->world_rotations[j][i]), _MM_FROUND_TO_NEAREST_INT));
+        }
+
+        for (uint32_t j = 0; j < 8; j++) {
+            instance_t* instance = &instances[i + j - begin];
+            instance->position = (vec3s) {{ store->world_positions[0][i + j], store->world_positions[1][i + j], store->world_positions[2][i + j] }};
+            instance->scale = store->world_scales[i + j];
+            instance->rotation[0] = halves[0][j];
+            instance->rotation[1] = halves[1][j];
+            instance->rotation[2] = halves[2][j];
+            instance->rotation[3] = halves[3][j];
+        }
+    }
+
+    write_transforms_scalar(store, i, end, &instances[i - begin]);
+}
+
+static bool is_avx2_supported(void) {
+    static int supported = -1;
+    if (supported == -1) {
+        __builtin_cpu_init();
+        supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+    }
+    return supported;
+}
+#endif
+
+#ifdef TRANSFORM_NEON
+static inline float32x4_t gather_neon(const float* values, const uint32_t parents[4]) {
+    return (float32x4_t) { values[parents[0]], values[parents[1]], values[parents[2]], values[parents[3]] };
+}
+
+// Part of the AArch64 baseline, so there is no runtime check, gathers are done with scalar loads since NEON has none
+static void compose_transforms_neon(transform_store_t* store, uint32_t begin, uint32_t end) {
+    uint32_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        const uint32_t* parents = &store->parent_indices[i];
+
+        float32x4_t parent_scale = gather_neon(store->world_scales, parents);
+        float32x4_t ax = gather_neon(store->world_rotations[0], parents);
+        float32x4_t ay = gather_neon(store->world_rotations[1], parents);
+        float32x4_t az = gather_neon(store->world_rotations[2], parents);
+        float32x4_t aw = gather_neon(store->world_rotations[3], parents);
+
+        float32x4_t bx = vld1q_f32(&store->local_rotations[0][i]);
+        float32x4_t by = vld1q_f32(&store->local_rotations[1][i]);
+        float32x4_t bz = vld1q_f32(&store->local_rotations[2][i]);
+        float32x4_t bw = vld1q_f32(&store->local_rotations[3][i]);
+
+        vst1q_f32(&store->world_rotations[0][i], vfmsq_f32(vfmaq_f32(vfmaq_f32(vmulq_f32(aw, bx), ax, bw), ay, bz), az, by));
+        vst1q_f32(&store->world_rotations[1][i], vfmaq_f32(vfmaq_f32(vfmsq_f32(vmulq_f32(aw, by), ax, bz), ay, bw), az, bx));
+        vst1q_f32(&store->world_rotations[2][i], vfmaq_f32(vfmsq_f32(vfmaq_f32(vmulq_f32(aw, bz), ax, by), ay, bx), az, bw));
+        vst1q_f32(&store->world_rotations[3][i], vfmsq_f32(vfmsq_f32(vfmsq_f32(vmulq_f32(aw, bw), ax, bx), ay, by), az, bz));
+        vst1q_f32(&store->world_scales[i], vmulq_f32(parent_scale, vld1q_f32(&store->local_scales[i])));
+
+        float32x4_t vx = vmulq_f32(parent_scale, vld1q_f32(&store->local_positions[0][i]));
+        float32x4_t vy = vmulq_f32(parent_scale, vld1q_f32(&store->local_positions[1][i]));
+        float32x4_t vz = vmulq_f32(parent_scale, vld1q_f32(&store->local_positions[2][i]));
+
+        float32x4_t tx = vmulq_n_f32(vfmsq_f32(vmulq_f32(ay, vz), az, vy), 2.0f);
+        float32x4_t ty = vmulq_n_f32(vfmsq_f32(vmulq_f32(az, vx), ax, vz), 2.0f);
+        float32x4_t tz = vmulq_n_f32(vfmsq_f32(vmulq_f32(ax, vy), ay, vx), 2.0f);
+
+        float32x4_t px = gather_neon(store->world_positions[0], parents);
+        float32x4_t py = gather_neon(store->world_positions[1], parents);
+        float32x4_t pz = gather_neon(store->world_positions[2], parents);
+
+        vst1q_f32(&store->world_positions[0][i], vaddq_f32(vaddq_f32(px, vx), vfmaq_f32(vfmsq_f32(vmulq_f32(ay, tz), az, ty), aw, tx)));
+        vst1q_f32(&store->world_positions[1][i], vaddq_f32(vaddq_f32(py, vy), vfmaq_f32(vfmsq_f32(vmulq_f32(az, tx), ax, tz), aw, ty)));
+        vst1q_f32(&store->world_positions[2][i], vaddq_f32(vaddq_f32(pz, vz), vfmaq_f32(vfmsq_f32(vmulq_f32(ax, ty), ay, tx), aw, tz)));
+    }
+
+    compose_transforms_scalar(store, i, end);
+}
+
+static void write_transforms_neon(const transform_store_t* store, uint32_t begin, uint32_t end, instance_t instances[]) {
+    uint32_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        uint16_t halves[4][4];
+        for (size_t j = 0; j < 4; j++) {
+            vst1_u16(halves[j], vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(&store->world_rotations[j][i]))));
+        }
+
+        for (uint32_t j = 0; j < 4; j++) {
+            instance_t* instance = &instances[i + j - begin];
+            instance->position = (vec3s) {{ store->world_positions[0][i + j], store->world_positions[1][i + j], store->world_positions[2][i + j] }};
+            instance->scale = store->world_scales[i + j];
+            instance->rotation[0] = halves[0][j];
+            instance->rotation[1] = halves[1][j];
+            instance->rotation[2] = halves[2][j];
+            instance->rotation[3] = halves[3][j];
+        }
+    }
+
+    write_transforms_scalar(store, i, end, &instances[i - begin]);
+}
+#endif
+
+static void copy_root_transforms(transform_store_t* store) {
+    size_t num_root_bytes = store->num_levels == 0 ? 0 : store->level_ends[0]*sizeof(float);
+    for (size_t i = 0; i < 3; i++) {
+        memcpy(store->world_positions[i], store->local_positions[i], num_root_bytes);
+    }
+    for (size_t i = 0; i < 4; i++) {
+        memcpy(store->world_rotations[i], store->local_rotations[i], num_root_bytes);
+    }
+    memcpy(store->world_scales, store->local_scales, num_root_bytes);
+}
+
+void compute_world_transforms_scalar(transform_store_t* store) {
+    copy_root_transforms(store);
+    for (uint32_t level = 1; level < store->num_levels; level++) {
+        compose_transforms_scalar(store, store->level_ends[level - 1], store->level_ends[level]);
+    }
+}
+
+void compute_world_transforms(transform_store_t* store) {
+#if defined(TRANSFORM_AVX2)
+    if (!is_avx2_supported()) {
+        compute_world_transforms_scalar(store);
+        return;
+    }
+    copy_root_transforms(store);
+    for (uint32_t level = 1; level < store->num_levels; level++) {
+        compose_transforms_avx2(store, store->level_ends[level - 1], store->level_ends[level]);
+    }
+#elif defined(TRANSFORM_NEON)
+    copy_root_transforms(store);
+    for (uint32_t level = 1; level < store->num_levels; level++) {
+        compose_transforms_neon(store, store->level_ends[level - 1], store->level_ends[level]);
+    }
+#else
+    compute_world_transforms_scalar(store);
+#endif
+}
+
+void write_world_transforms_scalar(const transform_store_t* store, uint32_t first_transform, uint32_t num_transforms, instance_t instances[]) {
+    write_transforms_scalar(store, first_transform, first_transform + num_transforms, instances);
+}
+
+void write_world_transforms(const transform_store_t* store, uint32_t first_transform, uint32_t num_transforms, instance_t instances[]) {
+#if defined(TRANSFORM_AVX2)
+    if (is_avx2_supported()) {
+        write_transforms_avx2(store, first_transform, first_transform + num_transforms, instances);
+        return;
+    }
+#elif defined(TRANSFORM_NEON)
+    write_transforms_neon(store, first_transform, first_transform + num_transforms, instances);
+    return;
+#endif
+    write_transforms_scalar(store, first_transform, first_transform + num_transforms, instances);
+}
+
+const char* get_transform_kernel_name(void) {
+#if defined(TRANSFORM_AVX2)
+    return is_avx2_supported() ? "AVX2" : "scalar";
+#elif defined(TRANSFORM_NEON)
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
+
+// Round to nearest, subnormals are kept and everything too large becomes infinity
+uint16_t pack_half_float(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000u);
+    int32_t exponent = (int32_t)((bits >> 23) & 0xffu) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffffu;
+
+    if (exponent <= 0) {
+        if (exponent < -10) {
+            return sign;
+        }
+        mantissa |= 0x800000u;
+        uint32_t shift = (uint32_t)(14 - exponent);
+        uint32_t half_mantissa = (mantissa >> shift) + ((mantissa >> (shift - 1)) & 1u);
+        return (uint16_t)(sign | half_mantissa);
+    }
+    if (exponent >= 31) {
+        return (uint16_t)(sign | 0x7c00u);
+    }
+
+    // A carry out of the mantissa rounds up into the exponent, which is still correct
+    uint32_t half = (((uint32_t)exponent << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1u);
+    return (uint16_t)(sign | half);
+}
\ No newline at end of file
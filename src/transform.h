@@ -0,0 +1,49 @@
+#pragma once
+#include "result.h"
+#include "vk/asset.h"
+#include <stdint.h>
+#include <cglm/struct/vec3.h>
+#include <cglm/struct/quat.h>
+
+#define MAX_TRANSFORM_LEVELS 16
+
+// Uniformly scaled, rotated and translated like instance_t, kept as structure of arrays so whole batches are composed with SIMD
+// Transforms are added breadth first, so every level only has parents in earlier levels and is composed without dependencies within it
+typedef struct {
+    uint32_t num_transforms;
+    uint32_t max_transforms;
+    uint32_t num_levels;
+    // Level i holds the transforms from level_ends[i - 1] up to level_ends[i], roots are level 0
+    uint32_t level_ends[MAX_TRANSFORM_LEVELS];
+
+    // NULL_UINT32 for roots
+    uint32_t* parent_indices;
+
+    float* local_positions[3];
+    float* local_rotations[4];
+    float* local_scales;
+
+    // Written by compute_world_transforms
+    float* world_positions[3];
+    float* world_rotations[4];
+    float* world_scales;
+} transform_store_t;
+
+result_t init_transform_store(uint32_t max_transforms, transform_store_t* store);
+// Returns the index of the new transform, or NULL_UINT32 when the store is full or the parent is at a shallower level than the last one added
+uint32_t add_transform(transform_store_t* store, uint32_t parent_index, vec3s position, versors rotation, float scale);
+void set_local_transform(transform_store_t* store, uint32_t transform_index, vec3s position, versors rotation, float scale);
+// Composes every level in order, AVX2 or NEON when available and scalar otherwise
+void compute_world_transforms(transform_store_t* store);
+// Only the transform of each instance is written, material indices are kept
+void write_world_transforms(const transform_store_t* store, uint32_t first_transform, uint32_t num_transforms, instance_t instances[]);
+void term_transform_store(transform_store_t* store);
+
+// Round to nearest, used for the rotations of instances
+uint16_t pack_half_float(float value);
+
+// The scalar kernels only, so the benchmark can compare them against the SIMD ones
+void compute_world_transforms_scalar(transform_store_t* store);
+void write_world_transforms_scalar(const transform_store_t* store, uint32_t first_transform, uint32_t num_transforms, instance_t instances[]);
+// Name of the kernels compute_world_transforms and write_world_transforms pick on this CPU
+const char* get_transform_kernel_name(void);
\ No newline at end of file
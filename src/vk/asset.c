@@ -5,8 +5,18 @@
 #include "gfx_core.h"
 #include "color_pipeline.h"
 #include "defaults.h"
+#include "mipmap.h"
+#include "chrono.h"
+#include "upload.h"
+#include "bindless.h"
+#include "frame_uniforms.h"
+#include "debug.h"
+#include "transform.h"
+#include "job.h"
 #include <malloc.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
 #include <stdalign.h>
 #include <stb_image.h>
 #include <cglm/struct/cam.h>
@@ -14,6 +24,7 @@
 #include <cglm/struct/vec3.h>
 #include <cglm/struct/mat3.h>
 #include <cglm/struct/affine.h>
+#include <cglm/struct/quat.h>
 
 alignas(64)
 
@@ -23,110 +34,263 @@ VmaAllocation vertex_buffer_allocation_arrays[NUM_MODELS][NUM_VERTEX_ARRAYS];
 VkBuffer index_buffers[NUM_MODELS];
 VmaAllocation index_buffer_allocations[NUM_MODELS];
 
-VkBuffer instance_buffers[NUM_MODELS];
-VmaAllocation instance_buffer_allocations[NUM_MODELS];
+VkBuffer instance_buffer;
+VmaAllocation instance_buffer_allocation;
+uint32_t instance_buffer_index;
 
 uint32_t num_indices_array[NUM_MODELS];
 uint32_t num_instances_array[NUM_MODELS];
+uint32_t first_instances_array[NUM_MODELS];
+
+VkBuffer material_buffer;
+VmaAllocation material_buffer_allocation;
+uint32_t material_buffer_index;
 
 VkSampler texture_image_sampler;
 VkImage texture_images[NUM_TEXTURE_IMAGES];
 VmaAllocation texture_image_allocations[NUM_TEXTURE_IMAGES];
 VkImageView texture_image_views[NUM_TEXTURE_IMAGES];
 
+const size_t model_color_pipeline_variants[NUM_MODELS] = {
+    color_pipeline_variant_full,
+    color_pipeline_variant_simple
+};
+
+// 81 normal mapped cubes standing on a plane that covers most of the screen, so the plane is shaded under every cube
+const bool scene_depth_prepass = true;
+
+const vec3s light_direction = {{ -0.8f, -0.6f, 0.4f }};
+const vec3s light_color = {{ 0.9f, 0.95f, 1.0f }};
+
+VkBuffer light_buffer;
+VmaAllocation light_buffer_allocation;
+uint32_t light_buffer_index;
+uint32_t num_lights;
+static light_t lights[MAX_LIGHTS];
+
 VkSampler shadow_texture_image_sampler;
 mat4s shadow_view_projection;
 VkBuffer shadow_view_projection_buffer;
 VmaAllocation shadow_view_projection_buffer_allocation;
 
-const char* init_vulkan_assets(const VkPhysicalDeviceProperties* physical_device_properties) {
-    struct {
-        const char* path;
-        int channels;
-    } image_load_infos[][NUM_TEXTURE_LAYERS] = {
-        {
-            { "image/cube_color.tga", STBI_rgb_alpha },
-            { "image/plane_color.jpg", STBI_rgb_alpha }
-        },
-        {
-            { "image/cube_normal.tga", STBI_rgb },
-            { "image/plane_normal.png", STBI_rgb }
+static upload_id_t asset_upload_id;
+static microseconds_t asset_upload_start;
+static bool assets_ready = false;
+
+// Simulation side, every instance is current and the ranges are the changes since the last take_instance_updates
+static instance_updates_t simulated_instance_updates;
+static vec3s instance_positions[NUM_INSTANCES];
+static uint32_t sorted_instance_order[NUM_INSTANCES];
+
+// Render side, the instances as of the last applied snapshot and the ranges not copied into the instance buffer yet
+static instance_t instances[NUM_INSTANCES];
+static uint32_t num_dirty_instance_ranges = 0;
+static instance_range_t dirty_instance_ranges[MAX_DIRTY_INSTANCE_RANGES];
+
+// Persistently mapped, one slot of NUM_INSTANCES per frame in flight, changed ranges are staged at their own offset within the slot
+static VkBuffer instance_staging_buffer;
+static VmaAllocation instance_staging_allocation;
+static instance_t* instance_staging_data;
+
+instance_t make_instance(vec3s position, float scale, versors rotation, uint32_t material_index) {
+    versors unit_rotation = glms_quat_normalize(rotation);
+    return (instance_t) {
+        .position = position,
+        .scale = scale,
+        .rotation = {
+            pack_half_float(unit_rotation.x),
+            pack_half_float(unit_rotation.y),
+            pack_half_float(unit_rotation.z),
+            pack_half_float(unit_rotation.w)
         },
-        {
-            { "image/cube_specular.tga", STBI_rgb },
-            { "image/plane_specular.png", STBI_rgb }
-        }
+        .material_index = material_index
     };
+}
 
-    void* pixel_arrays[NUM_TEXTURE_IMAGES][NUM_TEXTURE_LAYERS];
+typedef struct {
+    const char* path;
+    int channels;
+    uint32_t num_pixel_bytes;
+    VkFormat format;
+} image_load_info_t;
+
+// Decoding takes most of the loading time and every image is independent, so each is a job
+typedef struct {
+    const image_load_info_t* infos;
+    void** pixel_arrays;
+    int* widths;
+    int* heights;
+} image_decode_t;
+
+// Same sequence every run, so timings of different light counts compare the same lights
+static float get_random_float(uint32_t* state, float min, float max) {
+    *state = *state*1664525u + 1013904223u;
+    return min + (max - min)*(float)(*state >> 8)/(float)(1u << 24);
+}
 
-    image_create_info_t image_create_infos[NUM_TEXTURE_IMAGES] = {
-        {
-            .num_pixel_bytes = 4,
-            .info = {
-                DEFAULT_VK_SAMPLED_IMAGE,
-                .format = VK_FORMAT_R8G8B8A8_SRGB,
-                .arrayLayers = NUM_TEXTURE_LAYERS
-            }
-        },
-        {
-            .num_pixel_bytes = 3,
-            .info = {
-                DEFAULT_VK_SAMPLED_IMAGE,
-                .format = VK_FORMAT_R8G8B8_UNORM, // USE UNORM FOR ANY NON COLOR TEXTURE, SRGB WILL FUCK UP YOUR NORMAL TEXTURE SO BAD
-                .arrayLayers = NUM_TEXTURE_LAYERS
-            }
-        },
-        {
-            .num_pixel_bytes = 3,
+// Scattered over the plane between and above the cubes, every fourth one a spot light pointing down
+static void generate_lights(void) {
+    uint32_t random_state = 1;
+    for (uint32_t i = 0; i < MAX_LIGHTS; i++) {
+        bool spot = i % 4 == 3;
+        vec3s color = {{ get_random_float(&random_state, 0.2f, 1.0f), get_random_float(&random_state, 0.2f, 1.0f), get_random_float(&random_state, 0.2f, 1.0f) }};
+        vec3s position = {{
+            get_random_float(&random_state, -38.0f, 38.0f),
+            spot ? get_random_float(&random_state, 4.0f, 6.0f) : get_random_float(&random_state, 0.5f, 3.0f),
+            get_random_float(&random_state, -38.0f, 38.0f)
+        }};
+
+        lights[i] = (light_t) {
+            .position = position,
+            .range = spot ? get_random_float(&random_state, 8.0f, 12.0f) : get_random_float(&random_state, 3.0f, 6.0f),
+            .color = glms_vec3_scale(color, spot ? 6.0f : 2.0f),
+            // Cosines of 35 and 25 degrees
+            .spot_cos_outer = spot ? 0.819f : -2.0f,
+            .direction = {{ 0.0f, -1.0f, 0.0f }},
+            .spot_cos_inner = spot ? 0.906f : -1.0f
+        };
+    }
+}
+
+static void decode_images(void* context, uint32_t first, uint32_t end) {
+    const image_decode_t* decode = context;
+    for (uint32_t i = first; i < end; i++) {
+        decode->pixel_arrays[i] = stbi_load(decode->infos[i].path, &decode->widths[i], &decode->heights[i], (int[1]) { 0 }, decode->infos[i].channels);
+    }
+}
+
+const char* init_vulkan_assets(const VkPhysicalDeviceProperties* physical_device_properties) {
+    image_load_info_t image_load_infos[NUM_TEXTURE_IMAGES] = {
+        { "image/cube_color.tga", STBI_rgb_alpha, 4, VK_FORMAT_R8G8B8A8_SRGB },
+        { "image/cube_normal.tga", STBI_rgb, 3, VK_FORMAT_R8G8B8_UNORM }, // USE UNORM FOR ANY NON COLOR TEXTURE, SRGB WILL FUCK UP YOUR NORMAL TEXTURE SO BAD
+        { "image/cube_specular.tga", STBI_rgb, 3, VK_FORMAT_R8G8B8_UNORM },
+        { "image/plane_color.jpg", STBI_rgb_alpha, 4, VK_FORMAT_R8G8B8A8_SRGB },
+        { "image/plane_normal.png", STBI_rgb, 3, VK_FORMAT_R8G8B8_UNORM },
+        { "image/plane_specular.png", STBI_rgb, 3, VK_FORMAT_R8G8B8_UNORM }
+    };
+
+    // Indices into texture_images, turned into bindless indices once the image views exist
+    size_t material_image_indices[NUM_MATERIALS][3] = {
+        { 0, 1, 2 },
+        { 3, 4, 5 }
+    };
+
+    void* pixel_arrays[NUM_TEXTURE_IMAGES];
+    int widths[NUM_TEXTURE_IMAGES];
+    int heights[NUM_TEXTURE_IMAGES];
+    image_create_info_t image_create_infos[NUM_TEXTURE_IMAGES];
+
+    microseconds_t decode_start = get_current_microseconds();
+    job_counter_t decode_counter = { 0 };
+    run_jobs(decode_images, &(image_decode_t) {
+        .infos = image_load_infos,
+        .pixel_arrays = pixel_arrays,
+        .widths = widths,
+        .heights = heights
+    }, NUM_TEXTURE_IMAGES, 1, &decode_counter);
+    wait_for_job_counter(&decode_counter);
+    printf("Decoded texture images in %ldus\n", get_current_microseconds() - decode_start);
+
+    for (size_t i = 0; i < NUM_TEXTURE_IMAGES; i++) {
+        if (pixel_arrays[i] == NULL) {
+            return "Failed to load image pixels\n";
+        }
+
+        image_create_infos[i] = (image_create_info_t) {
+            .pixel_arrays = &pixel_arrays[i],
+            .num_pixel_bytes = image_load_infos[i].num_pixel_bytes,
             .info = {
                 DEFAULT_VK_SAMPLED_IMAGE,
-                .format = VK_FORMAT_R8G8B8_UNORM,
-                .arrayLayers = NUM_TEXTURE_LAYERS
+                .format = image_load_infos[i].format,
+                .extent.width = (uint32_t)widths[i],
+                .extent.height = (uint32_t)heights[i],
+                .mipLevels = get_num_mip_levels((uint32_t)widths[i], (uint32_t)heights[i])
             }
-        },
-    };
+        };
+    }
+
+    VkCommandBuffer command_buffer;
+    if (begin_upload(&command_buffer) != result_success) {
+        return "Failed to begin asset upload\n";
+    }
+
+    microseconds_t begin_images_start = get_current_microseconds();
+    if (upload_images(command_buffer, NUM_TEXTURE_IMAGES, image_create_infos, texture_images, texture_image_allocations) != result_success) {
+        return "Failed to begin creating images\n";
+    }
+#ifdef GPU_MIP_GENERATION
+    printf("Staged texture images in %ldus (mip chains generated on the GPU)\n", get_current_microseconds() - begin_images_start);
+#else
+    printf("Staged texture images in %ldus (mip chains generated on the CPU)\n", get_current_microseconds() - begin_images_start);
+#endif
 
     for (size_t i = 0; i < NUM_TEXTURE_IMAGES; i++) {
-        uint32_t width;
-        uint32_t height;
-
-        image_create_info_t* info = &image_create_infos[i];
-        info->pixel_arrays = (void**)&pixel_arrays[i];
-        
-        for (size_t j = 0; j < info->info.arrayLayers; j++) {
-            int new_width;
-            int new_height;
-            info->pixel_arrays[j] = stbi_load(image_load_infos[i][j].path, &new_width, &new_height, (int[1]) { 0 }, image_load_infos[i][j].channels);
-
-            if (info->pixel_arrays[j] == NULL) {
-                return "Failed to load image pixels\n";
-            }
+        stbi_image_free(pixel_arrays[i]);
+    }
 
-            if (j > 0 && ((uint32_t)new_width != width || (uint32_t)new_width != height)) {
-                return "Pixels \n";
-            }
+    for (size_t i = 0; i < NUM_TEXTURE_IMAGES; i++) {
+        const VkImageCreateInfo* image_create_info = &image_create_infos[i].info;
 
-            width = (uint32_t)new_width;
-            height = (uint32_t)new_height;
+        if (vkCreateImageView(device, &(VkImageViewCreateInfo) {
+            DEFAULT_VK_IMAGE_VIEW,
+            .image = texture_images[i],
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = image_create_info->format,
+            .subresourceRange.levelCount = image_create_info->mipLevels,
+            .subresourceRange.layerCount = 1,
+            .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT
+        }, NULL, &texture_image_views[i]) != VK_SUCCESS) {
+            return "Failed to create texture image view\n";
+        }
+    }
 
-            info->info.extent.width = width;
-            info->info.extent.height = height;
-            info->info.mipLevels = ((uint32_t)floorf(log2f((float)max_uint32(width, height)))) + 1;
+    // Views and descriptors can be created before the upload has completed, they are only read by draws after it did
+    uint32_t bindless_image_indices[NUM_TEXTURE_IMAGES];
+    for (size_t i = 0; i < NUM_TEXTURE_IMAGES; i++) {
+        if (add_bindless_image(texture_image_views[i], &bindless_image_indices[i]) != result_success) {
+            return "Failed to add texture image to bindless table\n";
         }
     }
 
-    staging_t image_stagings[NUM_TEXTURE_IMAGES];
+    if (vkCreateSampler(device, &(VkSamplerCreateInfo) {
+        DEFAULT_VK_SAMPLER,
+        .maxLod = VK_LOD_CLAMP_NONE
+    }, NULL, &texture_image_sampler) != VK_SUCCESS) {
+        return "Failed to create tetxure image sampler\n";
+    }
 
-    if (begin_images(NUM_TEXTURE_IMAGES, image_create_infos, image_stagings, texture_images, texture_image_allocations) != result_success) {
-        return "Failed to begin creating images\n";
+    uint32_t bindless_sampler_index;
+    if (add_bindless_sampler(texture_image_sampler, &bindless_sampler_index) != result_success) {
+        return "Failed to add texture image sampler to bindless table\n";
     }
 
-    for (size_t i = 0; i < NUM_TEXTURE_IMAGES; i++) {
-        const image_create_info_t* info = &image_create_infos[i];
-        
-        for (size_t j = 0; j < info->info.arrayLayers; j++) {
-            stbi_image_free(info->pixel_arrays[j]);
+    if (vkCreateSampler(device, &(VkSamplerCreateInfo) {
+        DEFAULT_VK_SAMPLER,
+        .compareEnable = VK_TRUE,
+        .compareOp = VK_COMPARE_OP_LESS
+    }, NULL, &shadow_texture_image_sampler) != VK_SUCCESS) {
+        return "Failed to create tetxure image sampler\n";
+    }
+
+    material_t materials[NUM_MATERIALS];
+    for (size_t i = 0; i < NUM_MATERIALS; i++) {
+        materials[i] = (material_t) {
+            .color_image_index = bindless_image_indices[material_image_indices[i][0]],
+            .normal_image_index = bindless_image_indices[material_image_indices[i][1]],
+            .specular_image_index = bindless_image_indices[material_image_indices[i][2]],
+            .sampler_index = bindless_sampler_index
+        };
+    }
+
+    {
+        void* material_array = materials;
+        uint32_t num_material_bytes = sizeof(material_t);
+        if (upload_buffers(NUM_MATERIALS, &storage_buffer_create_info, 1, &material_array, &num_material_bytes, &material_buffer, &material_buffer_allocation) != result_success) {
+            return "Failed to begin creating material buffer\n";
+        }
+
+        if (add_bindless_storage_buffer(material_buffer, sizeof(materials), &material_buffer_index) != result_success) {
+            return "Failed to add material buffer to bindless table\n";
         }
     }
 
@@ -135,33 +299,55 @@ const char* init_vulkan_assets(const VkPhysicalDeviceProperties* physical_device
         "mesh/plane.gltf"
     };
 
-    mat4s cube_model_matrices[81];
+    // 81 cubes followed by the plane
     {
         size_t i = 0;
         for (float x = -4.0f; x <= 4.0f; x++) {
             for (float y = -4.0f; y <= 4.0f; y++, i++) {
-                cube_model_matrices[i] = glms_translate(glms_mat4_identity(), (vec3s) {{ x * 8.0f, 1.0f, y * 8.0f }});
+                instances[i] = make_instance((vec3s) {{ x * 8.0f, 1.0f, y * 8.0f }}, 1.0f, glms_quat_identity(), 0);
             }
         }
-    }
 
-    mat4s plane_model_matrix = glms_scale(glms_mat4_identity(), (vec3s) {{ 40.0f, 40.0f, 40.0f }});
+        instances[i] = make_instance((vec3s) {{ 0.0f, 0.0f, 0.0f }}, 40.0f, glms_quat_identity(), 1);
+    }
 
-    num_instances_array[0] = NUM_ELEMS(cube_model_matrices);
+    num_instances_array[0] = 81;
     num_instances_array[1] = 1;
-    void* model_matrix_arrays[] = {
-        cube_model_matrices,
-        &plane_model_matrix
-    };
+    first_instances_array[0] = 0;
+    first_instances_array[1] = 81;
 
-    uint32_t num_vertices_array[NUM_MODELS];
+    memcpy(simulated_instance_updates.instances, instances, sizeof(instances));
+    for (uint32_t i = 0; i < NUM_INSTANCES; i++) {
+        instance_positions[i] = instances[i].position;
+        sorted_instance_order[i] = i;
+    }
 
-    staging_t vertex_staging_arrays[NUM_MODELS][NUM_VERTEX_ARRAYS];
-    staging_t index_stagings[NUM_MODELS];
-    staging_t instance_stagings[NUM_MODELS];
+    {
+        void* instance_array = instances;
+        uint32_t num_instance_bytes = sizeof(instance_t);
+        if (upload_buffers(NUM_ELEMS(instances), &instance_buffer_create_info, 1, &instance_array, &num_instance_bytes, &instance_buffer, &instance_buffer_allocation) != result_success) {
+            return "Failed to begin creating instance buffer\n";
+        }
+
+        if (add_bindless_storage_buffer(instance_buffer, sizeof(instances), &instance_buffer_index) != result_success) {
+            return "Failed to add instance buffer to bindless table\n";
+        }
+
+        VmaAllocationCreateInfo allocation_create_info = staging_allocation_create_info;
+        allocation_create_info.flags |= VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+        VmaAllocationInfo allocation_info;
+        if (vmaCreateBuffer(allocator, &(VkBufferCreateInfo) {
+            DEFAULT_VK_STAGING_BUFFER,
+            .size = NUM_FRAMES_IN_FLIGHT*sizeof(instances)
+        }, &allocation_create_info, &instance_staging_buffer, &instance_staging_allocation, &allocation_info) != VK_SUCCESS) {
+            return "Failed to create instance staging buffer\n";
+        }
+        instance_staging_data = allocation_info.pMappedData;
+        SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_BUFFER, instance_staging_buffer, "Instance staging");
+    }
 
     uint32_t num_index_bytes = sizeof(uint16_t);
-    uint32_t num_instance_bytes = sizeof(mat4s);
 
     for (size_t i = 0; i < NUM_MODELS; i++) {
         mesh_t mesh;
@@ -169,140 +355,216 @@ const char* init_vulkan_assets(const VkPhysicalDeviceProperties* physical_device
             return "Failed to load mesh\n";
         }
 
-        num_vertices_array[i] = mesh.num_vertices;
         num_indices_array[i] = mesh.num_indices;
 
-        if (begin_buffers(mesh.num_vertices, &vertex_buffer_create_info, NUM_VERTEX_ARRAYS, &mesh.vertex_arrays[0].data, num_vertex_bytes_array, vertex_staging_arrays[i], vertex_buffer_arrays[i], vertex_buffer_allocation_arrays[i]) != result_success) {
+        if (upload_buffers(mesh.num_vertices, &vertex_buffer_create_info, NUM_VERTEX_ARRAYS, &mesh.vertex_arrays[0].data, num_vertex_bytes_array, vertex_buffer_arrays[i], vertex_buffer_allocation_arrays[i]) != result_success) {
             return "Failed to begin creating vertex buffers\n"; 
         }
 
-        if (begin_buffers(mesh.num_indices, &index_buffer_create_info, 1, &mesh.indices_data, &num_index_bytes, &index_stagings[i], &index_buffers[i], &index_buffer_allocations[i]) != result_success) {
+        if (upload_buffers(mesh.num_indices, &index_buffer_create_info, 1, &mesh.indices_data, &num_index_bytes, &index_buffers[i], &index_buffer_allocations[i]) != result_success) {
             return "Failed to begin creating index buffer\n";
         }
 
-        if (begin_buffers(num_instances_array[i], &vertex_buffer_create_info, 1, &model_matrix_arrays[i], &num_instance_bytes, &instance_stagings[i], &instance_buffers[i], &instance_buffer_allocations[i]) != result_success) {
-            return "Failed to begin creating instance buffer\n";
-        }
-
         for (size_t i = 0; i < NUM_VERTEX_ARRAYS; i++) {
             free(mesh.vertex_arrays[i].data);
         }
         free(mesh.indices_data);
     }
 
+    // VULKAN_NUM_LIGHTS lights the first that many
+    {
+        const char* num_lights_env = getenv("VULKAN_NUM_LIGHTS");
+        num_lights = num_lights_env == NULL ? 2048 : (uint32_t)strtoul(num_lights_env, NULL, 10);
+        if (num_lights > MAX_LIGHTS) {
+            num_lights = MAX_LIGHTS;
+        }
+        printf("Lighting the scene with %u point and spot lights\n", num_lights);
+
+        generate_lights();
+        void* light_array = lights;
+        uint32_t num_light_bytes = sizeof(light_t);
+        if (upload_buffers(MAX_LIGHTS, &storage_buffer_create_info, 1, &light_array, &num_light_bytes, &light_buffer, &light_buffer_allocation) != result_success) {
+            return "Failed to begin creating light buffer\n";
+        }
+
+        if (add_bindless_storage_buffer(light_buffer, sizeof(lights), &light_buffer_index) != result_success) {
+            return "Failed to add light buffer to bindless table\n";
+        }
+    }
+
     //
 
-    vec3s light_direction = glms_vec3_normalize((vec3s) {{ -0.8f, -0.6f, 0.4f }});
-    vec3s light_position = glms_vec3_scale(glms_vec3_negate(light_direction), 40.0f);
+    vec3s unit_light_direction = glms_vec3_normalize(light_direction);
+    vec3s light_position = glms_vec3_scale(glms_vec3_negate(unit_light_direction), 40.0f);
 
     mat4s projection = glms_ortho(-60.0f, 60.0f, -60.0f, 60.0f, 0.01f, 300.0f);
 
-    mat4s view = glms_look(light_position, light_direction, (vec3s) {{ 0.0f, -1.0f, 0.0f }});
+    mat4s view = glms_look(light_position, unit_light_direction, (vec3s) {{ 0.0f, -1.0f, 0.0f }});
 
     mat4s shadow_view_projection = glms_mat4_mul(projection, view);
     void* shadow_view_projection_ptr = &shadow_view_projection;
 
     uint32_t num_shadow_view_projection_bytes = sizeof(shadow_view_projection);
 
-    staging_t shadow_view_projection_staging;
-    if (begin_buffers(1, &uniform_buffer_create_info, 1, &shadow_view_projection_ptr, &num_shadow_view_projection_bytes, &shadow_view_projection_staging, &shadow_view_projection_buffer, &shadow_view_projection_buffer_allocation) != result_success) {
+    if (upload_buffers(1, &uniform_buffer_create_info, 1, &shadow_view_projection_ptr, &num_shadow_view_projection_bytes, &shadow_view_projection_buffer, &shadow_view_projection_buffer_allocation) != result_success) {
         return "Failed to create shadow view projection buffer\n";
     }
+
+    frame_uniforms.shadow_view_projection = shadow_view_projection;
+    frame_uniforms.instance_buffer_index = instance_buffer_index;
+    frame_uniforms.material_buffer_index = material_buffer_index;
+    frame_uniforms.light_buffer_index = light_buffer_index;
+    frame_uniforms.num_lights = num_lights;
     //
     
-    VkFence transfer_fence;
-    if (vkCreateFence(device, &(VkFenceCreateInfo) {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO
-    }, NULL, &transfer_fence) != VK_SUCCESS) {
-        return "Failed to create transfer fence\n";
+    // Rendering starts right away, assets are only drawn once this upload has finished
+    asset_upload_start = get_current_microseconds();
+    if (end_upload(&asset_upload_id) != result_success) {
+        return "Failed to submit asset upload\n";
     }
 
-    VkCommandBuffer command_buffer;
-    if (vkAllocateCommandBuffers(device, &(VkCommandBufferAllocateInfo) {
-        DEFAULT_VK_COMMAND_BUFFER,
-        .commandPool = command_pool // TODO: Use separate command pool
-    }, &command_buffer) != VK_SUCCESS) {
-        return "Failed to create transfer command buffer\n";
+    return NULL;
+}
+
+void sort_instances_front_to_back(vec3s camera_position, uint32_t instance_order[NUM_INSTANCES]) {
+    float distances[NUM_INSTANCES];
+    for (uint32_t i = 0; i < NUM_INSTANCES; i++) {
+        distances[i] = glms_vec3_distance2(instance_positions[i], camera_position);
     }
 
-    if (vkBeginCommandBuffer(command_buffer, &(VkCommandBufferBeginInfo) {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
-    }) != VK_SUCCESS) {
-        return "Failed to write to transfer command buffer\n";
+    // Insertion sort within each model's range, instances stay in their model's range since each draw covers one range
+    for (size_t model = 0; model < NUM_MODELS; model++) {
+        uint32_t first = first_instances_array[model];
+        uint32_t end = first + num_instances_array[model];
+        for (uint32_t i = first + 1; i < end; i++) {
+            uint32_t instance = sorted_instance_order[i];
+            uint32_t j = i;
+            for (; j > first && distances[sorted_instance_order[j - 1]] > distances[instance]; j--) {
+                sorted_instance_order[j] = sorted_instance_order[j - 1];
+            }
+            sorted_instance_order[j] = instance;
+        }
     }
 
-    transfer_images(command_buffer, NUM_TEXTURE_IMAGES, image_create_infos, image_stagings, texture_images);
+    memcpy(instance_order, sorted_instance_order, sizeof(sorted_instance_order));
+}
 
-    for (size_t i = 0; i < NUM_MODELS; i++) {
-        transfer_buffers(command_buffer, num_vertices_array[i], NUM_VERTEX_ARRAYS, num_vertex_bytes_array, vertex_staging_arrays[i], vertex_buffer_arrays[i]);
-        transfer_buffers(command_buffer, num_indices_array[i], 1, &num_index_bytes, &index_stagings[i], &index_buffers[i]);
-        transfer_buffers(command_buffer, num_instances_array[i], 1, &num_instance_bytes, &instance_stagings[i], &instance_buffers[i]);
+static void mark_instances_dirty(uint32_t* num_ranges, instance_range_t ranges[], uint32_t first, uint32_t end) {
+    // Ranges before the first one that overlaps or touches stay as they are, every one up to the last that does is merged into it
+    uint32_t merge_start = 0;
+    while (merge_start < *num_ranges && ranges[merge_start].end < first) {
+        merge_start++;
+    }
+    uint32_t merge_end = merge_start;
+    for (; merge_end < *num_ranges && ranges[merge_end].first <= end; merge_end++) {
+        first = first < ranges[merge_end].first ? first : ranges[merge_end].first;
+        end = end > ranges[merge_end].end ? end : ranges[merge_end].end;
     }
-    transfer_buffers(command_buffer, 1, 1, &num_shadow_view_projection_bytes, &shadow_view_projection_staging, &shadow_view_projection_buffer);
 
-    if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
-        return "Failed to write to transfer command buffer\n";
+    // Out of ranges, everything from the first to the last change is copied instead
+    if (merge_start == merge_end && *num_ranges == MAX_DIRTY_INSTANCE_RANGES) {
+        first = first < ranges[0].first ? first : ranges[0].first;
+        end = end > ranges[*num_ranges - 1].end ? end : ranges[*num_ranges - 1].end;
+        merge_start = 0;
+        merge_end = *num_ranges;
     }
 
-    vkQueueSubmit(graphics_queue, 1, &(VkSubmitInfo) {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &command_buffer
-    }, transfer_fence);
-    vkWaitForFences(device, 1, &transfer_fence, VK_TRUE, UINT64_MAX);
+    memmove(&ranges[merge_start + 1], &ranges[merge_end], (*num_ranges - merge_end)*sizeof(instance_range_t));
+    ranges[merge_start] = (instance_range_t) { first, end };
+    *num_ranges = *num_ranges - (merge_end - merge_start) + 1;
+}
 
-    vkDestroyFence(device, transfer_fence, NULL);
+result_t update_instances(uint32_t first_instance, uint32_t num_instances, const instance_t new_instances[]) {
+    // Written so it cannot wrap around
+    if (first_instance > NUM_INSTANCES || num_instances > NUM_INSTANCES - first_instance) {
+        return result_failure;
+    }
+    if (num_instances == 0) {
+        return result_success;
+    }
 
-    vkFreeCommandBuffers(device, command_pool, 1, &command_buffer);
+    memcpy(&simulated_instance_updates.instances[first_instance], new_instances, num_instances*sizeof(instance_t));
+    for (uint32_t i = first_instance; i < first_instance + num_instances; i++) {
+        instance_positions[i] = new_instances[i - first_instance].position;
+    }
 
-    end_images(NUM_TEXTURE_IMAGES, image_stagings);
+    mark_instances_dirty(&simulated_instance_updates.num_ranges, simulated_instance_updates.ranges, first_instance, first_instance + num_instances);
+    return result_success;
+}
 
-    for (size_t i = 0; i < NUM_MODELS; i++) {
-        end_buffers(NUM_VERTEX_ARRAYS, vertex_staging_arrays[i]);
-        end_buffers(1, &index_stagings[i]);
-        end_buffers(1, &instance_stagings[i]);
+void take_instance_updates(instance_updates_t* updates) {
+    updates->num_ranges = simulated_instance_updates.num_ranges;
+    memcpy(updates->ranges, simulated_instance_updates.ranges, simulated_instance_updates.num_ranges*sizeof(instance_range_t));
+    for (uint32_t i = 0; i < simulated_instance_updates.num_ranges; i++) {
+        instance_range_t range = simulated_instance_updates.ranges[i];
+        memcpy(&updates->instances[range.first], &simulated_instance_updates.instances[range.first], (range.end - range.first)*sizeof(instance_t));
     }
-    end_buffers(1, &shadow_view_projection_staging);
-
-    //
 
-    for (size_t i = 0; i < NUM_TEXTURE_IMAGES; i++) {
-        const VkImageCreateInfo* image_create_info = &image_create_infos[i].info;
+    simulated_instance_updates.num_ranges = 0;
+}
 
-        if (vkCreateImageView(device, &(VkImageViewCreateInfo) {
-            DEFAULT_VK_IMAGE_VIEW,
-            .image = texture_images[i],
-            .viewType = image_create_info->arrayLayers == 1 ? VK_IMAGE_VIEW_TYPE_2D : VK_IMAGE_VIEW_TYPE_2D_ARRAY,
-            .format = image_create_info->format,
-            .subresourceRange.levelCount = image_create_info->mipLevels,
-            .subresourceRange.layerCount = image_create_info->arrayLayers,
-            .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT
-        }, NULL, &texture_image_views[i]) != VK_SUCCESS) {
-            return "Failed to create texture image view\n";
-        }
+void apply_instance_updates(const instance_updates_t* updates) {
+    for (uint32_t i = 0; i < updates->num_ranges; i++) {
+        instance_range_t range = updates->ranges[i];
+        memcpy(&instances[range.first], &updates->instances[range.first], (range.end - range.first)*sizeof(instance_t));
+        mark_instances_dirty(&num_dirty_instance_ranges, dirty_instance_ranges, range.first, range.end);
     }
+}
 
-    if (vkCreateSampler(device, &(VkSamplerCreateInfo) {
-        DEFAULT_VK_SAMPLER,
-        .maxLod = (float)image_create_infos[0].info.mipLevels
-    }, NULL, &texture_image_sampler) != VK_SUCCESS) {
-        return "Failed to create tetxure image sampler\n";
+bool record_instance_updates(VkCommandBuffer command_buffer, uint32_t frame_index) {
+    if (num_dirty_instance_ranges == 0) {
+        return false;
     }
 
-    if (vkCreateSampler(device, &(VkSamplerCreateInfo) {
-        DEFAULT_VK_SAMPLER,
-        .compareEnable = VK_TRUE,
-        .compareOp = VK_COMPARE_OP_LESS
-    }, NULL, &shadow_texture_image_sampler) != VK_SUCCESS) {
-        return "Failed to create tetxure image sampler\n";
+    instance_t* slot_data = &instance_staging_data[frame_index*NUM_INSTANCES];
+    VkDeviceSize slot_offset = frame_index*sizeof(instances);
+
+    VkBufferCopy regions[MAX_DIRTY_INSTANCE_RANGES];
+    for (uint32_t i = 0; i < num_dirty_instance_ranges; i++) {
+        instance_range_t range = dirty_instance_ranges[i];
+        memcpy(&slot_data[range.first], &instances[range.first], (range.end - range.first)*sizeof(instance_t));
+        regions[i] = (VkBufferCopy) {
+            .srcOffset = slot_offset + range.first*sizeof(instance_t),
+            .dstOffset = range.first*sizeof(instance_t),
+            .size = (range.end - range.first)*sizeof(instance_t)
+        };
     }
 
-    return NULL;
+    // Earlier frames may still be reading the instances, only an execution dependency is needed before overwriting them
+    VkPipelineStageFlags read_stage_flags = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+    vkCmdPipelineBarrier(command_buffer, read_stage_flags, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 0, NULL);
+
+    vkCmdCopyBuffer(command_buffer, instance_staging_buffer, instance_buffer, num_dirty_instance_ranges, regions);
+
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, read_stage_flags, 0, 0, NULL, 1, &(VkBufferMemoryBarrier) {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = instance_buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE
+    }, 0, NULL);
+
+    num_dirty_instance_ranges = 0;
+    return true;
+}
+
+bool are_vulkan_assets_ready(void) {
+    if (!assets_ready && is_upload_complete(asset_upload_id)) {
+        assets_ready = true;
+        printf("Assets became resident %ldus after upload submission\n", get_current_microseconds() - asset_upload_start);
+    }
+    return assets_ready;
 }
 
 void term_vulkan_assets(void) {
     vmaDestroyBuffer(allocator, shadow_view_projection_buffer, shadow_view_projection_buffer_allocation);
+    vmaDestroyBuffer(allocator, material_buffer, material_buffer_allocation);
+    vmaDestroyBuffer(allocator, light_buffer, light_buffer_allocation);
+    vmaDestroyBuffer(allocator, instance_buffer, instance_buffer_allocation);
+    vmaDestroyBuffer(allocator, instance_staging_buffer, instance_staging_allocation);
 
     vkDestroySampler(device, texture_image_sampler, NULL);
     vkDestroySampler(device, shadow_texture_image_sampler, NULL);
@@ -313,6 +575,5 @@ void term_vulkan_assets(void) {
             vmaDestroyBuffer(allocator, vertex_buffer_arrays[i][j], vertex_buffer_allocation_arrays[i][j]);
         }
         vmaDestroyBuffer(allocator, index_buffers[i], index_buffer_allocations[i]);
-        vmaDestroyBuffer(allocator, instance_buffers[i], instance_buffer_allocations[i]);
     }
 }
\ No newline at end of file
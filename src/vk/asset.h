@@ -1,8 +1,12 @@
 #pragma once
 #include <vulkan/vulkan.h>
+#include <stdbool.h>
+#include <assert.h>
 #include "mesh.h"
+#include "result.h"
 #include <vk_mem_alloc.h>
 #include <cglm/struct/mat4.h>
+#include <cglm/struct/quat.h>
 
 #define NUM_MODELS 2
 extern VkBuffer vertex_buffer_arrays[NUM_MODELS][NUM_VERTEX_ARRAYS];
@@ -11,23 +15,117 @@ extern VmaAllocation vertex_buffer_allocation_arrays[NUM_MODELS][NUM_VERTEX_ARRA
 extern VkBuffer index_buffers[NUM_MODELS];
 extern VmaAllocation index_buffer_allocations[NUM_MODELS];
 
-extern VkBuffer instance_buffers[NUM_MODELS];
-extern VmaAllocation instance_buffer_allocations[NUM_MODELS];
+// Instances of all models, bound as an instance rate vertex buffer by the shadow pipeline and read from the bindless table by the color pipeline
+extern VkBuffer instance_buffer;
+extern VmaAllocation instance_buffer_allocation;
+extern uint32_t instance_buffer_index;
+
+#define NUM_INSTANCES 82
 
 extern uint32_t num_indices_array[NUM_MODELS];
 extern uint32_t num_instances_array[NUM_MODELS];
+// Passed as the first instance of each model's draw
+extern uint32_t first_instances_array[NUM_MODELS];
+
+// Uniformly scaled, rotated and then translated, a third of the size of a model matrix with a material index
+// The material index selects an entry of the material buffer, mirrored by instance_t in the vertex shaders
+typedef struct {
+    vec3s position;
+    float scale;
+    // Unit quaternion x, y, z, w as half floats, decoded by the vertex input of the shadow pipeline as well
+    uint16_t rotation[4];
+    uint32_t material_index;
+    uint32_t padding;
+} instance_t;
+static_assert(sizeof(instance_t) == 32, "Instances must match the std430 layout of the shaders");
+
+instance_t make_instance(vec3s position, float scale, versors rotation, uint32_t material_index);
+
+// Sorted and disjoint, so each range is one copy region
+#define MAX_DIRTY_INSTANCE_RANGES 16
+typedef struct {
+    uint32_t first;
+    uint32_t end;
+} instance_range_t;
+
+// Instances changed by the simulation since the previous snapshot, instances outside the ranges are not written
+typedef struct {
+    uint32_t num_ranges;
+    instance_range_t ranges[MAX_DIRTY_INSTANCE_RANGES];
+    instance_t instances[NUM_INSTANCES];
+} instance_updates_t;
+
+// Indices into the bindless table, mirrored by material_t in the color fragment shader
+typedef struct {
+    uint32_t color_image_index;
+    uint32_t normal_image_index;
+    uint32_t specular_image_index;
+    uint32_t sampler_index;
+} material_t;
+
+#define NUM_MATERIALS 2
+extern VkBuffer material_buffer;
+extern VmaAllocation material_buffer_allocation;
+extern uint32_t material_buffer_index;
 
-#define NUM_TEXTURE_IMAGES 3
-#define NUM_TEXTURE_LAYERS 2
+// Textures are separate images registered in the bindless table, so their dimensions are independent
+#define NUM_TEXTURE_IMAGES 6
 extern VkSampler texture_image_sampler;
 extern VkImage texture_images[NUM_TEXTURE_IMAGES];
 extern VmaAllocation texture_image_allocations[NUM_TEXTURE_IMAGES];
 extern VkImageView texture_image_views[NUM_TEXTURE_IMAGES];
 
+// Each model is drawn with one material, which picks its color pipeline variant
+extern const size_t model_color_pipeline_variants[NUM_MODELS];
+
+// Whether the color pass is preceded by a depth prepass, chosen for the scene by how much of it is overdrawn, see render.c
+extern const bool scene_depth_prepass;
+
+// The sun, shared by the shadow view projection and the color fragment shader through specialization constants
+extern const vec3s light_direction;
+extern const vec3s light_color;
+
+// Point and spot lights, mirrored by light_t in the light cluster and color fragment shaders
+typedef struct {
+    vec3s position;
+    // Distance at which the light has faded out completely, clusters are assigned by the sphere it bounds
+    float range;
+    // Intensity included
+    vec3s color;
+    // Cosines of the angles from direction where a spot light ends and starts to fade, -2 and -1 for point lights so every direction is fully lit
+    float spot_cos_outer;
+    vec3s direction;
+    float spot_cos_inner;
+} light_t;
+static_assert(sizeof(light_t) == 48, "Lights must match the std430 layout of the shaders");
+
+// VULKAN_NUM_LIGHTS picks how many of them are lit to compare costs, all are uploaded
+#define MAX_LIGHTS 4096
+extern VkBuffer light_buffer;
+extern VmaAllocation light_buffer_allocation;
+extern uint32_t light_buffer_index;
+extern uint32_t num_lights;
+
 extern VkSampler shadow_texture_image_sampler;
 extern mat4s shadow_view_projection;
 extern VkBuffer shadow_view_projection_buffer;
 extern VmaAllocation shadow_view_projection_buffer_allocation;
 
 const char* init_vulkan_assets(const VkPhysicalDeviceProperties* physical_device_properties);
+// Whether the asset upload has finished, update_uploads has to be called beforehand to observe completion
+bool are_vulkan_assets_ready(void);
+// Simulation side, these run on the main thread while the render thread records an earlier frame
+// Orders the instances of each model front to back from the camera, the order of the previous call is the starting point so this is cheap while the camera moves smoothly
+void sort_instances_front_to_back(vec3s camera_position, uint32_t instance_order[NUM_INSTANCES]);
+// Changes reach the render thread through the snapshot of the frame that takes them, only the changed ranges are copied
+// Fails without changing anything when the range does not fit in NUM_INSTANCES
+result_t update_instances(uint32_t first_instance, uint32_t num_instances, const instance_t new_instances[]);
+void take_instance_updates(instance_updates_t* updates);
+
+// Render side
+// Changes accumulate until the assets are ready, so none are lost to frames drawn before that
+void apply_instance_updates(const instance_updates_t* updates);
+// Stages the instances applied since the last call in the slot of the frame and copies them into the instance buffer, returns whether there were any
+// Recorded before the passes of the frame, the frame's fence has to have been waited on and the assets have to be ready
+bool record_instance_updates(VkCommandBuffer command_buffer, uint32_t frame_index);
 void term_vulkan_assets(void);
\ No newline at end of file
@@ -0,0 +1,150 @@
+#include "bindless.h"
+#include "core.h"
+#include "debug.h"
+#include "util.h"
+#include <stdalign.h>
+
+alignas(64)
+VkDescriptorSetLayout bindless_descriptor_set_layout;
+VkDescriptorSet bindless_descriptor_set;
+static VkDescriptorPool bindless_descriptor_pool;
+
+static uint32_t num_bindless_images = 0;
+static uint32_t num_bindless_samplers = 0;
+static uint32_t num_bindless_storage_buffers = 0;
+
+const char* init_vulkan_bindless(void) {
+    // Update after bind lets resources be added while command buffers using the set are pending, partially bound lets slots stay empty
+    VkDescriptorBindingFlags binding_flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
+
+    if (vkCreateDescriptorSetLayout(device, &(VkDescriptorSetLayoutCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &(VkDescriptorSetLayoutBindingFlagsCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+            .bindingCount = 3,
+            .pBindingFlags = (VkDescriptorBindingFlags[3]) { binding_flags, binding_flags, binding_flags }
+        },
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+
+        .bindingCount = 3,
+        .pBindings = (VkDescriptorSetLayoutBinding[3]) {
+            {
+                .binding = BINDLESS_IMAGE_BINDING,
+                .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+                .descriptorCount = MAX_BINDLESS_IMAGES,
+                .stageFlags = VK_SHADER_STAGE_ALL
+            },
+            {
+                .binding = BINDLESS_SAMPLER_BINDING,
+                .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+                .descriptorCount = MAX_BINDLESS_SAMPLERS,
+                .stageFlags = VK_SHADER_STAGE_ALL
+            },
+            {
+                .binding = BINDLESS_STORAGE_BUFFER_BINDING,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = MAX_BINDLESS_STORAGE_BUFFERS,
+                .stageFlags = VK_SHADER_STAGE_ALL
+            }
+        }
+    }, NULL, &bindless_descriptor_set_layout) != VK_SUCCESS) {
+        return "Failed to create bindless descriptor set layout\n";
+    }
+
+    if (vkCreateDescriptorPool(device, &(VkDescriptorPoolCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+        .poolSizeCount = 3,
+        .pPoolSizes = (VkDescriptorPoolSize[3]) {
+            { .type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, .descriptorCount = MAX_BINDLESS_IMAGES },
+            { .type = VK_DESCRIPTOR_TYPE_SAMPLER, .descriptorCount = MAX_BINDLESS_SAMPLERS },
+            { .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = MAX_BINDLESS_STORAGE_BUFFERS }
+        },
+        .maxSets = 1
+    }, NULL, &bindless_descriptor_pool) != VK_SUCCESS) {
+        return "Failed to create bindless descriptor pool\n";
+    }
+
+    if (vkAllocateDescriptorSets(device, &(VkDescriptorSetAllocateInfo) {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = bindless_descriptor_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &bindless_descriptor_set_layout
+    }, &bindless_descriptor_set) != VK_SUCCESS) {
+        return "Failed to allocate bindless descriptor set\n";
+    }
+    SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_DESCRIPTOR_SET, bindless_descriptor_set, "Bindless descriptor set");
+
+    return NULL;
+}
+
+void term_vulkan_bindless(void) {
+    vkDestroyDescriptorPool(device, bindless_descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(device, bindless_descriptor_set_layout, NULL);
+}
+
+result_t add_bindless_image(VkImageView image_view, uint32_t* index) {
+    if (num_bindless_images == MAX_BINDLESS_IMAGES) {
+        return result_failure;
+    }
+
+    *index = num_bindless_images++;
+    vkUpdateDescriptorSets(device, 1, &(VkWriteDescriptorSet) {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = bindless_descriptor_set,
+        .dstBinding = BINDLESS_IMAGE_BINDING,
+        .dstArrayElement = *index,
+        .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+        .descriptorCount = 1,
+        .pImageInfo = &(VkDescriptorImageInfo) {
+            .imageView = image_view,
+            .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+        }
+    }, 0, NULL);
+
+    return result_success;
+}
+
+result_t add_bindless_sampler(VkSampler sampler, uint32_t* index) {
+    if (num_bindless_samplers == MAX_BINDLESS_SAMPLERS) {
+        return result_failure;
+    }
+
+    *index = num_bindless_samplers++;
+    vkUpdateDescriptorSets(device, 1, &(VkWriteDescriptorSet) {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = bindless_descriptor_set,
+        .dstBinding = BINDLESS_SAMPLER_BINDING,
+        .dstArrayElement = *index,
+        .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+        .descriptorCount = 1,
+        .pImageInfo = &(VkDescriptorImageInfo) {
+            .sampler = sampler
+        }
+    }, 0, NULL);
+
+    return result_success;
+}
+
+result_t add_bindless_storage_buffer(VkBuffer buffer, VkDeviceSize num_bytes, uint32_t* index) {
+    if (num_bindless_storage_buffers == MAX_BINDLESS_STORAGE_BUFFERS) {
+        return result_failure;
+    }
+
+    *index = num_bindless_storage_buffers++;
+    vkUpdateDescriptorSets(device, 1, &(VkWriteDescriptorSet) {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = bindless_descriptor_set,
+        .dstBinding = BINDLESS_STORAGE_BUFFER_BINDING,
+        .dstArrayElement = *index,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 1,
+        .pBufferInfo = &(VkDescriptorBufferInfo) {
+            .buffer = buffer,
+            .offset = 0,
+            .range = num_bytes
+        }
+    }, 0, NULL);
+
+    return result_success;
+}
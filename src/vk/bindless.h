@@ -0,0 +1,25 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include "result.h"
+
+// Shaders declare these as runtime sized arrays in set 0, see shader/color_pipeline_fragment.frag
+#define MAX_BINDLESS_IMAGES 1024
+#define MAX_BINDLESS_SAMPLERS 32
+#define MAX_BINDLESS_STORAGE_BUFFERS 64
+
+#define BINDLESS_IMAGE_BINDING 0
+#define BINDLESS_SAMPLER_BINDING 1
+#define BINDLESS_STORAGE_BUFFER_BINDING 2
+
+// One set shared by every pipeline as set 0, bound once per pass
+extern VkDescriptorSetLayout bindless_descriptor_set_layout;
+extern VkDescriptorSet bindless_descriptor_set;
+
+const char* init_vulkan_bindless(void);
+void term_vulkan_bindless(void);
+
+// Each returns the index shaders use to reach the resource, slots are never reused
+result_t add_bindless_image(VkImageView image_view, uint32_t* index);
+result_t add_bindless_sampler(VkSampler sampler, uint32_t* index);
+result_t add_bindless_storage_buffer(VkBuffer buffer, VkDeviceSize num_bytes, uint32_t* index);
@@ -6,116 +6,113 @@
 #include "util.h"
 #include "mesh.h"
 #include "defaults.h"
+#include "pipeline_cache.h"
+#include "debug.h"
+#include "bindless.h"
+#include "frame_uniforms.h"
+#include "render.h"
+#include "render_scale.h"
+#include "light_cluster_pipeline.h"
 #include <vk_mem_alloc.h>
 #include <stdalign.h>
+#include <stddef.h>
+#include <string.h>
 #include <cglm/struct/mat4.h>
 #include <cglm/struct/cam.h>
 #include <cglm/struct/mat3.h>
 #include <cglm/struct/affine.h>
 
+// Every variant once with a LESS depth test for frames without a prepass and once with an EQUAL test after it, followed by the prepass itself
+#define DEPTH_EQUAL_PIPELINES NUM_COLOR_PIPELINE_VARIANTS
+#define DEPTH_PREPASS_PIPELINE (2*NUM_COLOR_PIPELINE_VARIANTS)
+#define NUM_PIPELINES (2*NUM_COLOR_PIPELINE_VARIANTS + 1)
+
 alignas(64)
 VkRenderPass color_pipeline_render_pass;
+VkRenderPass depth_prepass_render_pass;
+// Compatible with color_pipeline_render_pass, so it shares its framebuffers and pipelines, but loads the depth of the prepass
+static VkRenderPass depth_load_render_pass;
 static VkDescriptorSetLayout descriptor_set_layout;
 static VkDescriptorPool descriptor_pool;
 static VkDescriptorSet descriptor_set;
 static VkPipelineLayout pipeline_layout;
-static VkPipeline pipeline;
-
-static VkCommandBuffer color_command_buffers[NUM_FRAMES_IN_FLIGHT];
-
-static VkImage color_image;
-static VmaAllocation color_image_allocation;
-VkImageView color_image_view;
-
-static VkImage depth_image;
-static VmaAllocation depth_image_allocation;
-VkImageView depth_image_view;
-
-color_pipeline_push_constants_t color_pipeline_push_constants;
-
-result_t init_color_pipeline_swapchain_dependents(void) {
-    if (vmaCreateImage(allocator, &(VkImageCreateInfo) {
-        DEFAULT_VK_IMAGE,
-        .extent.width = swap_image_extent.width,
-        .extent.height = swap_image_extent.height,
-        .format = surface_format.format,
-        .samples = render_multisample_flags,
-        .usage = VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
-    }, &device_allocation_create_info, &color_image, &color_image_allocation, NULL) != VK_SUCCESS) {
-        return result_failure;
-    }
-
-    if (vkCreateImageView(device, &(VkImageViewCreateInfo) {
-        DEFAULT_VK_IMAGE_VIEW,
-        .image = color_image,
-        .format = surface_format.format,
-        .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT
-    }, NULL, &color_image_view) != VK_SUCCESS) {
-        return result_failure;
-    }
-
-    if (vmaCreateImage(allocator, &(VkImageCreateInfo) {
-        DEFAULT_VK_IMAGE,
-        .extent.width = swap_image_extent.width,
-        .extent.height = swap_image_extent.height,
-        .format = depth_image_format,
-        .samples = render_multisample_flags,
-        .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT
-    }, &device_allocation_create_info, &depth_image, &depth_image_allocation, NULL) != VK_SUCCESS) {
-        return result_failure;
-    }
-    
-    if (vkCreateImageView(device, &(VkImageViewCreateInfo) {
-        DEFAULT_VK_IMAGE_VIEW,
-        .image = depth_image,
-        .format = depth_image_format,
-        .subresourceRange.aspectMask = (depth_image_format == VK_FORMAT_D32_SFLOAT_S8_UINT || depth_image_format == VK_FORMAT_D24_UNORM_S8_UINT) ? VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT : VK_IMAGE_ASPECT_DEPTH_BIT
-    }, NULL, &depth_image_view) != VK_SUCCESS) {
-        return result_failure;
-    }
-
-    return result_success;
-}
-
-void term_color_pipeline_swapchain_dependents(void) {
-    vkDestroyImageView(device, color_image_view, NULL);
-    vmaDestroyImage(allocator, color_image, color_image_allocation);
-    vkDestroyImageView(device, depth_image_view, NULL);
-    vmaDestroyImage(allocator, depth_image, depth_image_allocation);
-}
-
-const char* init_color_pipeline(void) {
-    if (init_color_pipeline_swapchain_dependents() != result_success) {
-        return "Failed to create color pipeline images\n";
-    }
-
-    if (vkAllocateCommandBuffers(device, &(VkCommandBufferAllocateInfo) {
-        DEFAULT_VK_COMMAND_BUFFER,
-        .commandPool = command_pool,
-        .commandBufferCount = NUM_FRAMES_IN_FLIGHT
-    }, color_command_buffers) != VK_SUCCESS) {
-        return "Failed to allocate command buffers\n";
+static VkPipeline pipelines[NUM_PIPELINES];
+
+const color_pipeline_variant_t color_pipeline_variants[NUM_COLOR_PIPELINE_VARIANTS] = {
+    [color_pipeline_variant_full] = {
+        .shadows_enabled = VK_TRUE,
+        .pcf_kernel_size = 3,
+        .specular_enabled = VK_TRUE,
+        .normal_mapping_enabled = VK_TRUE
+    },
+    [color_pipeline_variant_simple] = {
+        .shadows_enabled = VK_TRUE,
+        .pcf_kernel_size = 1,
+        .specular_enabled = VK_FALSE,
+        .normal_mapping_enabled = VK_FALSE
     }
+};
+
+// Layout of the specialization data, constant ids are the order of the members
+typedef struct {
+    color_pipeline_variant_t variant;
+    vec3s light_direction;
+    float ambient_base_scalar;
+    float specular_intensity;
+    vec3s light_color;
+    uint32_t light_cluster_tiles_x;
+    uint32_t light_cluster_tiles_y;
+    uint32_t light_cluster_slices;
+    uint32_t max_light_cluster_lights;
+} color_pipeline_specialization_t;
+
+#define SPECIALIZATION_ENTRY(ID, MEMBER, SIZE) { .constantID = (ID), .offset = offsetof(color_pipeline_specialization_t, MEMBER), .size = (SIZE) }
+
+static const VkSpecializationMapEntry specialization_map_entries[] = {
+    SPECIALIZATION_ENTRY(0, variant.shadows_enabled, sizeof(VkBool32)),
+    SPECIALIZATION_ENTRY(1, variant.pcf_kernel_size, sizeof(uint32_t)),
+    SPECIALIZATION_ENTRY(2, variant.specular_enabled, sizeof(VkBool32)),
+    SPECIALIZATION_ENTRY(3, variant.normal_mapping_enabled, sizeof(VkBool32)),
+    SPECIALIZATION_ENTRY(4, light_direction.x, sizeof(float)),
+    SPECIALIZATION_ENTRY(5, light_direction.y, sizeof(float)),
+    SPECIALIZATION_ENTRY(6, light_direction.z, sizeof(float)),
+    SPECIALIZATION_ENTRY(7, ambient_base_scalar, sizeof(float)),
+    SPECIALIZATION_ENTRY(8, specular_intensity, sizeof(float)),
+    SPECIALIZATION_ENTRY(9, light_color.x, sizeof(float)),
+    SPECIALIZATION_ENTRY(10, light_color.y, sizeof(float)),
+    SPECIALIZATION_ENTRY(11, light_color.z, sizeof(float)),
+    SPECIALIZATION_ENTRY(12, light_cluster_tiles_x, sizeof(uint32_t)),
+    SPECIALIZATION_ENTRY(13, light_cluster_tiles_y, sizeof(uint32_t)),
+    SPECIALIZATION_ENTRY(14, light_cluster_slices, sizeof(uint32_t)),
+    SPECIALIZATION_ENTRY(15, max_light_cluster_lights, sizeof(uint32_t))
+};
+
+static result_t create_color_render_pass(VkAttachmentLoadOp depth_load_op, VkRenderPass* render_pass) {
+    // Without multisampling the first attachment is the scene image itself and there is no resolve
+    bool multisampled = render_multisample_flags != VK_SAMPLE_COUNT_1_BIT;
 
     if (vkCreateRenderPass(device, &(VkRenderPassCreateInfo) {
         DEFAULT_VK_RENDER_PASS,
 
-        .attachmentCount = 3,
+        .attachmentCount = multisampled ? 3 : 2,
+        // The frame graph transitions every attachment around the pass, so the layouts stay the same
         .pAttachments = (VkAttachmentDescription[3]) {
             {
                 DEFAULT_VK_ATTACHMENT,
                 .format = surface_format.format,
                 .samples = render_multisample_flags,
                 .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-                .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                .storeOp = multisampled ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE,
+                .initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
                 .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
             },
             {
                 DEFAULT_VK_ATTACHMENT,
                 .format = depth_image_format,
                 .samples = render_multisample_flags,
-                .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                .loadOp = depth_load_op,
                 .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                .initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
                 .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
             },
             {
@@ -123,7 +120,8 @@ const char* init_color_pipeline(void) {
                 .format = surface_format.format,
                 .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
                 .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-                .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+                .initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
             }
         },
 
@@ -141,94 +139,85 @@ const char* init_color_pipeline(void) {
                 .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
             },
 
-            .pResolveAttachments = &(VkAttachmentReference) {
+            .pResolveAttachments = multisampled ? &(VkAttachmentReference) {
                 .attachment = 2,
                 .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
-            }
-        },
+            } : NULL
+        }
+    }, NULL, render_pass) != VK_SUCCESS) {
+        return result_failure;
+    }
+    return result_success;
+}
+
+const char* init_color_pipeline(void) {
+    // Dynamic rendering gives the attachments when the pass begins, so there are no render pass objects to create
+    if (!dynamic_rendering_enabled) {
+        if (create_color_render_pass(VK_ATTACHMENT_LOAD_OP_CLEAR, &color_pipeline_render_pass) != result_success) {
+            return "Failed to create render pass\n";
+        }
+        SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_RENDER_PASS, color_pipeline_render_pass, "Color render pass");
+
+        if (create_color_render_pass(VK_ATTACHMENT_LOAD_OP_LOAD, &depth_load_render_pass) != result_success) {
+            return "Failed to create render pass\n";
+        }
+        SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_RENDER_PASS, depth_load_render_pass, "Color render pass (depth prepassed)");
+
+        // Depth is stored for the color pass, the frame graph transitions it in between
+        if (vkCreateRenderPass(device, &(VkRenderPassCreateInfo) {
+            DEFAULT_VK_RENDER_PASS,
+
+            .attachmentCount = 1,
+            .pAttachments = &(VkAttachmentDescription) {
+                DEFAULT_VK_ATTACHMENT,
+                .format = depth_image_format,
+                .samples = render_multisample_flags,
+                .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                .initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+            },
 
-        .dependencyCount = 1,
-        .pDependencies = &(VkSubpassDependency) {
-            .srcSubpass = VK_SUBPASS_EXTERNAL,
-            .dstSubpass = 0,
-            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
-            .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
-            .srcAccessMask = 0,
-            .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+            .pSubpasses = &(VkSubpassDescription) {
+                .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+                .pDepthStencilAttachment = &(VkAttachmentReference) {
+                    .attachment = 0,
+                    .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+                }
+            }
+        }, NULL, &depth_prepass_render_pass) != VK_SUCCESS) {
+            return "Failed to create render pass\n";
         }
-    }, NULL, &color_pipeline_render_pass) != VK_SUCCESS) {
-        return "Failed to create render pass\n";
+        SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_RENDER_PASS, depth_prepass_render_pass, "Depth prepass render pass");
     }
 
     if (create_descriptor_set(
         &(VkDescriptorSetLayoutCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
             
-            .bindingCount = 5,
-            .pBindings = (VkDescriptorSetLayoutBinding[5]) {
+            .bindingCount = 2,
+            .pBindings = (VkDescriptorSetLayoutBinding[2]) {
                 {
                     DEFAULT_VK_DESCRIPTOR_BINDING,
                     .binding = 0,
-                    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                    .stageFlags = VK_SHADER_STAGE_VERTEX_BIT
+                    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                    .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT
                 },
                 {
                     DEFAULT_VK_DESCRIPTOR_BINDING,
                     .binding = 1,
                     .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
                     .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
-                },
-                {
-                    DEFAULT_VK_DESCRIPTOR_BINDING,
-                    .binding = 2,
-                    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                    .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
-                },
-                {
-                    DEFAULT_VK_DESCRIPTOR_BINDING,
-                    .binding = 3,
-                    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                    .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
-                },
-                {
-                    DEFAULT_VK_DESCRIPTOR_BINDING,
-                    .binding = 4,
-                    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                    .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
                 }
             }
         },
-        (descriptor_info_t[5]) {
+        (descriptor_info_t[2]) {
             {
                 .type = descriptor_info_type_buffer,
                 .buffer = {
-                    .buffer = shadow_view_projection_buffer,
+                    .buffer = frame_uniform_buffer,
                     .offset = 0,
-                    .range = sizeof(shadow_view_projection)
-                }
-            },
-            {
-                .type = descriptor_info_type_image,
-                .image = {
-                    .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                    .imageView = texture_image_views[0],
-                    .sampler = texture_image_sampler
-                }
-            },
-            {
-                .type = descriptor_info_type_image,
-                .image = {
-                    .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                    .imageView = texture_image_views[1],
-                    .sampler = texture_image_sampler
-                }
-            },
-            {
-                .type = descriptor_info_type_image,
-                .image = {
-                    .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                    .imageView = texture_image_views[2],
-                    .sampler = texture_image_sampler
+                    .range = sizeof(frame_uniforms_t)
                 }
             },
             {
@@ -245,117 +234,88 @@ const char* init_color_pipeline(void) {
         return "Failed to create descriptor set\n";
     }
 
+    // Set 0 is the bindless table with the instances, materials, their textures and the lights, set 1 holds the frame uniforms and the shadow map
     if (vkCreatePipelineLayout(device, &(VkPipelineLayoutCreateInfo) {
         DEFAULT_VK_PIPELINE_LAYOUT,
-        .pSetLayouts = &descriptor_set_layout,
-        .pushConstantRangeCount = 1,
-        .pPushConstantRanges = &(VkPushConstantRange) {
-            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-            .size = sizeof(color_pipeline_push_constants)
-        }
+        .setLayoutCount = 2,
+        .pSetLayouts = (VkDescriptorSetLayout[2]) { bindless_descriptor_set_layout, descriptor_set_layout }
     }, NULL, &pipeline_layout) != VK_SUCCESS) {
         return "Failed to create pipeline layout\n";
     }
 
-    //
+    return NULL;
+}
 
+// Runs on a pipeline job thread, everything it uses was created by init_color_pipeline
+const char* create_color_pipeline(void) {
     VkShaderModule vertex_shader_module;
-    if (create_shader_module("shader/color_pipeline_vertex.spv", &vertex_shader_module) != result_success) {
+    if (create_shader_module("color_pipeline_vertex", &vertex_shader_module) != result_success) {
         return "Failed to create vertex shader module\n";
     }
 
     VkShaderModule fragment_shader_module;
-    if (create_shader_module("shader/color_pipeline_fragment.spv", &fragment_shader_module) != result_success) {
+    if (create_shader_module("color_pipeline_fragment", &fragment_shader_module) != result_success) {
+        vkDestroyShaderModule(device, vertex_shader_module, NULL);
         return "Failed to create fragment shader module\n";
     }
 
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &(VkGraphicsPipelineCreateInfo) {
+    VkShaderModule depth_prepass_shader_module;
+    if (create_shader_module("depth_prepass_pipeline_vertex", &depth_prepass_shader_module) != result_success) {
+        vkDestroyShaderModule(device, vertex_shader_module, NULL);
+        vkDestroyShaderModule(device, fragment_shader_module, NULL);
+        return "Failed to create depth prepass shader module\n";
+    }
+
+    const VkPipelineDepthStencilStateCreateInfo* depth_create_info = reverse_depth_enabled ? &reverse_depth_stencil_create_info : &default_depth_stencil_create_info;
+
+    // Every variant shares all state except for the specialization of its shader stages
+    const VkGraphicsPipelineCreateInfo base_pipeline_create_info = {
         DEFAULT_VK_GRAPHICS_PIPELINE,
+        .pDepthStencilState = depth_create_info,
 
         .stageCount = 2,
-        .pStages = (VkPipelineShaderStageCreateInfo[2]) {
-            {
-                DEFAULT_VK_SHADER_STAGE,
-                .stage = VK_SHADER_STAGE_VERTEX_BIT,
-                .module = vertex_shader_module
-            },
-            {
-                DEFAULT_VK_SHADER_STAGE,
-                .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-                .module = fragment_shader_module
-            }
-        },
 
         .pVertexInputState = &(VkPipelineVertexInputStateCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
         
-            .vertexBindingDescriptionCount = 3,
-            .pVertexBindingDescriptions = (VkVertexInputBindingDescription[3]) {
+            // Instance data is read from the instance storage buffer, only per vertex attributes remain
+            .vertexBindingDescriptionCount = 2,
+            .pVertexBindingDescriptions = (VkVertexInputBindingDescription[2]) {
                 {
                     .binding = 0,
-                    .stride = sizeof(mat4s),
-                    .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE
-                },
-                {
-                    .binding = 1,
                     .stride = num_vertex_bytes_array[GENERAL_PIPELINE_VERTEX_ARRAY_INDEX],
                     .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
                 },
                 {
-                    .binding = 2,
+                    .binding = 1,
                     .stride = num_vertex_bytes_array[COLOR_PIPELINE_VERTEX_ARRAY_INDEX],
                     .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
                 }
             },
 
-            .vertexAttributeDescriptionCount = 8,
-            .pVertexAttributeDescriptions = (VkVertexInputAttributeDescription[8]) {
+            .vertexAttributeDescriptionCount = 4,
+            .pVertexAttributeDescriptions = (VkVertexInputAttributeDescription[4]) {
                 {
                     .binding = 0,
                     .location = 0,
-                    .format = VK_FORMAT_R32G32B32A32_SFLOAT,
-                    .offset = 0*sizeof(vec4s)
-                },
-                {
-                    .binding = 0,
-                    .location = 1,
-                    .format = VK_FORMAT_R32G32B32A32_SFLOAT,
-                    .offset = 1*sizeof(vec4s)
-                },
-                {
-                    .binding = 0,
-                    .location = 2,
-                    .format = VK_FORMAT_R32G32B32A32_SFLOAT,
-                    .offset = 2*sizeof(vec4s)
-                },
-                {
-                    .binding = 0,
-                    .location = 3,
-                    .format = VK_FORMAT_R32G32B32A32_SFLOAT,
-                    .offset = 3*sizeof(vec4s)
-                },
-                //
-                {
-                    .binding = 1,
-                    .location = 4,
                     .format = VK_FORMAT_R32G32B32_SFLOAT,
                     .offset = offsetof(general_pipeline_vertex_t, position)
                 },
                 {
-                    .binding = 2,
-                    .location = 5,
+                    .binding = 1,
+                    .location = 1,
                     .format = VK_FORMAT_R32G32B32_SFLOAT,
                     .offset = offsetof(color_pipeline_vertex_t, normal)
                 },
                 {
-                    .binding = 2,
-                    .location = 6,
+                    .binding = 1,
+                    .location = 2,
                     .format = VK_FORMAT_R32G32B32A32_SFLOAT,
                     .offset = offsetof(color_pipeline_vertex_t, tangent)
                 },
                 {
-                    .binding = 2,
-                    .location = 7,
+                    .binding = 1,
+                    .location = 3,
                     .format = VK_FORMAT_R32G32_SFLOAT,
                     .offset = offsetof(color_pipeline_vertex_t, tex_coord)
                 }
@@ -367,67 +327,283 @@ const char* init_color_pipeline(void) {
             .rasterizationSamples = render_multisample_flags
         },
         .layout = pipeline_layout,
-        .renderPass = color_pipeline_render_pass
-    }, NULL, &pipeline) != VK_SUCCESS) {
-        return "Failed to create graphics pipeline\n";
+        .renderPass = color_pipeline_render_pass,
+        .pNext = dynamic_rendering_enabled ? &(VkPipelineRenderingCreateInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR,
+            .colorAttachmentCount = 1,
+            .pColorAttachmentFormats = &surface_format.format,
+            .depthAttachmentFormat = depth_image_format
+        } : NULL
+    };
+
+    color_pipeline_specialization_t specializations[NUM_COLOR_PIPELINE_VARIANTS];
+    VkSpecializationInfo specialization_infos[NUM_COLOR_PIPELINE_VARIANTS];
+    VkPipelineShaderStageCreateInfo shader_stage_create_infos[NUM_COLOR_PIPELINE_VARIANTS][2];
+    VkGraphicsPipelineCreateInfo pipeline_create_infos[NUM_PIPELINES];
+
+    // Only fragments that ended up visible in the prepass are shaded, their depth is already written
+    const VkPipelineDepthStencilStateCreateInfo depth_equal_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+        .depthTestEnable = VK_TRUE,
+        .depthWriteEnable = VK_FALSE,
+        .depthCompareOp = VK_COMPARE_OP_EQUAL,
+        .depthBoundsTestEnable = VK_FALSE,
+        .stencilTestEnable = VK_FALSE
+    };
+
+    for (size_t i = 0; i < NUM_COLOR_PIPELINE_VARIANTS; i++) {
+        specializations[i] = (color_pipeline_specialization_t) {
+            .variant = color_pipeline_variants[i],
+            .light_direction = light_direction,
+            .ambient_base_scalar = 0.2f,
+            .specular_intensity = 5.0f,
+            .light_color = light_color,
+            .light_cluster_tiles_x = LIGHT_CLUSTER_TILES_X,
+            .light_cluster_tiles_y = LIGHT_CLUSTER_TILES_Y,
+            .light_cluster_slices = LIGHT_CLUSTER_SLICES,
+            .max_light_cluster_lights = MAX_LIGHT_CLUSTER_LIGHTS
+        };
+
+        specialization_infos[i] = (VkSpecializationInfo) {
+            .mapEntryCount = NUM_ELEMS(specialization_map_entries),
+            .pMapEntries = specialization_map_entries,
+            .dataSize = sizeof(specializations[i]),
+            .pData = &specializations[i]
+        };
+
+        shader_stage_create_infos[i][0] = (VkPipelineShaderStageCreateInfo) {
+            DEFAULT_VK_SHADER_STAGE,
+            .stage = VK_SHADER_STAGE_VERTEX_BIT,
+            .module = vertex_shader_module,
+            .pSpecializationInfo = &specialization_infos[i]
+        };
+        shader_stage_create_infos[i][1] = (VkPipelineShaderStageCreateInfo) {
+            DEFAULT_VK_SHADER_STAGE,
+            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .module = fragment_shader_module,
+            .pSpecializationInfo = &specialization_infos[i]
+        };
+
+        pipeline_create_infos[i] = base_pipeline_create_info;
+        pipeline_create_infos[i].pStages = shader_stage_create_infos[i];
+
+        pipeline_create_infos[DEPTH_EQUAL_PIPELINES + i] = pipeline_create_infos[i];
+        pipeline_create_infos[DEPTH_EQUAL_PIPELINES + i].pDepthStencilState = &depth_equal_create_info;
     }
 
+    // Depth only, reads nothing but the position stream the shadow pass uses as well
+    pipeline_create_infos[DEPTH_PREPASS_PIPELINE] = (VkGraphicsPipelineCreateInfo) {
+        DEFAULT_VK_GRAPHICS_PIPELINE,
+
+        .stageCount = 1,
+        .pStages = &(VkPipelineShaderStageCreateInfo) {
+            DEFAULT_VK_SHADER_STAGE,
+            .stage = VK_SHADER_STAGE_VERTEX_BIT,
+            .module = depth_prepass_shader_module
+        },
+        .pDepthStencilState = depth_create_info,
+
+        .pVertexInputState = &(VkPipelineVertexInputStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+
+            .vertexBindingDescriptionCount = 1,
+            .pVertexBindingDescriptions = &(VkVertexInputBindingDescription) {
+                .binding = 0,
+                .stride = num_vertex_bytes_array[GENERAL_PIPELINE_VERTEX_ARRAY_INDEX],
+                .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+            },
+
+            .vertexAttributeDescriptionCount = 1,
+            .pVertexAttributeDescriptions = &(VkVertexInputAttributeDescription) {
+                .binding = 0,
+                .location = 0,
+                .format = VK_FORMAT_R32G32B32_SFLOAT,
+                .offset = offsetof(general_pipeline_vertex_t, position)
+            }
+        },
+        .pRasterizationState = &(VkPipelineRasterizationStateCreateInfo) { DEFAULT_VK_RASTERIZATION },
+        .pMultisampleState = &(VkPipelineMultisampleStateCreateInfo) {
+            DEFAULT_VK_MULTISAMPLE,
+            .rasterizationSamples = render_multisample_flags
+        },
+        .pColorBlendState = NULL,
+        .layout = pipeline_layout,
+        .renderPass = depth_prepass_render_pass,
+        .pNext = dynamic_rendering_enabled ? &(VkPipelineRenderingCreateInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR,
+            .depthAttachmentFormat = depth_image_format
+        } : NULL
+    };
+
+    // All pipelines in one call so the driver can compile them in parallel
+    // Created aside, the current ones stay in use until all new ones exist
+    VkPipeline new_pipelines[NUM_PIPELINES];
+    VkResult result = vkCreateGraphicsPipelines(device, pipeline_cache, NUM_PIPELINES, pipeline_create_infos, NULL, new_pipelines);
+
     vkDestroyShaderModule(device, vertex_shader_module, NULL);
     vkDestroyShaderModule(device, fragment_shader_module, NULL);
+    vkDestroyShaderModule(device, depth_prepass_shader_module, NULL);
+
+    // The call can fail after creating some of them, those that failed are VK_NULL_HANDLE
+    if (result != VK_SUCCESS) {
+        for (size_t i = 0; i < NUM_PIPELINES; i++) {
+            if (new_pipelines[i] != VK_NULL_HANDLE) {
+                vkDestroyPipeline(device, new_pipelines[i], NULL);
+            }
+        }
+        return "Failed to create graphics pipeline\n";
+    }
+    memcpy(pipelines, new_pipelines, sizeof(pipelines));
+    SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_PIPELINE, pipelines[color_pipeline_variant_full], "Color pipeline (full variant)");
+    SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_PIPELINE, pipelines[color_pipeline_variant_simple], "Color pipeline (simple variant)");
+    SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_PIPELINE, pipelines[DEPTH_EQUAL_PIPELINES + color_pipeline_variant_full], "Color pipeline (full variant, depth equal)");
+    SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_PIPELINE, pipelines[DEPTH_EQUAL_PIPELINES + color_pipeline_variant_simple], "Color pipeline (simple variant, depth equal)");
+    SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_PIPELINE, pipelines[DEPTH_PREPASS_PIPELINE], "Depth prepass pipeline");
 
     return NULL;
 }
 
-const char* draw_color_pipeline(size_t frame_index, size_t image_index, VkCommandBuffer* out_command_buffer) {
-    VkCommandBuffer command_buffer = color_command_buffers[frame_index];
-    *out_command_buffer = command_buffer;
+// Keeps the current pipeline when the new one fails, so a broken shader edit does not stop the app
+const char* recreate_color_pipeline(void) {
+    VkPipeline old_pipelines[NUM_PIPELINES];
+    memcpy(old_pipelines, pipelines, sizeof(pipelines));
 
-    vkResetCommandBuffer(command_buffer, 0);
-    if (vkBeginCommandBuffer(command_buffer, &(VkCommandBufferBeginInfo) {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
-    }) != VK_SUCCESS) {
-        return "Failed to begin writing to command buffer\n";
+    const char* msg = create_color_pipeline();
+    if (msg != NULL) {
+        return msg;
     }
 
-    begin_pipeline(
-        command_buffer,
-        swapchain_framebuffers[image_index], swap_image_extent,
-        2, (VkClearValue[2]) {
-            { .color = { .float32 = { 0.62f, 0.78f, 1.0f, 1.0f } } },
-            { .depthStencil = { .depth = 1.0f, .stencil = 0 } },
-        },
-        color_pipeline_render_pass, descriptor_set, pipeline_layout, pipeline
-    );
+    for (size_t i = 0; i < NUM_PIPELINES; i++) {
+        vkDestroyPipeline(device, old_pipelines[i], NULL);
+    }
+    return NULL;
+}
 
-    for (size_t i = 0; i < NUM_MODELS; i++) {
-        color_pipeline_push_constants.layer_index = (float)i;
+// Depth images are cleared to the far end of the depth range
+static float get_far_depth(void) {
+    return reverse_depth_enabled ? 0.0f : 1.0f;
+}
 
-        vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(color_pipeline_push_constants), &color_pipeline_push_constants);
+void draw_depth_prepass(VkCommandBuffer command_buffer, uint32_t frame_uniform_offset) {
+    if (dynamic_rendering_enabled) {
+        begin_rendering_pipeline(command_buffer, &(VkRenderingInfoKHR) {
+            DEFAULT_VK_RENDERING,
+            .renderArea.extent = render_extent,
+            .pDepthAttachment = &(VkRenderingAttachmentInfoKHR) {
+                DEFAULT_VK_RENDERING_ATTACHMENT,
+                .imageView = frame_resources[frame_depth_image].view,
+                .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                .clearValue = { .depthStencil = { .depth = get_far_depth(), .stencil = 0 } }
+            }
+        }, bindless_descriptor_set, pipeline_layout, pipelines[DEPTH_PREPASS_PIPELINE]);
+    } else {
+        begin_pipeline(
+            command_buffer,
+            depth_prepass_framebuffer, render_extent,
+            1, &(VkClearValue) { .depthStencil = { .depth = get_far_depth(), .stencil = 0 } },
+            depth_prepass_render_pass, bindless_descriptor_set, pipeline_layout, pipelines[DEPTH_PREPASS_PIPELINE]
+        );
+    }
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 1, 1, &descriptor_set, 1, &frame_uniform_offset);
 
-        bind_vertex_buffers(command_buffer, 3, (VkBuffer[3]) {
-            instance_buffers[i],
-            vertex_buffer_arrays[i][GENERAL_PIPELINE_VERTEX_ARRAY_INDEX],
-            vertex_buffer_arrays[i][COLOR_PIPELINE_VERTEX_ARRAY_INDEX]
-        });
+    // Every model regardless of its variant, each draw walks its instances front to back through the instance order
+    for (size_t i = 0; i < NUM_MODELS; i++) {
+        bind_vertex_buffers(command_buffer, 1, &vertex_buffer_arrays[i][GENERAL_PIPELINE_VERTEX_ARRAY_INDEX]);
         vkCmdBindIndexBuffer(command_buffer, index_buffers[i], 0, VK_INDEX_TYPE_UINT16);
-        vkCmdDrawIndexed(command_buffer, num_indices_array[i], num_instances_array[i], 0, 0, 0);
+        vkCmdDrawIndexed(command_buffer, num_indices_array[i], num_instances_array[i], 0, 0, first_instances_array[i]);
+    }
+
+    if (dynamic_rendering_enabled) {
+        end_rendering_pipeline(command_buffer);
+    } else {
+        end_pipeline(command_buffer);
+    }
+}
+
+void draw_color_pipeline(VkCommandBuffer command_buffer, uint32_t frame_uniform_offset, bool draw_models, bool depth_prepassed) {
+    // After a prepass the depth is loaded instead of cleared and only tested
+    const VkPipeline* variant_pipelines = depth_prepassed ? &pipelines[DEPTH_EQUAL_PIPELINES] : pipelines;
+
+    if (dynamic_rendering_enabled) {
+        // The multisampled image is resolved into the scene image at the end of rendering and then discarded
+        bool multisampled = render_multisample_flags != VK_SAMPLE_COUNT_1_BIT;
+        begin_rendering_pipeline(command_buffer, &(VkRenderingInfoKHR) {
+            DEFAULT_VK_RENDERING,
+            .renderArea.extent = render_extent,
+            .colorAttachmentCount = 1,
+            .pColorAttachments = &(VkRenderingAttachmentInfoKHR) {
+                DEFAULT_VK_RENDERING_ATTACHMENT,
+                .imageView = multisampled ? frame_resources[frame_color_image].view : frame_resources[frame_scene_image].view,
+                .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                .resolveMode = multisampled ? VK_RESOLVE_MODE_AVERAGE_BIT : VK_RESOLVE_MODE_NONE,
+                .resolveImageView = multisampled ? frame_resources[frame_scene_image].view : VK_NULL_HANDLE,
+                .resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                .storeOp = multisampled ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE,
+                .clearValue = { .color = { .float32 = { 0.62f, 0.78f, 1.0f, 1.0f } } }
+            },
+            .pDepthAttachment = &(VkRenderingAttachmentInfoKHR) {
+                DEFAULT_VK_RENDERING_ATTACHMENT,
+                .imageView = frame_resources[frame_depth_image].view,
+                .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                .loadOp = depth_prepassed ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
+                .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                .clearValue = { .depthStencil = { .depth = get_far_depth(), .stencil = 0 } }
+            }
+        }, bindless_descriptor_set, pipeline_layout, variant_pipelines[color_pipeline_variant_full]);
+    } else {
+        begin_pipeline(
+            command_buffer,
+            color_framebuffer, render_extent,
+            2, (VkClearValue[2]) {
+                { .color = { .float32 = { 0.62f, 0.78f, 1.0f, 1.0f } } },
+                { .depthStencil = { .depth = get_far_depth(), .stencil = 0 } },
+            },
+            depth_prepassed ? depth_load_render_pass : color_pipeline_render_pass, bindless_descriptor_set, pipeline_layout, variant_pipelines[color_pipeline_variant_full]
+        );
     }
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 1, 1, &descriptor_set, 1, &frame_uniform_offset);
 
-    end_pipeline(command_buffer);
+    // Instances and materials are reached through the first instance of each draw, so nothing but vertex and index buffers changes between draws
+
+    // Models are drawn grouped by the variant of their material, so each pipeline is bound at most once
+    size_t bound_variant = color_pipeline_variant_full;
+    for (size_t variant = 0; draw_models && variant < NUM_COLOR_PIPELINE_VARIANTS; variant++) {
+        for (size_t i = 0; i < NUM_MODELS; i++) {
+            if (model_color_pipeline_variants[i] != variant) {
+                continue;
+            }
+            if (bound_variant != variant) {
+                vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, variant_pipelines[variant]);
+                bound_variant = variant;
+            }
 
-    if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
-        return "Failed to end command buffer\n";
+            bind_vertex_buffers(command_buffer, 2, (VkBuffer[2]) {
+                vertex_buffer_arrays[i][GENERAL_PIPELINE_VERTEX_ARRAY_INDEX],
+                vertex_buffer_arrays[i][COLOR_PIPELINE_VERTEX_ARRAY_INDEX]
+            });
+            vkCmdBindIndexBuffer(command_buffer, index_buffers[i], 0, VK_INDEX_TYPE_UINT16);
+            vkCmdDrawIndexed(command_buffer, num_indices_array[i], num_instances_array[i], 0, 0, first_instances_array[i]);
+        }
     }
 
-    return NULL;
+    if (dynamic_rendering_enabled) {
+        end_rendering_pipeline(command_buffer);
+    } else {
+        end_pipeline(command_buffer);
+    }
 }
 
 void term_color_pipeline(void) {
-    vkDestroyPipeline(device, pipeline, NULL);
+    for (size_t i = 0; i < NUM_PIPELINES; i++) {
+        vkDestroyPipeline(device, pipelines[i], NULL);
+    }
     vkDestroyPipelineLayout(device, pipeline_layout, NULL);
     vkDestroyRenderPass(device, color_pipeline_render_pass, NULL);
+    vkDestroyRenderPass(device, depth_load_render_pass, NULL);
+    vkDestroyRenderPass(device, depth_prepass_render_pass, NULL);
     vkDestroyDescriptorPool(device, descriptor_pool, NULL);
     vkDestroyDescriptorSetLayout(device, descriptor_set_layout, NULL);
-
-    term_color_pipeline_swapchain_dependents();
 }
\ No newline at end of file
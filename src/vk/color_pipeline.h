@@ -10,22 +10,30 @@
 #include <assert.h>
 
 extern VkRenderPass color_pipeline_render_pass;
+// Depth only, its framebuffer holds the depth image the color pass then loads
+extern VkRenderPass depth_prepass_render_pass;
 
-extern VkImageView color_image_view;
-
-extern VkImageView depth_image_view;
-
+// Feature switches of the color fragment shader, each variant is its own pipeline specialized from the same SPIR-V
 typedef struct {
-    mat4s view_projection;
-    vec3s camera_position;
-    float layer_index;
-} color_pipeline_push_constants_t;
-extern color_pipeline_push_constants_t color_pipeline_push_constants;
-static_assert(sizeof(color_pipeline_push_constants_t) <= 256, "Push constants must be less than or equal to 256 bytes");
+    VkBool32 shadows_enabled;
+    uint32_t pcf_kernel_size;
+    VkBool32 specular_enabled;
+    VkBool32 normal_mapping_enabled;
+} color_pipeline_variant_t;
+
+typedef enum {
+    color_pipeline_variant_full,
+    color_pipeline_variant_simple,
+    NUM_COLOR_PIPELINE_VARIANTS
+} color_pipeline_variant_index_t;
 
-result_t init_color_pipeline_swapchain_dependents(void);
-void term_color_pipeline_swapchain_dependents(void);
+extern const color_pipeline_variant_t color_pipeline_variants[NUM_COLOR_PIPELINE_VARIANTS];
 
 const char* init_color_pipeline(void);
-const char* draw_color_pipeline(size_t frame_index, size_t image_index, VkCommandBuffer* out_command_buffer);
+const char* create_color_pipeline(void);
+const char* recreate_color_pipeline(void);
+// Fills the depth image so the color pass only shades visible fragments, its models have to be ready
+void draw_depth_prepass(VkCommandBuffer command_buffer, uint32_t frame_uniform_offset);
+// Renders the scene image at render_extent, with depth_prepassed the depth image is loaded and tested with EQUAL instead of cleared
+void draw_color_pipeline(VkCommandBuffer command_buffer, uint32_t frame_uniform_offset, bool draw_models, bool depth_prepassed);
 void term_color_pipeline(void);
\ No newline at end of file
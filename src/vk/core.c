@@ -1,16 +1,27 @@
 #include "core.h"
 #include "util.h"
 #include "result.h"
+#include "gfx_core.h"
 #include "gfx_pipeline.h"
 #include "shadow_pipeline.h"
 #include "color_pipeline.h"
+#include "upscale_pipeline.h"
 #include "asset.h"
+#include "upload.h"
+#include "render.h"
+#include "pipeline_cache.h"
+#include "debug.h"
+#include "bindless.h"
+#include "frame_uniforms.h"
+#include "shader.h"
+#include "shader_reload.h"
 #include "defaults.h"
 #include <stdbool.h>
 #include <string.h>
 #include <malloc.h>
 #include <stdalign.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #define WIDTH 640
 #define HEIGHT 480
@@ -31,17 +42,58 @@ uint32_t num_swapchain_images;
 VkImage* swapchain_images;
 VkImageView* swapchain_image_views;
 VkFramebuffer* swapchain_framebuffers;
+VkFramebuffer color_framebuffer;
+VkFramebuffer depth_prepass_framebuffer;
 VkSwapchainKHR swapchain;
 VkInstance instance;
 VkSurfaceKHR surface;
 VkExtent2D swap_image_extent;
 VkQueue graphics_queue;
 VkQueue presentation_queue;
+VkQueue transfer_queue;
 bool framebuffer_resized;
+VkExtent2D window_extent;
+bool window_resized;
 
 VkSampleCountFlagBits render_multisample_flags;
 
 VkFormat depth_image_format;
+VkImageAspectFlags depth_image_aspect_flags;
+bool reverse_depth_enabled = false;
+
+const present_policy_info_t present_policy_infos[NUM_PRESENT_POLICIES] = {
+    [present_policy_fifo] = { "fifo", VK_PRESENT_MODE_FIFO_KHR },
+    [present_policy_fifo_relaxed] = { "fifo_relaxed", VK_PRESENT_MODE_FIFO_RELAXED_KHR },
+    [present_policy_mailbox] = { "mailbox", VK_PRESENT_MODE_MAILBOX_KHR },
+    [present_policy_immediate] = { "immediate", VK_PRESENT_MODE_IMMEDIATE_KHR },
+    [present_policy_low_latency] = { "low_latency", VK_PRESENT_MODE_FIFO_KHR }
+};
+
+present_policy_t present_policy = present_policy_mailbox;
+bool present_wait_enabled = false;
+// Bit per core present mode the surface supports, FIFO always is
+static uint32_t supported_present_mode_bits;
+
+bool validation_enabled = false;
+bool dynamic_rendering_enabled = false;
+
+// Resources of a replaced swapchain, frames recorded before the replacement may still be using them
+typedef struct {
+    uint64_t retire_frame_number;
+    VkSwapchainKHR swapchain;
+    uint32_t num_images;
+    VkImage* images;
+    VkImageView* image_views;
+    VkFramebuffer* framebuffers;
+    VkFramebuffer color_framebuffer;
+    VkFramebuffer depth_prepass_framebuffer;
+    render_graph_transients_t frame_graph_transients;
+} retired_swapchain_t;
+
+// Resizing every frame retires one swapchain per frame until the first one's frame finishes
+#define MAX_RETIRED_SWAPCHAINS (NUM_FRAMES_IN_FLIGHT + 2)
+static uint32_t num_retired_swapchains = 0;
+static retired_swapchain_t retired_swapchains[MAX_RETIRED_SWAPCHAINS];
 
 static const char* layers[] = {
     "VK_LAYER_KHRONOS_validation"
@@ -51,6 +103,7 @@ static const char* extensions[] = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+#ifdef VULKAN_DEBUG
 static result_t check_layers(void) {
     uint32_t num_available_layers;
     vkEnumerateInstanceLayerProperties(&num_available_layers, NULL);
@@ -58,10 +111,6 @@ static result_t check_layers(void) {
     VkLayerProperties available_layers[num_available_layers];
     vkEnumerateInstanceLayerProperties(&num_available_layers, available_layers);
 
-    for (size_t i = 0; i < num_available_layers; i++) {
-        printf("%s\n", available_layers[i].layerName);
-    }
-
     for (size_t i = 0; i < NUM_ELEMS(layers); i++) {
         bool not_found = true;
         for (size_t j = 0; j < num_available_layers; j++) {
@@ -78,6 +127,7 @@ static result_t check_layers(void) {
 
     return result_success;
 }
+#endif
 
 static result_t check_extensions(VkPhysicalDevice physical_device) {
     uint32_t num_available_extensions;
@@ -103,9 +153,54 @@ static result_t check_extensions(VkPhysicalDevice physical_device) {
     return result_success;
 }
 
+static bool has_device_extension(VkPhysicalDevice physical_device, const char* extension) {
+    uint32_t num_available_extensions;
+    vkEnumerateDeviceExtensionProperties(physical_device, NULL, &num_available_extensions, NULL);
+    
+    VkExtensionProperties available_extensions[num_available_extensions];
+    vkEnumerateDeviceExtensionProperties(physical_device, NULL, &num_available_extensions, available_extensions);
+
+    for (size_t i = 0; i < num_available_extensions; i++) {
+        if (strcmp(extension, available_extensions[i].extensionName) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool has_present_wait_support(VkPhysicalDevice physical_device) {
+    if (!has_device_extension(physical_device, VK_KHR_PRESENT_ID_EXTENSION_NAME) || !has_device_extension(physical_device, VK_KHR_PRESENT_WAIT_EXTENSION_NAME)) {
+        return false;
+    }
+
+    VkPhysicalDevicePresentWaitFeaturesKHR present_wait_features = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR };
+    VkPhysicalDevicePresentIdFeaturesKHR present_id_features = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR, .pNext = &present_wait_features };
+    vkGetPhysicalDeviceFeatures2(physical_device, &(VkPhysicalDeviceFeatures2) {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &present_id_features
+    });
+
+    return present_id_features.presentId && present_wait_features.presentWait;
+}
+
+static bool has_dynamic_rendering_support(VkPhysicalDevice physical_device) {
+    if (!has_device_extension(physical_device, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)) {
+        return false;
+    }
+
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR };
+    vkGetPhysicalDeviceFeatures2(physical_device, &(VkPhysicalDeviceFeatures2) {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &dynamic_rendering_features
+    });
+
+    return dynamic_rendering_features.dynamicRendering;
+}
+
+// The light clusters are assigned by a compute dispatch recorded with the scene
 static uint32_t get_graphics_queue_family_index(uint32_t num_queue_families, const VkQueueFamilyProperties queue_families[]) {
     for (uint32_t i = 0; i < num_queue_families; i++) {
-        if (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        if ((queue_families[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) {
             return i;
         }
     }
@@ -127,6 +222,23 @@ static uint32_t get_presentation_queue_family_index(VkPhysicalDevice physical_de
     return NULL_UINT32;
 }
 
+static uint32_t get_transfer_queue_family_index(uint32_t graphics_queue_family_index, uint32_t num_queue_families, const VkQueueFamilyProperties queue_families[]) {
+#ifdef GPU_MIP_GENERATION
+    // Mip chains are blitted on the upload queue, which needs graphics support
+    (void)num_queue_families;
+    (void)queue_families;
+#else
+    // A transfer only family is usually backed by a dedicated copy engine that runs alongside rendering
+    for (uint32_t i = 0; i < num_queue_families; i++) {
+        VkQueueFlags flags = queue_families[i].queueFlags;
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            return i;
+        }
+    }
+#endif
+    return graphics_queue_family_index;
+}
+
 static result_t get_physical_device(uint32_t num_physical_devices, const VkPhysicalDevice physical_devices[], VkPhysicalDevice* out_physical_device, uint32_t* out_num_surface_formats, uint32_t* out_num_present_modes, queue_family_indices_t* out_queue_family_indices) {
     for (size_t i = 0; i < num_physical_devices; i++) {
         VkPhysicalDevice physical_device = physical_devices[i];
@@ -144,10 +256,31 @@ static result_t get_physical_device(uint32_t num_physical_devices, const VkPhysi
             continue;
         }
 
-        VkPhysicalDeviceFeatures features;
-        vkGetPhysicalDeviceFeatures(physical_device, &features);
+        if (physical_device_properties.apiVersion < VK_API_VERSION_1_2) {
+            continue;
+        }
+
+        VkPhysicalDeviceVulkan12Features vulkan12_features = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+        VkPhysicalDeviceFeatures2 features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &vulkan12_features
+        };
+        vkGetPhysicalDeviceFeatures2(physical_device, &features);
+
+        if (!features.features.samplerAnisotropy) {
+            continue;
+        }
 
-        if (!features.samplerAnisotropy) {
+        // Needed by the bindless descriptor table, storage buffers are indexed by values read from the frame uniforms
+        if (
+            !features.features.shaderStorageBufferArrayDynamicIndexing ||
+            !vulkan12_features.descriptorIndexing ||
+            !vulkan12_features.runtimeDescriptorArray ||
+            !vulkan12_features.descriptorBindingPartiallyBound ||
+            !vulkan12_features.descriptorBindingSampledImageUpdateAfterBind ||
+            !vulkan12_features.descriptorBindingStorageBufferUpdateAfterBind ||
+            !vulkan12_features.shaderSampledImageArrayNonUniformIndexing
+        ) {
             continue;
         }
         
@@ -185,10 +318,12 @@ static result_t get_physical_device(uint32_t num_physical_devices, const VkPhysi
             break;
         }
 
+        uint32_t transfer_queue_family_index = get_transfer_queue_family_index(graphics_queue_family_index, num_queue_families, queue_families);
+
         *out_physical_device = physical_device;
         *out_num_surface_formats = num_surface_formats;
         *out_num_present_modes = num_present_modes;
-        *out_queue_family_indices = (queue_family_indices_t) {{ graphics_queue_family_index, presentation_queue_family_index }};
+        *out_queue_family_indices = (queue_family_indices_t) {{ graphics_queue_family_index, presentation_queue_family_index, transfer_queue_family_index }};
         return result_success;
     }
     return result_failure;
@@ -205,26 +340,29 @@ static VkSurfaceFormatKHR get_surface_format(uint32_t num_surface_formats, const
     return surface_formats[0];
 }
 
-static VkPresentModeKHR get_present_mode(uint32_t num_present_modes, const VkPresentModeKHR present_modes[]) {
-    for (size_t i = 0; i < num_present_modes; i++) {
-        VkPresentModeKHR present_mode = present_modes[i];
-        if (present_mode == VK_PRESENT_MODE_MAILBOX_KHR) {
-            return present_mode;
-        }
+static VkPresentModeKHR get_present_mode(present_policy_t policy) {
+    VkPresentModeKHR present_mode = present_policy_infos[policy].present_mode;
+    if (supported_present_mode_bits & (1u << present_mode)) {
+        return present_mode;
     }
 
     return VK_PRESENT_MODE_FIFO_KHR;
 }
 
+void set_present_policy(present_policy_t policy) {
+    present_policy = policy;
+    framebuffer_resized = true;
+
+    bool supported = get_present_mode(policy) == present_policy_infos[policy].present_mode;
+    printf("Present policy %s%s\n", present_policy_infos[policy].name, supported ? "" : ", unsupported so presenting with fifo");
+}
+
 static VkExtent2D get_swap_image_extent(const VkSurfaceCapabilitiesKHR* capabilities) {
     if (capabilities->currentExtent.width != NULL_UINT32) {
         return capabilities->currentExtent;
     }
 
-    int width;
-    int height;
-    glfwGetFramebufferSize(window, &width, &height);
-    VkExtent2D extent = { (uint32_t)width, (uint32_t)height };
+    VkExtent2D extent = window_extent;
 
     extent.width = clamp_uint32(extent.width, capabilities->minImageExtent.width, capabilities->maxImageExtent.width);
     extent.height = clamp_uint32(extent.height, capabilities->minImageExtent.height, capabilities->maxImageExtent.height);
@@ -232,7 +370,8 @@ static VkExtent2D get_swap_image_extent(const VkSurfaceCapabilitiesKHR* capabili
     return extent;
 }
 
-static result_t init_swapchain(void) {
+// Passing the old swapchain lets the presentation engine hand its images over, it is retired but not destroyed here
+static result_t init_swapchain(VkSwapchainKHR old_swapchain) {
     VkSurfaceCapabilitiesKHR capabilities;
     vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &capabilities);
     swap_image_extent = get_swap_image_extent(&capabilities); // NOTE: Not actually a problem? (https://github.com/KhronosGroup/Vulkan-ValidationLayers/issues/1340)
@@ -242,6 +381,9 @@ static result_t init_swapchain(void) {
         min_num_swapchain_images = clamp_uint32(min_num_swapchain_images, 0, capabilities.maxImageCount);
     }
 
+    // The policy can have changed since the last swapchain
+    present_mode = get_present_mode(present_policy);
+
     VkSwapchainCreateInfoKHR info = {
         .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
         .surface = surface,
@@ -255,7 +397,7 @@ static result_t init_swapchain(void) {
         .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
         .presentMode = present_mode,
         .clipped = VK_TRUE,
-        .oldSwapchain = VK_NULL_HANDLE
+        .oldSwapchain = old_swapchain
     };
 
     if (queue_family_indices.graphics != queue_family_indices.presentation) {
@@ -275,7 +417,13 @@ static result_t init_swapchain(void) {
     return result_success;
 }
 
+// The arrays belong to this swapchain, the image count can differ between swapchains
 static result_t init_swapchain_framebuffers(void) {
+    vkGetSwapchainImagesKHR(device, swapchain, &num_swapchain_images, NULL);
+    swapchain_images = memalign(64, num_swapchain_images*sizeof(VkImage));
+    swapchain_image_views = memalign(64, num_swapchain_images*sizeof(VkImageView));
+    swapchain_framebuffers = dynamic_rendering_enabled ? NULL : memalign(64, num_swapchain_images*sizeof(VkFramebuffer));
+
     vkGetSwapchainImagesKHR(device, swapchain, &num_swapchain_images, swapchain_images);
 
     for (size_t i = 0; i < num_swapchain_images; i++) {
@@ -289,12 +437,17 @@ static result_t init_swapchain_framebuffers(void) {
         }
     }
 
+    // Every pass renders straight into the image views
+    if (dynamic_rendering_enabled) {
+        return result_success;
+    }
+
     for (size_t i = 0; i < num_swapchain_images; i++) {
         if (vkCreateFramebuffer(device, &(VkFramebufferCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-            .renderPass = color_pipeline_render_pass,
-            .attachmentCount = 3,
-            .pAttachments = (VkImageView[3]) { color_image_view, depth_image_view, swapchain_image_views[i] },
+            .renderPass = upscale_pipeline_render_pass,
+            .attachmentCount = 1,
+            .pAttachments = &swapchain_image_views[i],
             .width = swap_image_extent.width,
             .height = swap_image_extent.height,
             .layers = 1
@@ -302,39 +455,120 @@ static result_t init_swapchain_framebuffers(void) {
             return result_failure;
         }
     }
+
+    // Without multisampling the scene image is the color attachment and nothing is resolved
+    bool multisampled = render_multisample_flags != VK_SAMPLE_COUNT_1_BIT;
+    if (vkCreateFramebuffer(device, &(VkFramebufferCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+        .renderPass = color_pipeline_render_pass,
+        .attachmentCount = multisampled ? 3 : 2,
+        .pAttachments = multisampled ?
+            (VkImageView[3]) { frame_resources[frame_color_image].view, frame_resources[frame_depth_image].view, frame_resources[frame_scene_image].view } :
+            (VkImageView[2]) { frame_resources[frame_scene_image].view, frame_resources[frame_depth_image].view },
+        .width = swap_image_extent.width,
+        .height = swap_image_extent.height,
+        .layers = 1
+    }, NULL, &color_framebuffer) != VK_SUCCESS) {
+        return result_failure;
+    }
+
+    if (vkCreateFramebuffer(device, &(VkFramebufferCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+        .renderPass = depth_prepass_render_pass,
+        .attachmentCount = 1,
+        .pAttachments = &frame_resources[frame_depth_image].view,
+        .width = swap_image_extent.width,
+        .height = swap_image_extent.height,
+        .layers = 1
+    }, NULL, &depth_prepass_framebuffer) != VK_SUCCESS) {
+        return result_failure;
+    }
     return result_success;
 }
 
-static void term_swapchain(void) {
-    for (size_t i = 0; i < num_swapchain_images; i++) {
-        vkDestroyImageView(device, swapchain_image_views[i], NULL);
-        vkDestroyFramebuffer(device, swapchain_framebuffers[i], NULL);
+static void retire_swapchain(uint64_t retire_frame_number, retired_swapchain_t* retired) {
+    *retired = (retired_swapchain_t) {
+        .retire_frame_number = retire_frame_number,
+        .swapchain = swapchain,
+        .num_images = num_swapchain_images,
+        .images = swapchain_images,
+        .image_views = swapchain_image_views,
+        .framebuffers = swapchain_framebuffers,
+        .color_framebuffer = color_framebuffer,
+        .depth_prepass_framebuffer = depth_prepass_framebuffer
+    };
+    retire_frame_graph(&retired->frame_graph_transients);
+
+    swapchain = VK_NULL_HANDLE;
+    swapchain_images = NULL;
+    swapchain_image_views = NULL;
+    swapchain_framebuffers = NULL;
+    color_framebuffer = VK_NULL_HANDLE;
+    depth_prepass_framebuffer = VK_NULL_HANDLE;
+}
+
+static void destroy_retired_swapchain(const retired_swapchain_t* retired) {
+    for (size_t i = 0; i < retired->num_images; i++) {
+        vkDestroyImageView(device, retired->image_views[i], NULL);
+        if (!dynamic_rendering_enabled) {
+            vkDestroyFramebuffer(device, retired->framebuffers[i], NULL);
+        }
     }
-    
-    vkDestroySwapchainKHR(device, swapchain, NULL);
+    vkDestroyFramebuffer(device, retired->color_framebuffer, NULL);
+    vkDestroyFramebuffer(device, retired->depth_prepass_framebuffer, NULL);
+    destroy_render_graph_transients(&retired->frame_graph_transients);
+
+    vkDestroySwapchainKHR(device, retired->swapchain, NULL);
+
+    free(retired->images);
+    free(retired->image_views);
+    free(retired->framebuffers);
 }
 
-void reinit_swapchain(void) {
-    // Even the tutorials use bad hacks, im all in
-    int width;
-    int height;
-    glfwGetFramebufferSize(window, &width, &height);
+void destroy_retired_swapchains(uint64_t frame_number) {
+    uint32_t num_remaining = 0;
+    for (uint32_t i = 0; i < num_retired_swapchains; i++) {
+        if (retired_swapchains[i].retire_frame_number <= frame_number) {
+            destroy_retired_swapchain(&retired_swapchains[i]);
+        } else {
+            retired_swapchains[num_remaining++] = retired_swapchains[i];
+        }
+    }
+    num_retired_swapchains = num_remaining;
+}
 
-    while (width == 0 || height == 0) {
-        glfwGetFramebufferSize(window, &width, &height);
-        glfwWaitEvents();
+const char* reinit_swapchain(uint64_t frame_number) {
+    // A minimized window has no extent to create a swapchain with, the old one stays until it is restored
+    if (window_extent.width == 0 || window_extent.height == 0) {
+        framebuffer_resized = true;
+        return NULL;
     }
-    //
-    
-    term_color_pipeline_swapchain_dependents();
-    term_swapchain();
-    init_swapchain();
-    init_color_pipeline_swapchain_dependents();
-    init_swapchain_framebuffers();
+    framebuffer_resized = false;
+
+    // Only happens when resized faster than frames finish
+    if (num_retired_swapchains == MAX_RETIRED_SWAPCHAINS) {
+        vkDeviceWaitIdle(device);
+        destroy_retired_swapchains(UINT64_MAX);
+    }
+
+    // Frames up to frame_number may be in flight, the fence waited on at the start of the frame NUM_FRAMES_IN_FLIGHT later covers the last of them
+    retired_swapchain_t* retired = &retired_swapchains[num_retired_swapchains++];
+    retire_swapchain(frame_number + NUM_FRAMES_IN_FLIGHT, retired);
+
+    if (init_swapchain(retired->swapchain) != result_success) {
+        return "Failed to recreate swap chain\n";
+    }
+    if (init_frame_graph() != result_success) {
+        return "Failed to compile frame graph\n";
+    }
+    if (init_swapchain_framebuffers() != result_success) {
+        return "Failed to create framebuffer\n";
+    }
+    return NULL;
 }
 
 static void framebuffer_resize(GLFWwindow*, int, int) {
-    framebuffer_resized = true;
+    window_resized = true;
 }
 
 static VkFormat get_supported_format(size_t num_formats, const VkFormat formats[], VkImageTiling tiling, VkFormatFeatureFlags feature_flags) {
@@ -356,16 +590,17 @@ static VkFormat get_supported_format(size_t num_formats, const VkFormat formats[
     return VK_FORMAT_MAX_ENUM;
 }
 
-static VkSampleCountFlagBits get_max_multisample_flags(const VkPhysicalDeviceProperties* properties) {
+// Highest sample count supported for both color and depth that does not exceed the requested one
+static VkSampleCountFlagBits get_multisample_flags(const VkPhysicalDeviceProperties* properties, uint32_t num_requested_samples) {
     VkSampleCountFlags flags = properties->limits.framebufferColorSampleCounts & properties->limits.framebufferDepthSampleCounts;
 
     // Way too overkill for this project
     // if (flags & VK_SAMPLE_COUNT_64_BIT) { return VK_SAMPLE_COUNT_64_BIT; }
     // if (flags & VK_SAMPLE_COUNT_32_BIT) { return VK_SAMPLE_COUNT_32_BIT; }
     // if (flags & VK_SAMPLE_COUNT_16_BIT) { return VK_SAMPLE_COUNT_16_BIT; }
-    if (flags & VK_SAMPLE_COUNT_8_BIT) { return VK_SAMPLE_COUNT_8_BIT; }
-    if (flags & VK_SAMPLE_COUNT_4_BIT) { return VK_SAMPLE_COUNT_4_BIT; }
-    if (flags & VK_SAMPLE_COUNT_2_BIT) { return VK_SAMPLE_COUNT_2_BIT; }
+    if (num_requested_samples >= 8 && (flags & VK_SAMPLE_COUNT_8_BIT)) { return VK_SAMPLE_COUNT_8_BIT; }
+    if (num_requested_samples >= 4 && (flags & VK_SAMPLE_COUNT_4_BIT)) { return VK_SAMPLE_COUNT_4_BIT; }
+    if (num_requested_samples >= 2 && (flags & VK_SAMPLE_COUNT_2_BIT)) { return VK_SAMPLE_COUNT_2_BIT; }
 
     return VK_SAMPLE_COUNT_1_BIT;
 }
@@ -379,33 +614,67 @@ const char* init_vulkan_core(void) {
 
     window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", NULL, NULL);
     glfwSetFramebufferSizeCallback(window, framebuffer_resize);
+    {
+        int width;
+        int height;
+        glfwGetFramebufferSize(window, &width, &height);
+        window_extent = (VkExtent2D) { (uint32_t)width, (uint32_t)height };
+    }
 
-    //
-    if (check_layers() != result_success) {
-        return "Validation layers requested, but not available\n";
+#ifdef VULKAN_DEBUG
+    // VULKAN_VALIDATION=0 turns the layers off at runtime so debug builds can still be profiled without them
+    const char* validation_env = getenv("VULKAN_VALIDATION");
+    if (validation_env == NULL || strcmp(validation_env, "0") != 0) {
+        if (check_layers() == result_success) {
+            validation_enabled = true;
+        } else {
+            printf("Validation layers requested, but not available, continuing without them\n");
+        }
     }
+    debug_utils_enabled = has_debug_utils_extension();
+#endif
+    printf("Validation layers %s\n", validation_enabled ? "enabled" : "disabled");
+
+    uint32_t num_glfw_extensions;
+    const char** glfw_extensions = glfwGetRequiredInstanceExtensions(&num_glfw_extensions);
 
-    uint32_t num_instance_extensions;
-    const char** instance_extensions = glfwGetRequiredInstanceExtensions(&num_instance_extensions);
+    uint32_t num_instance_extensions = num_glfw_extensions;
+    const char* instance_extensions[num_glfw_extensions + 1];
+    memcpy(instance_extensions, glfw_extensions, num_glfw_extensions*sizeof(const char*));
+
+    const void* instance_create_info_next = NULL;
+#ifdef VULKAN_DEBUG
+    if (debug_utils_enabled) {
+        instance_extensions[num_instance_extensions++] = VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
+        instance_create_info_next = &debug_messenger_create_info;
+    }
+#endif
 
     if (vkCreateInstance(&(VkInstanceCreateInfo) {
         .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+        .pNext = instance_create_info_next,
         .pApplicationInfo = &(VkApplicationInfo) {
             .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
             .pApplicationName = "Hello Triangle",
             .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
             .pEngineName = "No Engine",
             .engineVersion = VK_MAKE_VERSION(1, 0, 0),
-            .apiVersion = VK_API_VERSION_1_0
+            .apiVersion = VK_API_VERSION_1_2
         },
         .enabledExtensionCount = num_instance_extensions,
         .ppEnabledExtensionNames = instance_extensions,
-        .enabledLayerCount = NUM_ELEMS(layers),
+        .enabledLayerCount = validation_enabled ? NUM_ELEMS(layers) : 0,
         .ppEnabledLayerNames = layers
     }, NULL, &instance) != VK_SUCCESS) {
         return "Failed to create instance\n";
     }
 
+#ifdef VULKAN_DEBUG
+    if (init_vulkan_debug_messenger() != result_success) {
+        return "Failed to create debug messenger\n";
+    }
+#endif
+
     if (glfwCreateWindowSurface(instance, window, NULL, &surface) != VK_SUCCESS) {
         return "Failed to create window surface\n";
     }
@@ -432,12 +701,67 @@ const char* init_vulkan_core(void) {
     vkGetPhysicalDeviceProperties(physical_device, &physical_device_properties);
     printf("Loaded physical device \"%s\"\n", physical_device_properties.deviceName);
 
-    render_multisample_flags = get_max_multisample_flags(&physical_device_properties);
+    // VULKAN_MSAA_SAMPLES=1 renders without multisampling or a resolve, the default is the highest supported count up to 8
+    const char* msaa_samples_env = getenv("VULKAN_MSAA_SAMPLES");
+    uint32_t num_requested_samples = msaa_samples_env == NULL ? 8 : (uint32_t)strtoul(msaa_samples_env, NULL, 10);
+    render_multisample_flags = get_multisample_flags(&physical_device_properties, num_requested_samples);
+    printf("Rendering with %ux MSAA\n", (uint32_t)render_multisample_flags);
+
+    // VULKAN_DYNAMIC_RENDERING=0 keeps the render pass path on devices that support dynamic rendering
+    const char* dynamic_rendering_env = getenv("VULKAN_DYNAMIC_RENDERING");
+    if (dynamic_rendering_env == NULL || strcmp(dynamic_rendering_env, "0") != 0) {
+        dynamic_rendering_enabled = has_dynamic_rendering_support(physical_device);
+    }
+    printf("Dynamic rendering %s\n", dynamic_rendering_enabled ? "enabled" : "disabled");
+
+    present_wait_enabled = has_present_wait_support(physical_device);
+    printf("Present wait %s\n", present_wait_enabled ? "enabled" : "disabled");
+
+    uint32_t num_device_extensions = NUM_ELEMS(extensions);
+    const char* device_extensions[NUM_ELEMS(extensions) + 3];
+    memcpy(device_extensions, extensions, sizeof(extensions));
+    if (dynamic_rendering_enabled) {
+        device_extensions[num_device_extensions++] = VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME;
+    }
+    if (present_wait_enabled) {
+        device_extensions[num_device_extensions++] = VK_KHR_PRESENT_ID_EXTENSION_NAME;
+        device_extensions[num_device_extensions++] = VK_KHR_PRESENT_WAIT_EXTENSION_NAME;
+    }
+
+    // Optional features are chained behind the core ones
+    VkPhysicalDevicePresentWaitFeaturesKHR present_wait_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+        .presentWait = VK_TRUE
+    };
+    VkPhysicalDevicePresentIdFeaturesKHR present_id_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+        .pNext = &present_wait_features,
+        .presentId = VK_TRUE
+    };
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
+        .pNext = present_wait_enabled ? &present_id_features : NULL,
+        .dynamicRendering = VK_TRUE
+    };
+    void* optional_features = dynamic_rendering_enabled ? (void*)&dynamic_rendering_features : present_wait_enabled ? (void*)&present_id_features : NULL;
 
     float queue_priority = 1.0f;
-    VkDeviceQueueCreateInfo queue_create_infos[2];
-    for (size_t i = 0; i < 2; i++) {
-        queue_create_infos[i] = (VkDeviceQueueCreateInfo) {
+    uint32_t num_queue_create_infos = 0;
+    VkDeviceQueueCreateInfo queue_create_infos[NUM_ELEMS(queue_family_indices.data)];
+    for (size_t i = 0; i < NUM_ELEMS(queue_family_indices.data); i++) {
+        bool is_unique = true;
+        for (size_t j = 0; j < num_queue_create_infos; j++) {
+            if (queue_create_infos[j].queueFamilyIndex == queue_family_indices.data[i]) {
+                is_unique = false;
+                break;
+            }
+        }
+
+        if (!is_unique) {
+            continue;
+        }
+
+        queue_create_infos[num_queue_create_infos++] = (VkDeviceQueueCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
             .queueFamilyIndex = queue_family_indices.data[i],
             .queueCount = 1,
@@ -447,27 +771,53 @@ const char* init_vulkan_core(void) {
 
     if (vkCreateDevice(physical_device, &(VkDeviceCreateInfo) {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        .queueCreateInfoCount = 1,
+        .queueCreateInfoCount = num_queue_create_infos,
         .pQueueCreateInfos = queue_create_infos,
-        .pEnabledFeatures = &(VkPhysicalDeviceFeatures) {
-            .samplerAnisotropy = VK_TRUE
+        .pNext = &(VkPhysicalDeviceFeatures2) {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &(VkPhysicalDeviceVulkan12Features) {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+                .pNext = optional_features,
+                .descriptorIndexing = VK_TRUE,
+                .runtimeDescriptorArray = VK_TRUE,
+                .descriptorBindingPartiallyBound = VK_TRUE,
+                .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+                .descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE,
+                .shaderSampledImageArrayNonUniformIndexing = VK_TRUE
+            },
+            .features = {
+                .samplerAnisotropy = VK_TRUE,
+                .shaderStorageBufferArrayDynamicIndexing = VK_TRUE
+            }
         },
 
-        .enabledExtensionCount = NUM_ELEMS(extensions),
-        .ppEnabledExtensionNames = extensions,
-        .enabledLayerCount = NUM_ELEMS(layers),
+        .enabledExtensionCount = num_device_extensions,
+        .ppEnabledExtensionNames = device_extensions,
+        .enabledLayerCount = validation_enabled ? NUM_ELEMS(layers) : 0,
         .ppEnabledLayerNames = layers
     }, NULL, &device) != VK_SUCCESS) {
         return "Failed to create logical device\n";
     }
 
+#ifdef VULKAN_DEBUG
+    init_vulkan_debug_device_functions();
+#endif
+
+    if (dynamic_rendering_enabled && init_dynamic_rendering_functions() != result_success) {
+        return "Failed to load dynamic rendering functions\n";
+    }
+
+    if (present_wait_enabled && init_present_wait_functions() != result_success) {
+        return "Failed to load present wait functions\n";
+    }
+
     if (vmaCreateAllocator(&(VmaAllocatorCreateInfo) {
         .instance = instance,
         .physicalDevice = physical_device,
         .device = device,
         .pAllocationCallbacks = NULL,
         .pDeviceMemoryCallbacks = NULL,
-        .vulkanApiVersion = VK_API_VERSION_1_0,
+        .vulkanApiVersion = VK_API_VERSION_1_2,
         .flags = 0 // Don't think any are needed
     }, &allocator) != VK_SUCCESS) {
         return "Failed to create memory allocator\n";
@@ -488,6 +838,7 @@ const char* init_vulkan_core(void) {
 
     vkGetDeviceQueue(device, queue_family_indices.graphics, 0, &graphics_queue);
     vkGetDeviceQueue(device, queue_family_indices.presentation, 0, &presentation_queue);
+    vkGetDeviceQueue(device, queue_family_indices.transfer, 0, &transfer_queue);
 
     {
         VkSurfaceFormatKHR surface_formats[num_surface_formats];
@@ -500,10 +851,26 @@ const char* init_vulkan_core(void) {
         VkPresentModeKHR present_modes[num_present_modes];
         vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &num_present_modes, present_modes);
 
-        present_mode = get_present_mode(num_present_modes, present_modes);
+        supported_present_mode_bits = 1u << VK_PRESENT_MODE_FIFO_KHR;
+        for (size_t i = 0; i < num_present_modes; i++) {
+            if (present_modes[i] < 32) {
+                supported_present_mode_bits |= 1u << present_modes[i];
+            }
+        }
+
+        // VULKAN_PRESENT_MODE selects a policy by name, mailbox otherwise
+        const char* present_mode_env = getenv("VULKAN_PRESENT_MODE");
+        present_policy_t policy = present_policy_mailbox;
+        for (size_t i = 0; present_mode_env != NULL && i < NUM_PRESENT_POLICIES; i++) {
+            if (strcmp(present_mode_env, present_policy_infos[i].name) == 0) {
+                policy = (present_policy_t)i;
+            }
+        }
+        set_present_policy(policy);
+        framebuffer_resized = false;
     }
 
-    if (init_swapchain() != result_success) {
+    if (init_swapchain(VK_NULL_HANDLE) != result_success) {
         return "Failed to create swap chain\n";
     }
 
@@ -514,25 +881,51 @@ const char* init_vulkan_core(void) {
     }, NULL, &command_pool) != VK_SUCCESS) {
         return "Failed to create command pool\n";
     }
+
+    const char* msg = init_vulkan_uploads();
+    if (msg != NULL) { return msg; }
+
+    msg = init_vulkan_render(&physical_device_properties);
+    if (msg != NULL) { return msg; }
     
     depth_image_format = get_supported_format(3, (VkFormat[3]) { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
     if (depth_image_format == VK_FORMAT_MAX_ENUM) {
         return "Failed to get a supported depth image format\n";
     }
+    depth_image_aspect_flags = (depth_image_format == VK_FORMAT_D32_SFLOAT_S8_UINT || depth_image_format == VK_FORMAT_D24_UNORM_S8_UINT) ? VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT : VK_IMAGE_ASPECT_DEPTH_BIT;
+
+    // Reversing the depth range only gains precision when the float exponent spreads it out, a unorm format keeps the regular projection
+    // VULKAN_REVERSE_Z=0 keeps the regular projection to compare
+    const char* reverse_depth_env = getenv("VULKAN_REVERSE_Z");
+    bool float_depth_format = depth_image_format == VK_FORMAT_D32_SFLOAT || depth_image_format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+    reverse_depth_enabled = float_depth_format && (reverse_depth_env == NULL || strcmp(reverse_depth_env, "0") != 0);
+    printf("Reverse depth %s\n", reverse_depth_enabled ? "enabled" : "disabled");
     
-    const char* msg = init_vulkan_assets(&physical_device_properties);
+    msg = init_vulkan_bindless();
     if (msg != NULL) { return msg; }
 
-    msg = init_vulkan_graphics_pipelines();
+    msg = init_vulkan_frame_uniforms(&physical_device_properties);
     if (msg != NULL) { return msg; }
 
-    msg = draw_shadow_pipeline();
+    msg = init_vulkan_assets(&physical_device_properties);
     if (msg != NULL) { return msg; }
 
-    vkGetSwapchainImagesKHR(device, swapchain, &num_swapchain_images, NULL);
-    swapchain_images = memalign(64, num_swapchain_images*sizeof(VkImage));
-    swapchain_image_views = memalign(64, num_swapchain_images*sizeof(VkImageView));
-    swapchain_framebuffers = memalign(64, num_swapchain_images*sizeof(VkFramebuffer));
+    msg = init_vulkan_pipeline_cache(&physical_device_properties);
+    if (msg != NULL) { return msg; }
+
+    // Development override for the SPIR-V embedded at build time
+    shader_override_dir = getenv("SHADER_OVERRIDE_DIR");
+#ifdef SHADER_HOT_RELOAD
+    msg = init_vulkan_shader_reload();
+    if (msg != NULL) { return msg; }
+#endif
+
+    msg = init_vulkan_graphics_pipelines();
+    if (msg != NULL) { return msg; }
+
+    if (init_frame_graph() != result_success) {
+        return "Failed to compile frame graph\n";
+    }
 
     if (init_swapchain_framebuffers() != result_success) {
         return "Failed to create framebuffer\n";
@@ -546,9 +939,17 @@ void term_vulkan_all(void) {
 
     vkDestroyCommandPool(device, command_pool, NULL);
 
+#ifdef SHADER_HOT_RELOAD
+    term_vulkan_shader_reload();
+#endif
+    // The device is idle, so the replaced swapchains go along with the current one
+    destroy_retired_swapchains(UINT64_MAX);
+    retired_swapchain_t retired;
+    retire_swapchain(0, &retired);
+    destroy_retired_swapchain(&retired);
     term_vulkan_graphics_pipelines();
-    
-    term_swapchain();
+    term_vulkan_pipeline_cache();
+    term_vulkan_render();
 
     for (size_t i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
         vkDestroySemaphore(device, image_available_semaphores[i], NULL);
@@ -556,18 +957,20 @@ void term_vulkan_all(void) {
         vkDestroyFence(device, in_flight_fences[i], NULL);
     }
 
+    term_vulkan_uploads();
     term_vulkan_assets();
+    term_vulkan_bindless();
+    term_vulkan_frame_uniforms();
 
     vmaDestroyAllocator(allocator);
 
     vkDestroyDevice(device, NULL);
+#ifdef VULKAN_DEBUG
+    term_vulkan_debug_messenger();
+#endif
     vkDestroySurfaceKHR(instance, surface, NULL);
     vkDestroyInstance(instance, NULL);
 
-    free(swapchain_images);
-    free(swapchain_image_views);
-    free(swapchain_framebuffers);
-
     glfwDestroyWindow(window);
     glfwTerminate();
 }
@@ -7,10 +7,11 @@
 #define NUM_FRAMES_IN_FLIGHT 2
 
 typedef union {
-    uint32_t data[2];
+    uint32_t data[3];
     struct {
         uint32_t graphics;
         uint32_t presentation;
+        uint32_t transfer;
     };
 } queue_family_indices_t;
 
@@ -28,20 +29,66 @@ extern VkCommandPool command_pool;
 extern uint32_t num_swapchain_images;
 extern VkImage* swapchain_images;
 extern VkImageView* swapchain_image_views;
+// Used by the upscale pass, the only one drawing to the swapchain images
 extern VkFramebuffer* swapchain_framebuffers;
+// Scene attachments at the full swapchain extent, the color pass only renders to the render_extent part
+extern VkFramebuffer color_framebuffer;
+// Only the depth image, it does not change with the swapchain image
+extern VkFramebuffer depth_prepass_framebuffer;
 extern VkSwapchainKHR swapchain;
 extern VkInstance instance;
 extern VkSurfaceKHR surface;
 extern VkExtent2D swap_image_extent;
 extern VkQueue graphics_queue;
 extern VkQueue presentation_queue;
+extern VkQueue transfer_queue;
+// Set when the swapchain no longer matches the window, including while it is minimized
 extern bool framebuffer_resized;
+// Framebuffer size of the window the swapchain is created for, set by the render thread from the frame snapshot
+extern VkExtent2D window_extent;
+// Set by the framebuffer size callback on the main thread, handed to the render thread by the frame snapshot
+extern bool window_resized;
 
 extern VkSampleCountFlagBits render_multisample_flags;
 
 extern VkFormat depth_image_format;
+// Stencil formats have to be transitioned with both aspects
+extern VkImageAspectFlags depth_image_aspect_flags;
+// The camera projection maps the near plane to depth 1 and infinity to 0, only used with a floating point depth format
+extern bool reverse_depth_enabled;
 
-void reinit_swapchain(void);
+typedef enum {
+    present_policy_fifo,
+    present_policy_fifo_relaxed,
+    present_policy_mailbox,
+    present_policy_immediate,
+    // FIFO with input sampling and recording held back until the previous frame is shown, see pace_vulkan_frame
+    present_policy_low_latency,
+    NUM_PRESENT_POLICIES
+} present_policy_t;
+
+typedef struct {
+    const char* name;
+    VkPresentModeKHR present_mode;
+} present_policy_info_t;
+
+extern const present_policy_info_t present_policy_infos[NUM_PRESENT_POLICIES];
+extern present_policy_t present_policy;
+// Presents carry ids through VK_KHR_present_id and can be waited on with VK_KHR_present_wait
+extern bool present_wait_enabled;
+
+extern bool validation_enabled;
+// Passes begin with vkCmdBeginRenderingKHR instead of render pass and framebuffer objects
+extern bool dynamic_rendering_enabled;
+
+// Takes effect with the next swapchain, which is recreated before the next frame, unsupported present modes fall back to FIFO
+void set_present_policy(present_policy_t policy);
+
+// Replaces the swapchain without waiting for the device, resources of the old one live on until frame_number has finished
+// Keeps the old swapchain and framebuffer_resized set while the window is minimized
+const char* reinit_swapchain(uint64_t frame_number);
+// Destroys the resources of replaced swapchains once the fence of frame_number has been waited on
+void destroy_retired_swapchains(uint64_t frame_number);
 
 const char* init_vulkan_core(void);
 void term_vulkan_all(void);
\ No newline at end of file
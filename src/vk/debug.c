@@ -0,0 +1,85 @@
+#include "debug.h"
+
+#ifdef VULKAN_DEBUG
+#include "core.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdalign.h>
+
+static VkBool32 VKAPI_PTR debug_messenger_callback(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT, const VkDebugUtilsMessengerCallbackDataEXT* data, void*) {
+    const char* severity_name = severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT ? "error" : severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT ? "warning" : "info";
+    fprintf(stderr, "Vulkan %s: %s\n", severity_name, data->pMessage);
+    return VK_FALSE;
+}
+
+alignas(64)
+bool debug_utils_enabled = false;
+static VkDebugUtilsMessengerEXT debug_messenger;
+static PFN_vkSetDebugUtilsObjectNameEXT set_debug_utils_object_name;
+
+// Also chained into the instance create info so instance creation and destruction get reported
+const VkDebugUtilsMessengerCreateInfoEXT debug_messenger_create_info = {
+    .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT,
+    .messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT,
+    .messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT,
+    .pfnUserCallback = debug_messenger_callback
+};
+
+bool has_debug_utils_extension(void) {
+    uint32_t num_available_extensions;
+    vkEnumerateInstanceExtensionProperties(NULL, &num_available_extensions, NULL);
+
+    VkExtensionProperties available_extensions[num_available_extensions];
+    vkEnumerateInstanceExtensionProperties(NULL, &num_available_extensions, available_extensions);
+
+    for (size_t i = 0; i < num_available_extensions; i++) {
+        if (strcmp(available_extensions[i].extensionName, VK_EXT_DEBUG_UTILS_EXTENSION_NAME) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+result_t init_vulkan_debug_messenger(void) {
+    if (!debug_utils_enabled) {
+        return result_success;
+    }
+
+    PFN_vkCreateDebugUtilsMessengerEXT create_debug_utils_messenger = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
+    if (create_debug_utils_messenger == NULL || create_debug_utils_messenger(instance, &debug_messenger_create_info, NULL, &debug_messenger) != VK_SUCCESS) {
+        return result_failure;
+    }
+
+    return result_success;
+}
+
+void init_vulkan_debug_device_functions(void) {
+    if (debug_utils_enabled) {
+        set_debug_utils_object_name = (PFN_vkSetDebugUtilsObjectNameEXT)vkGetDeviceProcAddr(device, "vkSetDebugUtilsObjectNameEXT");
+    }
+}
+
+void term_vulkan_debug_messenger(void) {
+    if (!debug_utils_enabled) {
+        return;
+    }
+
+    PFN_vkDestroyDebugUtilsMessengerEXT destroy_debug_utils_messenger = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
+    if (destroy_debug_utils_messenger != NULL) {
+        destroy_debug_utils_messenger(instance, debug_messenger, NULL);
+    }
+}
+
+void set_debug_object_name(VkObjectType type, uint64_t handle, const char* name) {
+    if (set_debug_utils_object_name == NULL) {
+        return;
+    }
+
+    set_debug_utils_object_name(device, &(VkDebugUtilsObjectNameInfoEXT) {
+        .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT,
+        .objectType = type,
+        .objectHandle = handle,
+        .pObjectName = name
+    });
+}
+#endif
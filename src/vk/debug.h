@@ -0,0 +1,20 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "result.h"
+
+#ifdef VULKAN_DEBUG
+extern bool debug_utils_enabled;
+extern const VkDebugUtilsMessengerCreateInfoEXT debug_messenger_create_info;
+
+bool has_debug_utils_extension(void);
+result_t init_vulkan_debug_messenger(void);
+void init_vulkan_debug_device_functions(void);
+void term_vulkan_debug_messenger(void);
+
+void set_debug_object_name(VkObjectType type, uint64_t handle, const char* name);
+#define SET_DEBUG_OBJECT_NAME(TYPE, HANDLE, NAME) set_debug_object_name((TYPE), (uint64_t)(HANDLE), (NAME))
+#else
+#define SET_DEBUG_OBJECT_NAME(TYPE, HANDLE, NAME) ((void)0)
+#endif
@@ -25,6 +25,15 @@ const VkPipelineDepthStencilStateCreateInfo default_depth_stencil_create_info =
     .stencilTestEnable = VK_FALSE
 };
 
+const VkPipelineDepthStencilStateCreateInfo reverse_depth_stencil_create_info = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+    .depthTestEnable = VK_TRUE,
+    .depthWriteEnable = VK_TRUE,
+    .depthCompareOp = VK_COMPARE_OP_GREATER,
+    .depthBoundsTestEnable = VK_FALSE,
+    .stencilTestEnable = VK_FALSE
+};
+
 const VkPipelineColorBlendStateCreateInfo default_color_blend_create_info = {
     .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
     .logicOpEnable = VK_FALSE,
@@ -56,6 +65,16 @@ const VkBufferCreateInfo uniform_buffer_create_info = {
     .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
 };
 
+const VkBufferCreateInfo storage_buffer_create_info = {
+    DEFAULT_VK_BUFFER,
+    .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+};
+
+const VkBufferCreateInfo instance_buffer_create_info = {
+    DEFAULT_VK_BUFFER,
+    .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+};
+
 const VmaAllocationCreateInfo staging_allocation_create_info = {
     DEFAULT_VMA_ALLOCATION,
     .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
@@ -5,12 +5,16 @@
 extern const VkPipelineInputAssemblyStateCreateInfo default_input_assembly_create_info;
 extern const VkPipelineViewportStateCreateInfo default_viewport_create_info;
 extern const VkPipelineDepthStencilStateCreateInfo default_depth_stencil_create_info;
+// Nearer fragments have greater depth, used by the scene pipelines when reverse_depth_enabled
+extern const VkPipelineDepthStencilStateCreateInfo reverse_depth_stencil_create_info;
 extern const VkPipelineColorBlendStateCreateInfo default_color_blend_create_info;
 extern const VkPipelineDynamicStateCreateInfo default_dynamic_create_info;
 
 extern const VkBufferCreateInfo vertex_buffer_create_info;
 extern const VkBufferCreateInfo index_buffer_create_info;
 extern const VkBufferCreateInfo uniform_buffer_create_info;
+extern const VkBufferCreateInfo storage_buffer_create_info;
+extern const VkBufferCreateInfo instance_buffer_create_info;
 extern const VmaAllocationCreateInfo staging_allocation_create_info;
 extern const VmaAllocationCreateInfo device_allocation_create_info;
 
@@ -29,6 +33,15 @@ extern const VmaAllocationCreateInfo device_allocation_create_info;
     .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,\
     .subpassCount = 1
 
+#define DEFAULT_VK_RENDERING\
+    .sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR,\
+    .renderArea.offset = { 0, 0 },\
+    .layerCount = 1
+
+#define DEFAULT_VK_RENDERING_ATTACHMENT\
+    .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,\
+    .resolveMode = VK_RESOLVE_MODE_NONE
+
 #define DEFAULT_VK_DESCRIPTOR_BINDING\
     .descriptorCount = 1
 
@@ -0,0 +1,83 @@
+#include "frame_uniforms.h"
+#include "core.h"
+#include "defaults.h"
+#include "debug.h"
+#include "asset.h"
+#include "bindless.h"
+#include "render_scale.h"
+#include "light_cluster_pipeline.h"
+#include <string.h>
+#include <stdalign.h>
+
+alignas(64)
+frame_uniforms_t frame_uniforms;
+
+VkBuffer frame_uniform_buffer;
+static VmaAllocation frame_uniform_allocation;
+static void* frame_uniform_data;
+static VkDeviceSize frame_uniform_stride;
+
+VkBuffer instance_order_buffer;
+static VmaAllocation instance_order_allocation;
+static uint32_t* instance_order_data;
+
+const char* init_vulkan_frame_uniforms(const VkPhysicalDeviceProperties* physical_device_properties) {
+    VkDeviceSize alignment = physical_device_properties->limits.minUniformBufferOffsetAlignment;
+    frame_uniform_stride = (sizeof(frame_uniforms_t) + alignment - 1) & ~(alignment - 1);
+
+    // Host coherent so the per frame copy needs no flush
+    VmaAllocationCreateInfo allocation_create_info = staging_allocation_create_info;
+    allocation_create_info.flags |= VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VmaAllocationInfo allocation_info;
+    if (vmaCreateBuffer(allocator, &(VkBufferCreateInfo) {
+        DEFAULT_VK_BUFFER,
+        .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        .size = NUM_FRAMES_IN_FLIGHT*frame_uniform_stride
+    }, &allocation_create_info, &frame_uniform_buffer, &frame_uniform_allocation, &allocation_info) != VK_SUCCESS) {
+        return "Failed to create frame uniform buffer\n";
+    }
+    frame_uniform_data = allocation_info.pMappedData;
+    SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_BUFFER, frame_uniform_buffer, "Frame uniforms");
+
+    // Read from the bindless table, so each frame's order is reached through its offset rather than its own descriptor
+    if (vmaCreateBuffer(allocator, &(VkBufferCreateInfo) {
+        DEFAULT_VK_BUFFER,
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        .size = NUM_FRAMES_IN_FLIGHT*NUM_INSTANCES*sizeof(uint32_t)
+    }, &allocation_create_info, &instance_order_buffer, &instance_order_allocation, &allocation_info) != VK_SUCCESS) {
+        return "Failed to create instance order buffer\n";
+    }
+    instance_order_data = allocation_info.pMappedData;
+    SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_BUFFER, instance_order_buffer, "Instance order");
+
+    if (add_bindless_storage_buffer(instance_order_buffer, NUM_FRAMES_IN_FLIGHT*NUM_INSTANCES*sizeof(uint32_t), &frame_uniforms.instance_order_buffer_index) != result_success) {
+        return "Failed to add instance order buffer to bindless table\n";
+    }
+
+    return NULL;
+}
+
+uint32_t get_frame_uniform_offset(uint32_t frame_index) {
+    return (uint32_t)(frame_index*frame_uniform_stride);
+}
+
+void write_frame_uniforms(uint32_t frame_index, const frame_snapshot_t* snapshot) {
+    frame_uniforms.view_projection = snapshot->view_projection;
+    frame_uniforms.camera_position = snapshot->camera_position;
+    frame_uniforms.view = snapshot->view;
+
+    // Both projections are symmetric, so the field of view is all the clusters need of them
+    frame_uniforms.light_cluster_tan_half_fov = (vec2s) {{ 1.0f/snapshot->projection.m00, 1.0f/snapshot->projection.m11 }};
+    frame_uniforms.light_cluster_tile_scale = (vec2s) {{ (float)LIGHT_CLUSTER_TILES_X/(float)render_extent.width, (float)LIGHT_CLUSTER_TILES_Y/(float)render_extent.height }};
+    frame_uniforms.light_cluster_offset = frame_index*NUM_LIGHT_CLUSTERS;
+    frame_uniforms.instance_order_offset = frame_index*NUM_INSTANCES;
+    memcpy(&instance_order_data[frame_uniforms.instance_order_offset], snapshot->instance_order, sizeof(snapshot->instance_order));
+
+    memcpy((uint8_t*)frame_uniform_data + get_frame_uniform_offset(frame_index), &frame_uniforms, sizeof(frame_uniforms));
+}
+
+void term_vulkan_frame_uniforms(void) {
+    vmaDestroyBuffer(allocator, instance_order_buffer, instance_order_allocation);
+    vmaDestroyBuffer(allocator, frame_uniform_buffer, frame_uniform_allocation);
+}
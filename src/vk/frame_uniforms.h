@@ -0,0 +1,56 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <cglm/struct/mat4.h>
+#include <cglm/struct/vec4.h>
+#include "frame_pipeline.h"
+
+// Mirrors frame_uniforms_t in the color pipeline shaders, std140
+typedef struct {
+    mat4s view_projection;
+    mat4s shadow_view_projection;
+    vec4s camera_position;
+    uint32_t instance_buffer_index;
+    uint32_t material_buffer_index;
+    // Bindless index of the instance order buffer and the start of this frame's slot in it, written by write_frame_uniforms
+    uint32_t instance_order_buffer_index;
+    uint32_t instance_order_offset;
+
+    // Light clusters, see light_cluster_pipeline.h
+    mat4s view;
+    // Maps the fragment coordinate in the render extent to its tile
+    vec2s light_cluster_tile_scale;
+    // Maps the log of the view depth to its slice
+    float light_cluster_depth_scale;
+    float light_cluster_depth_bias;
+    // Tangents of half the horizontal and vertical field of view
+    vec2s light_cluster_tan_half_fov;
+    float light_cluster_near;
+    float light_cluster_far;
+    uint32_t light_buffer_index;
+    uint32_t num_lights;
+    // Bindless index of the cluster buffer and the first cluster of this frame's slot in it, written by write_frame_uniforms
+    uint32_t light_cluster_buffer_index;
+    uint32_t light_cluster_offset;
+} frame_uniforms_t;
+static_assert(offsetof(frame_uniforms_t, instance_buffer_index) == 144, "Frame uniforms must match the std140 layout of the shaders");
+static_assert(offsetof(frame_uniforms_t, light_buffer_index) == 256, "Frame uniforms must match the std140 layout of the shaders");
+
+// The camera, instance order and render extent come from the frame, the rest is set once the assets and pipelines are initialized
+extern frame_uniforms_t frame_uniforms;
+
+// Persistently mapped, one slot per frame in flight, bound as a dynamic uniform buffer
+extern VkBuffer frame_uniform_buffer;
+
+// Persistently mapped as well, one front to back order of the instances per frame in flight, draws index instances through it
+// The order is sorted by the simulation into the snapshot, the render thread only copies it
+extern VkBuffer instance_order_buffer;
+
+const char* init_vulkan_frame_uniforms(const VkPhysicalDeviceProperties* physical_device_properties);
+// Dynamic offset of the slot, known before the slot is written so recording does not have to wait for it
+uint32_t get_frame_uniform_offset(uint32_t frame_index);
+// The fence of the frame has to have been waited on and the assets initialized
+void write_frame_uniforms(uint32_t frame_index, const frame_snapshot_t* snapshot);
+void term_vulkan_frame_uniforms(void);
@@ -2,6 +2,10 @@
 #include "core.h"
 #include "util.h"
 #include "defaults.h"
+#include "mipmap.h"
+#include "upload.h"
+#include "shader.h"
+#include "job.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,18 +14,29 @@
 #include <malloc.h>
 #include <math.h>
 
-result_t create_shader_module(const char* path, VkShaderModule* shader_module) {
-    if (access(path, F_OK) != 0) {
+static result_t create_shader_module_from_code(size_t num_bytes, const uint32_t* code, VkShaderModule* shader_module) {
+    if (vkCreateShaderModule(device, &(VkShaderModuleCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = num_bytes,
+        .pCode = code
+    }, NULL, shader_module) != VK_SUCCESS) {
         return result_failure;
     }
 
+    return result_success;
+}
+
+static result_t create_shader_module_from_file(const char* path, VkShaderModule* shader_module) {
     FILE* file = fopen(path, "rb");
     if (file == NULL) {
         return result_failure;
     }
 
     struct stat st;
-    stat(path, &st);
+    if (stat(path, &st) != 0 || st.st_size <= 0) {
+        fclose(file);
+        return result_failure;
+    }
 
     size_t num_bytes = (size_t)st.st_size;
     size_t aligned_num_bytes = num_bytes % 32ul == 0 ? num_bytes : num_bytes + (32ul - (num_bytes % 32ul));
@@ -29,45 +44,34 @@ result_t create_shader_module(const char* path, VkShaderModule* shader_module) {
     uint32_t* bytes = memalign(64, aligned_num_bytes);
     memset(bytes, 0, aligned_num_bytes);
     if (fread(bytes, num_bytes, 1, file) != 1) {
+        fclose(file);
+        free(bytes);
         return result_failure;
     }
 
     fclose(file);
 
-    if (vkCreateShaderModule(device, &(VkShaderModuleCreateInfo) {
-        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .codeSize = num_bytes,
-        .pCode = bytes
-    }, NULL, shader_module) != VK_SUCCESS) {
-        return result_failure;
-    }
-
+    result_t result = create_shader_module_from_code(num_bytes, bytes, shader_module);
     free(bytes);
-    return result_success;
+    return result;
 }
 
-result_t write_to_buffer(VmaAllocation buffer_allocation, size_t num_bytes, const void* data) {
-    void* mapped_data;
-    if (vmaMapMemory(allocator, buffer_allocation, &mapped_data) != VK_SUCCESS) {
-        return result_failure;
-    }
-    memcpy(mapped_data, data, num_bytes);
-    vmaUnmapMemory(allocator, buffer_allocation);
+result_t create_shader_module(const char* name, VkShaderModule* shader_module) {
+    if (shader_override_dir != NULL && shader_override_dir[0] != '\0') {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s.spv", shader_override_dir, name);
 
-    return result_success;
-}
+        if (access(path, F_OK) == 0) {
+            return create_shader_module_from_file(path, shader_module);
+        }
+    }
 
-result_t writes_to_buffer(VmaAllocation buffer_allocation, size_t num_write_bytes, size_t num_writes, const void* const data_array[]) {
-    void* mapped_data;
-    if (vmaMapMemory(allocator, buffer_allocation, &mapped_data) != VK_SUCCESS) {
+    const shader_code_t* shader_code = get_embedded_shader_code(name);
+    if (shader_code == NULL) {
         return result_failure;
     }
-    for (size_t i = 0; i < num_writes; i++) {
-        memcpy(mapped_data + (i*num_write_bytes), data_array[i], num_write_bytes);
-    }
-    vmaUnmapMemory(allocator, buffer_allocation);
 
-    return result_success;
+    return create_shader_module_from_code(shader_code->num_bytes, shader_code->code, shader_module);
 }
 
 result_t create_descriptor_set(const VkDescriptorSetLayoutCreateInfo* descriptor_set_layout_create_info, descriptor_info_t descriptor_infos[], VkDescriptorSetLayout* descriptor_set_layout, VkDescriptorPool* descriptor_pool, VkDescriptorSet* descriptor_set) {
@@ -134,137 +138,218 @@ result_t create_descriptor_set(const VkDescriptorSetLayoutCreateInfo* descriptor
     return result_success;
 }
 
-result_t begin_images(size_t num_images, const image_create_info_t infos[], staging_t stagings[], VkImage images[], VmaAllocation allocations[]) {
-    for (size_t i = 0; i < num_images; i++) {
-        const image_create_info_t* info = &infos[i];
-        
-        VkDeviceSize num_layer_bytes = info->info.extent.width * info->info.extent.height * info->num_pixel_bytes;
-        uint32_t num_layers = info->info.arrayLayers;
-        VkDeviceSize num_image_bytes = num_layer_bytes * num_layers;
-        
-        if (vmaCreateBuffer(allocator, &(VkBufferCreateInfo) {
-            DEFAULT_VK_STAGING_BUFFER,
-            .size = num_image_bytes
-        }, &staging_allocation_create_info, &stagings[i].buffer, &stagings[i].allocation, NULL) != VK_SUCCESS) {
-            return result_failure;
-        }
+// Resources filled on a separate transfer family are shared with the graphics family instead of doing ownership transfers
+static void share_with_transfer_queue(VkSharingMode* sharing_mode, uint32_t* num_queue_family_indices, const uint32_t** queue_family_indices_ptr) {
+    static uint32_t shared_queue_family_indices[2];
 
-        if (vmaCreateImage(allocator, &info->info, &device_allocation_create_info, &images[i], &allocations[i], NULL) != VK_SUCCESS) {
-            return result_failure;
-        }
-
-        const void* const* pixel_arrays = (const void* const*)info->pixel_arrays;
-        if (writes_to_buffer(stagings[i].allocation, num_layer_bytes, num_layers, pixel_arrays) != result_success) {
-            return result_failure;
-        }
+    if (queue_family_indices.transfer == queue_family_indices.graphics) {
+        return;
     }
 
-    return result_success;
+    shared_queue_family_indices[0] = queue_family_indices.graphics;
+    shared_queue_family_indices[1] = queue_family_indices.transfer;
+
+    *sharing_mode = VK_SHARING_MODE_CONCURRENT;
+    *num_queue_family_indices = 2;
+    *queue_family_indices_ptr = shared_queue_family_indices;
 }
 
-void transfer_images(VkCommandBuffer command_buffer, size_t num_images, const image_create_info_t infos[], const staging_t stagings[], const VkImage images[]) {
-    for (size_t i = 0; i < num_images; i++) {
-        const image_create_info_t* info = &infos[i];
+static bool is_srgb_format(VkFormat format) {
+    return format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_R8G8B8_SRGB || format == VK_FORMAT_B8G8R8A8_SRGB;
+}
 
-        uint32_t width = info->info.extent.width;
-        uint32_t height = info->info.extent.height;
-        uint32_t num_mip_levels = info->info.mipLevels;
-        uint32_t num_layers = info->info.arrayLayers;
+static uint32_t get_num_staged_mip_levels(const VkImageCreateInfo* info) {
+#ifdef GPU_MIP_GENERATION
+    (void)info;
+    return 1;
+#else
+    return info->mipLevels;
+#endif
+}
+
+static void transfer_image(VkCommandBuffer command_buffer, const image_create_info_t* info, const staging_region_t* region, const mip_level_t levels[], VkImage image) {
+    uint32_t num_mip_levels = info->info.mipLevels;
+    uint32_t num_layers = info->info.arrayLayers;
 
-        VkImage image = images[i];
+    {
+        VkImageMemoryBarrier barrier = {
+            DEFAULT_VK_IMAGE_MEMORY_BARRIER,
+            .image = image,
+            .subresourceRange.levelCount = num_mip_levels,
+            .subresourceRange.layerCount = num_layers,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT
+        };
 
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+    }
+    
+    {
+        uint32_t num_staged_mip_levels = get_num_staged_mip_levels(&info->info);
+
+        VkBufferImageCopy regions[num_staged_mip_levels];
+        for (uint32_t j = 0; j < num_staged_mip_levels; j++) {
+            regions[j] = (VkBufferImageCopy) {
+                DEFAULT_VK_BUFFER_IMAGE_COPY,
+                .bufferOffset = region->offset + levels[j].offset,
+                .imageSubresource.mipLevel = j,
+                .imageSubresource.layerCount = num_layers,
+                .imageExtent.width = levels[j].width,
+                .imageExtent.height = levels[j].height
+            };
+        }
+
+        vkCmdCopyBufferToImage(command_buffer, region->buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, num_staged_mip_levels, regions);
+    }
+
+#ifdef GPU_MIP_GENERATION
+    int32_t mip_width = (int32_t)info->info.extent.width;
+    int32_t mip_height = (int32_t)info->info.extent.height;
+
+    for (uint32_t i = 1; i < num_mip_levels; i++) {
         {
             VkImageMemoryBarrier barrier = {
                 DEFAULT_VK_IMAGE_MEMORY_BARRIER,
                 .image = image,
-                .subresourceRange.levelCount = num_mip_levels,
+                .subresourceRange.baseMipLevel = i - 1,
                 .subresourceRange.layerCount = num_layers,
-                .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT
+                .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT
             };
 
-            vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+            vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
         }
-        
         {
-            VkBufferImageCopy region = {
-                DEFAULT_VK_BUFFER_IMAGE_COPY,
-                .imageSubresource.layerCount = num_layers,
-                .imageExtent.width = width,
-                .imageExtent.height = height
+            VkImageBlit blit = {
+                DEFAULT_VK_IMAGE_BLIT,
+                .srcOffsets[1] = { mip_width, mip_height, 1 },
+                .srcSubresource.mipLevel = i - 1,
+                .srcSubresource.layerCount = num_layers,
+                .dstOffsets[1] = { mip_width > 1 ? mip_width / 2 : 1, mip_height > 1 ? mip_height / 2 : 1, 1 },
+                .dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .dstSubresource.mipLevel = i,
+                .dstSubresource.layerCount = num_layers
+            };
+
+            vkCmdBlitImage(command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+        }
+        {
+            VkImageMemoryBarrier barrier = {
+                DEFAULT_VK_IMAGE_MEMORY_BARRIER,
+                .image = image,
+                .subresourceRange.baseMipLevel = i - 1,
+                .subresourceRange.layerCount = num_layers,
+                .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                .srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
             };
 
-            vkCmdCopyBufferToImage(command_buffer, stagings[i].buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+            vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
         }
 
-        int32_t mip_width = (int32_t)width;
-        int32_t mip_height = (int32_t)height;
-
-        for (uint32_t i = 1; i < num_mip_levels; i++) {
-            {
-                VkImageMemoryBarrier barrier = {
-                    DEFAULT_VK_IMAGE_MEMORY_BARRIER,
-                    .image = image,
-                    .subresourceRange.baseMipLevel = i - 1,
-                    .subresourceRange.layerCount = num_layers,
-                    .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                    .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-                    .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT
-                };
-
-                vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
-            }
-            {
-                VkImageBlit blit = {
-                    DEFAULT_VK_IMAGE_BLIT,
-                    .srcOffsets[1] = { mip_width, mip_height, 1 },
-                    .srcSubresource.mipLevel = i - 1,
-                    .srcSubresource.layerCount = num_layers,
-                    .dstOffsets[1] = { mip_width > 1 ? mip_width / 2 : 1, mip_height > 1 ? mip_height / 2 : 1, 1 },
-                    .dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                    .dstSubresource.mipLevel = i,
-                    .dstSubresource.layerCount = num_layers
-                };
-
-                vkCmdBlitImage(command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
-            }
-            {
-                VkImageMemoryBarrier barrier = {
-                    DEFAULT_VK_IMAGE_MEMORY_BARRIER,
-                    .image = image,
-                    .subresourceRange.baseMipLevel = i - 1,
-                    .subresourceRange.layerCount = num_layers,
-                    .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                    .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                    .srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
-                    .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-                };
-
-                vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+        if (mip_width > 1) { mip_width /= 2; }
+        if (mip_height > 1) { mip_height /= 2; }
+    }
+
+    VkImageMemoryBarrier barrier = {
+        DEFAULT_VK_IMAGE_MEMORY_BARRIER,
+        .image = image,
+        .subresourceRange.baseMipLevel = num_mip_levels - 1,
+        .subresourceRange.layerCount = num_layers,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+    };
+
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+#else
+    // Every level was uploaded by the copy above, so the whole image can be transitioned at once
+    // The transfer queue may not support shader stages, visibility to the graphics queue comes from the upload fence being waited on before first use
+    VkImageMemoryBarrier barrier = {
+        DEFAULT_VK_IMAGE_MEMORY_BARRIER,
+        .image = image,
+        .subresourceRange.levelCount = num_mip_levels,
+        .subresourceRange.layerCount = num_layers,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = 0
+    };
+
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+#endif
+}
+
+// Level 0 of every layer is copied into the staging memory and the rest of the chain generated there, each image is a job
+typedef struct {
+    const image_create_info_t* infos;
+    const staging_region_t* regions;
+    const mip_level_t (*levels)[MAX_MIP_LEVELS];
+} image_staging_t;
+
+static void stage_images(void* context, uint32_t first, uint32_t end) {
+    const image_staging_t* staging = context;
+    for (uint32_t i = first; i < end; i++) {
+        const image_create_info_t* info = &staging->infos[i];
+        const staging_region_t* region = &staging->regions[i];
+
+        uint32_t num_pixel_bytes = (uint32_t)info->num_pixel_bytes;
+        uint32_t num_layers = info->info.arrayLayers;
+        VkDeviceSize num_layer_bytes = info->info.extent.width * info->info.extent.height * info->num_pixel_bytes;
+
+        for (size_t j = 0; j < num_layers; j++) {
+            memcpy(region->data + (j*num_layer_bytes), info->pixel_arrays[j], num_layer_bytes);
+        }
+        generate_mip_chain(region->data, get_num_staged_mip_levels(&info->info), num_layers, num_pixel_bytes, is_srgb_format(info->info.format), staging->levels[i]);
+    }
+}
+
+result_t upload_images(VkCommandBuffer command_buffer, size_t num_images, const image_create_info_t infos[], VkImage images[], VmaAllocation allocations[]) {
+    staging_region_t regions[num_images];
+    mip_level_t levels[num_images][MAX_MIP_LEVELS];
+
+    // The allocator and the staging ring are only used from this thread, the CPU heavy part is left to the jobs
+    for (size_t i = 0; i < num_images; i++) {
+        const image_create_info_t* info = &infos[i];
+        
+        uint32_t num_pixel_bytes = (uint32_t)info->num_pixel_bytes;
+        uint32_t num_layers = info->info.arrayLayers;
+        uint32_t num_mip_levels = get_num_staged_mip_levels(&info->info);
+
+        VkDeviceSize num_image_bytes = get_mip_chain_layout(info->info.extent.width, info->info.extent.height, num_mip_levels, num_layers, num_pixel_bytes, levels[i]);
+
+        {
+            VkImageCreateInfo image_info = info->info;
+            share_with_transfer_queue(&image_info.sharingMode, &image_info.queueFamilyIndexCount, &image_info.pQueueFamilyIndices);
+
+            if (vmaCreateImage(allocator, &image_info, &device_allocation_create_info, &images[i], &allocations[i], NULL) != VK_SUCCESS) {
+                return result_failure;
             }
+        }
 
-            if (mip_width > 1) { mip_width /= 2; }
-            if (mip_height > 1) { mip_height /= 2; }
+        // Buffer to image copy offsets have to be a multiple of both 4 and the texel size
+        if (allocate_upload_staging(num_image_bytes, 4ul * num_pixel_bytes, &regions[i]) != result_success) {
+            return result_failure;
         }
+    }
 
-        VkImageMemoryBarrier barrier = {
-            DEFAULT_VK_IMAGE_MEMORY_BARRIER,
-            .image = image,
-            .subresourceRange.baseMipLevel = num_mip_levels - 1,
-            .subresourceRange.layerCount = num_layers,
-            .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-        };
+    job_counter_t counter = { 0 };
+    run_jobs(stage_images, &(image_staging_t) {
+        .infos = infos,
+        .regions = regions,
+        .levels = (const mip_level_t (*)[MAX_MIP_LEVELS])levels
+    }, (uint32_t)num_images, 1, &counter);
+    wait_for_job_counter(&counter);
 
-        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+    for (size_t i = 0; i < num_images; i++) {
+        transfer_image(command_buffer, &infos[i], &regions[i], levels[i], images[i]);
     }
-}
 
-void end_images(size_t num_images, const staging_t stagings[]) {
-    end_buffers(num_images, stagings);
+    return result_success;
 }
 
 void destroy_images(size_t num_images, const VkImage images[], const VmaAllocation image_allocations[], const VkImageView image_views[]) {
@@ -275,22 +360,7 @@ void destroy_images(size_t num_images, const VkImage images[], const VmaAllocati
     }
 }
 
-void begin_pipeline(
-    VkCommandBuffer command_buffer,
-    VkFramebuffer image_framebuffer, VkExtent2D image_extent,
-    uint32_t num_clear_values, const VkClearValue clear_values[],
-    VkRenderPass render_pass, VkDescriptorSet descriptor_set, VkPipelineLayout pipeline_layout, VkPipeline pipeline
-) {
-    vkCmdBeginRenderPass(command_buffer, &(VkRenderPassBeginInfo) {
-        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-        .renderPass = render_pass,
-        .framebuffer = image_framebuffer,
-        .renderArea.offset = { 0, 0 },
-        .renderArea.extent = image_extent,
-        .clearValueCount = num_clear_values,
-        .pClearValues = clear_values
-    }, VK_SUBPASS_CONTENTS_INLINE);
-
+static void bind_pipeline(VkCommandBuffer command_buffer, VkExtent2D image_extent, VkDescriptorSet descriptor_set, VkPipelineLayout pipeline_layout, VkPipeline pipeline) {
     vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
     
     if (descriptor_set != NULL) {
@@ -314,6 +384,62 @@ void begin_pipeline(
     vkCmdSetScissor(command_buffer, 0, 1, &scissor);
 }
 
+void begin_pipeline(
+    VkCommandBuffer command_buffer,
+    VkFramebuffer image_framebuffer, VkExtent2D image_extent,
+    uint32_t num_clear_values, const VkClearValue clear_values[],
+    VkRenderPass render_pass, VkDescriptorSet descriptor_set, VkPipelineLayout pipeline_layout, VkPipeline pipeline
+) {
+    vkCmdBeginRenderPass(command_buffer, &(VkRenderPassBeginInfo) {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+        .renderPass = render_pass,
+        .framebuffer = image_framebuffer,
+        .renderArea.offset = { 0, 0 },
+        .renderArea.extent = image_extent,
+        .clearValueCount = num_clear_values,
+        .pClearValues = clear_values
+    }, VK_SUBPASS_CONTENTS_INLINE);
+
+    bind_pipeline(command_buffer, image_extent, descriptor_set, pipeline_layout, pipeline);
+}
+
+static PFN_vkCmdBeginRenderingKHR cmd_begin_rendering;
+static PFN_vkCmdEndRenderingKHR cmd_end_rendering;
+
+result_t init_dynamic_rendering_functions(void) {
+    cmd_begin_rendering = (PFN_vkCmdBeginRenderingKHR)vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR");
+    cmd_end_rendering = (PFN_vkCmdEndRenderingKHR)vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR");
+    if (cmd_begin_rendering == NULL || cmd_end_rendering == NULL) {
+        return result_failure;
+    }
+
+    return result_success;
+}
+
+void begin_rendering_pipeline(VkCommandBuffer command_buffer, const VkRenderingInfoKHR* rendering_info, VkDescriptorSet descriptor_set, VkPipelineLayout pipeline_layout, VkPipeline pipeline) {
+    cmd_begin_rendering(command_buffer, rendering_info);
+    bind_pipeline(command_buffer, rendering_info->renderArea.extent, descriptor_set, pipeline_layout, pipeline);
+}
+
+void end_rendering_pipeline(VkCommandBuffer command_buffer) {
+    cmd_end_rendering(command_buffer);
+}
+
+static PFN_vkWaitForPresentKHR wait_for_present_function;
+
+result_t init_present_wait_functions(void) {
+    wait_for_present_function = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(device, "vkWaitForPresentKHR");
+    if (wait_for_present_function == NULL) {
+        return result_failure;
+    }
+
+    return result_success;
+}
+
+VkResult wait_for_present(VkSwapchainKHR swapchain, uint64_t present_id, uint64_t timeout) {
+    return wait_for_present_function(device, swapchain, present_id, timeout);
+}
+
 void bind_vertex_buffers(VkCommandBuffer command_buffer, uint32_t num_vertex_buffers, const VkBuffer vertex_buffers[]) {
     VkDeviceSize offsets[num_vertex_buffers];
     memset(offsets, 0, num_vertex_buffers*sizeof(VkDeviceSize));
@@ -324,52 +450,31 @@ void end_pipeline(VkCommandBuffer command_buffer) {
     vkCmdEndRenderPass(command_buffer);
 }
 
-result_t begin_buffers(
+result_t upload_buffers(
     VkDeviceSize num_elements, const VkBufferCreateInfo* base_device_buffer_create_info,
-    size_t num_buffers, void* const arrays[], const uint32_t num_element_bytes_array[], staging_t stagings[], VkBuffer buffers[], VmaAllocation allocations[]
+    size_t num_buffers, void* const arrays[], const uint32_t num_element_bytes_array[], VkBuffer buffers[], VmaAllocation allocations[]
 ) {
     for (size_t i = 0; i < num_buffers; i++) {
-        void* array = arrays[i];
         VkDeviceSize num_array_bytes = num_elements*num_element_bytes_array[i];
 
-        if (vmaCreateBuffer(allocator, &(VkBufferCreateInfo) {
-            DEFAULT_VK_STAGING_BUFFER,
-            .size = num_array_bytes
-        }, &staging_allocation_create_info, &stagings[i].buffer, &stagings[i].allocation, NULL) != VK_SUCCESS) {
-            return result_failure;
-        }
-        
         {
             VkBufferCreateInfo info = *base_device_buffer_create_info;
             info.size = num_array_bytes;
+            share_with_transfer_queue(&info.sharingMode, &info.queueFamilyIndexCount, &info.pQueueFamilyIndices);
 
             if (vmaCreateBuffer(allocator, &info, &device_allocation_create_info, &buffers[i], &allocations[i], NULL) != VK_SUCCESS) {
                 return result_failure;
             }
         }
 
-        if (write_to_buffer(stagings[i].allocation, num_array_bytes, array) != result_success) {
+        staging_region_t region;
+        if (allocate_upload_staging(num_array_bytes, 16, &region) != result_success) {
             return result_failure;
         }
+
+        memcpy(region.data, arrays[i], num_array_bytes);
+        queue_upload_buffer_copy(&region, buffers[i], 0, num_array_bytes);
     }
     
     return result_success;
-}
-
-void transfer_buffers(
-    VkCommandBuffer command_buffer, VkDeviceSize num_elements,
-    size_t num_buffers, const uint32_t num_element_bytes_array[], const staging_t stagings[], const VkBuffer buffers[]
-) {
-    for (size_t i = 0; i < num_buffers; i++) {
-        VkBufferCopy region = {
-            .size = num_elements*num_element_bytes_array[i]
-        };
-        vkCmdCopyBuffer(command_buffer, stagings[i].buffer, buffers[i], 1, &region);
-    }
-}
-
-void end_buffers(size_t num_buffers, const staging_t stagings[]) {
-    for (size_t i = 0; i < num_buffers; i++) {
-        vmaDestroyBuffer(allocator, stagings[i].buffer, stagings[i].allocation);
-    }
 }
\ No newline at end of file
@@ -6,14 +6,8 @@
 #include <stdbool.h>
 
 // Graphics pipeline exclusive functions
-result_t create_shader_module(const char* path, VkShaderModule* shader_module);
-result_t write_to_buffer(VmaAllocation buffer_allocation, size_t num_bytes, const void* data);
-result_t writes_to_buffer(VmaAllocation buffer_allocation, size_t num_write_bytes, size_t num_writes, const void* const data_array[]);
-
-typedef struct {
-    VkBuffer buffer;
-    VmaAllocation allocation;
-} staging_t;
+// Name is the shader file name without its extension, e.g. "color_pipeline_vertex"
+result_t create_shader_module(const char* name, VkShaderModule* shader_module);
 
 typedef struct {
     void** pixel_arrays;
@@ -21,19 +15,13 @@ typedef struct {
     VkImageCreateInfo info;
 } image_create_info_t;
 
-result_t begin_images(size_t num_images, const image_create_info_t infos[], staging_t stagings[], VkImage images[], VmaAllocation allocations[]);
-void transfer_images(VkCommandBuffer command_buffer, size_t num_images, const image_create_info_t infos[], const staging_t stagings[], const VkImage images[]);
-void end_images(size_t num_images, const staging_t stagings[]);
+// Both have to be called between begin_upload and end_upload, the resources can be used once that upload has completed
+result_t upload_images(VkCommandBuffer command_buffer, size_t num_images, const image_create_info_t infos[], VkImage images[], VmaAllocation allocations[]);
 
-result_t begin_buffers(
+result_t upload_buffers(
     VkDeviceSize num_elements, const VkBufferCreateInfo* base_device_buffer_create_info,
-    size_t num_buffers, void* const arrays[], const uint32_t num_element_bytes_array[], staging_t stagings[], VkBuffer buffers[], VmaAllocation allocations[]
-);
-void transfer_buffers(
-    VkCommandBuffer command_buffer, VkDeviceSize num_elements,
-    size_t num_buffers, const uint32_t num_element_bytes_array[], const staging_t stagings[], const VkBuffer buffers[]
+    size_t num_buffers, void* const arrays[], const uint32_t num_element_bytes_array[], VkBuffer buffers[], VmaAllocation allocations[]
 );
-void end_buffers(size_t num_buffers, const staging_t stagings[]);
 
 typedef struct {
     enum {
@@ -60,4 +48,14 @@ void begin_pipeline(
 
 void bind_vertex_buffers(VkCommandBuffer command_buffer, uint32_t num_vertex_buffers, const VkBuffer vertex_buffers[]);
 
-void end_pipeline(VkCommandBuffer command_buffer);
\ No newline at end of file
+void end_pipeline(VkCommandBuffer command_buffer);
+
+// Used when dynamic_rendering_enabled, attachments are given per pass so there are no render pass or framebuffer objects
+// The caller transitions the attachment layouts itself, the functions are loaded by core after device creation
+result_t init_dynamic_rendering_functions(void);
+void begin_rendering_pipeline(VkCommandBuffer command_buffer, const VkRenderingInfoKHR* rendering_info, VkDescriptorSet descriptor_set, VkPipelineLayout pipeline_layout, VkPipeline pipeline);
+void end_rendering_pipeline(VkCommandBuffer command_buffer);
+
+// Used when present_wait_enabled, presents carry an increasing id that can be waited on, loaded by core after device creation
+result_t init_present_wait_functions(void);
+VkResult wait_for_present(VkSwapchainKHR swapchain, uint64_t present_id, uint64_t timeout);
\ No newline at end of file
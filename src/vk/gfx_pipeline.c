@@ -1,12 +1,50 @@
 #include "gfx_pipeline.h"
 #include "shadow_pipeline.h"
 #include "color_pipeline.h"
+#include "upscale_pipeline.h"
+#include "light_cluster_pipeline.h"
 #include "core.h"
 #include "gfx_core.h"
 #include "util.h"
 #include "asset.h"
+#include "pipeline_cache.h"
+#include "chrono.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdalign.h>
+
+typedef struct {
+    const char* name;
+    const char* (*create)(void);
+    const char* (*recreate)(void);
+    pthread_t thread;
+    bool started;
+    bool waited;
+    const char* msg;
+    microseconds_t num_create_microseconds;
+} pipeline_job_t;
+
+alignas(64)
+static pipeline_job_t pipeline_jobs[NUM_GRAPHICS_PIPELINES] = {
+    [shadow_graphics_pipeline] = { .name = "shadow", .create = create_shadow_pipeline, .recreate = recreate_shadow_pipeline },
+    [color_graphics_pipeline] = { .name = "color", .create = create_color_pipeline, .recreate = recreate_color_pipeline },
+    [upscale_graphics_pipeline] = { .name = "upscale", .create = create_upscale_pipeline, .recreate = recreate_upscale_pipeline },
+    [light_cluster_compute_pipeline] = { .name = "light cluster", .create = create_light_cluster_pipeline, .recreate = recreate_light_cluster_pipeline }
+};
+
+static void* run_pipeline_job(void* arg) {
+    pipeline_job_t* job = arg;
+
+    microseconds_t start = get_current_microseconds();
+    job->msg = job->create();
+    job->num_create_microseconds = get_current_microseconds() - start;
+
+    return NULL;
+}
 
 const char* init_vulkan_graphics_pipelines() {
+    // Render passes and layouts are cheap and needed by the swapchain framebuffers, only shader loading and pipeline compilation move off the main thread
     const char* msg = init_shadow_pipeline();
     if (msg != NULL) {
         return msg;
@@ -17,10 +55,70 @@ const char* init_vulkan_graphics_pipelines() {
         return msg;
     }
 
+    msg = init_upscale_pipeline();
+    if (msg != NULL) {
+        return msg;
+    }
+
+    msg = init_light_cluster_pipeline();
+    if (msg != NULL) {
+        return msg;
+    }
+
+    for (size_t i = 0; i < NUM_GRAPHICS_PIPELINES; i++) {
+        pipeline_job_t* job = &pipeline_jobs[i];
+        if (pthread_create(&job->thread, NULL, run_pipeline_job, job) != 0) {
+            return "Failed to start pipeline job\n";
+        }
+        job->started = true;
+    }
+
     return NULL;
 }
 
+const char* wait_for_graphics_pipeline(graphics_pipeline_t pipeline) {
+    pipeline_job_t* job = &pipeline_jobs[pipeline];
+    if (job->waited) {
+        return job->msg;
+    }
+
+    microseconds_t start = get_current_microseconds();
+    pthread_join(job->thread, NULL);
+    job->waited = true;
+
+    if (job->msg == NULL) {
+        printf("Created %s pipeline in %ldus (%s pipeline cache), waited %ldus for it\n", job->name, job->num_create_microseconds, pipeline_cache_warm ? "warm" : "cold", get_current_microseconds() - start);
+    }
+
+    return job->msg;
+}
+
+void reload_graphics_pipeline(graphics_pipeline_t pipeline) {
+    pipeline_job_t* job = &pipeline_jobs[pipeline];
+    if (wait_for_graphics_pipeline(pipeline) != NULL) {
+        return;
+    }
+
+    microseconds_t start = get_current_microseconds();
+    const char* msg = job->recreate();
+    if (msg != NULL) {
+        printf("Failed to reload %s pipeline, keeping the previous one: %s", job->name, msg);
+        return;
+    }
+
+    printf("Reloaded %s pipeline in %ldus\n", job->name, get_current_microseconds() - start);
+}
+
 void term_vulkan_graphics_pipelines() {
+    // Pipelines that were never used still have to finish before their objects can be destroyed
+    for (size_t i = 0; i < NUM_GRAPHICS_PIPELINES; i++) {
+        if (pipeline_jobs[i].started) {
+            wait_for_graphics_pipeline((graphics_pipeline_t)i);
+        }
+    }
+
     term_shadow_pipeline();
     term_color_pipeline();
-}
\ No newline at end of file
+    term_upscale_pipeline();
+    term_light_cluster_pipeline();
+}
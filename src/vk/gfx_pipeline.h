@@ -1,4 +1,17 @@
 #pragma once
 
+typedef enum {
+    shadow_graphics_pipeline,
+    color_graphics_pipeline,
+    upscale_graphics_pipeline,
+    // Compute, but created and reloaded the same way
+    light_cluster_compute_pipeline,
+    NUM_GRAPHICS_PIPELINES
+} graphics_pipeline_t;
+
+// Pipelines are compiled by jobs started here, wait_for_graphics_pipeline has to be called before a pipeline is first recorded
 const char* init_vulkan_graphics_pipelines(void);
-void term_vulkan_graphics_pipelines(void);
\ No newline at end of file
+const char* wait_for_graphics_pipeline(graphics_pipeline_t pipeline);
+// Recreates the pipeline from the current shader code, the GPU must not be using it anymore
+void reload_graphics_pipeline(graphics_pipeline_t pipeline);
+void term_vulkan_graphics_pipelines(void);
@@ -0,0 +1,159 @@
+#include "light_cluster_pipeline.h"
+#include "core.h"
+#include "gfx_core.h"
+#include "defaults.h"
+#include "pipeline_cache.h"
+#include "debug.h"
+#include "bindless.h"
+#include "frame_uniforms.h"
+#include <vk_mem_alloc.h>
+#include <stdalign.h>
+#include <math.h>
+
+alignas(64)
+VkBuffer light_cluster_buffer;
+static VmaAllocation light_cluster_allocation;
+static VkDescriptorSetLayout descriptor_set_layout;
+static VkDescriptorPool descriptor_pool;
+static VkDescriptorSet descriptor_set;
+static VkPipelineLayout pipeline_layout;
+static VkPipeline pipeline;
+
+#define LIGHT_CLUSTER_SLOT_BYTES (NUM_LIGHT_CLUSTERS*sizeof(light_cluster_t))
+
+const char* init_light_cluster_pipeline(void) {
+    // Only ever written and read by the GPU, the slot of a frame is free again once its fence has been waited on
+    if (vmaCreateBuffer(allocator, &(VkBufferCreateInfo) {
+        DEFAULT_VK_BUFFER,
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        .size = NUM_FRAMES_IN_FLIGHT*LIGHT_CLUSTER_SLOT_BYTES
+    }, &device_allocation_create_info, &light_cluster_buffer, &light_cluster_allocation, NULL) != VK_SUCCESS) {
+        return "Failed to create light cluster buffer\n";
+    }
+    SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_BUFFER, light_cluster_buffer, "Light clusters");
+
+    if (add_bindless_storage_buffer(light_cluster_buffer, NUM_FRAMES_IN_FLIGHT*LIGHT_CLUSTER_SLOT_BYTES, &frame_uniforms.light_cluster_buffer_index) != result_success) {
+        return "Failed to add light cluster buffer to bindless table\n";
+    }
+
+    // Slice s ends at near*(far/near)^((s + 1)/slices), so the slice of a depth is linear in its log
+    float log_depth_range = logf(LIGHT_CLUSTER_FAR/LIGHT_CLUSTER_NEAR);
+    frame_uniforms.light_cluster_depth_scale = (float)LIGHT_CLUSTER_SLICES/log_depth_range;
+    frame_uniforms.light_cluster_depth_bias = -(float)LIGHT_CLUSTER_SLICES*logf(LIGHT_CLUSTER_NEAR)/log_depth_range;
+    frame_uniforms.light_cluster_near = LIGHT_CLUSTER_NEAR;
+    frame_uniforms.light_cluster_far = LIGHT_CLUSTER_FAR;
+
+    if (create_descriptor_set(
+        &(VkDescriptorSetLayoutCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .bindingCount = 1,
+            .pBindings = &(VkDescriptorSetLayoutBinding) {
+                DEFAULT_VK_DESCRIPTOR_BINDING,
+                .binding = 0,
+                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT
+            }
+        },
+        &(descriptor_info_t) {
+            .type = descriptor_info_type_buffer,
+            .buffer = {
+                .buffer = frame_uniform_buffer,
+                .offset = 0,
+                .range = sizeof(frame_uniforms_t)
+            }
+        },
+        &descriptor_set_layout, &descriptor_pool, &descriptor_set
+    ) != result_success) {
+        return "Failed to create descriptor set\n";
+    }
+
+    // Same sets as the color pipeline, the bindless table with the lights and clusters and the frame uniforms
+    if (vkCreatePipelineLayout(device, &(VkPipelineLayoutCreateInfo) {
+        DEFAULT_VK_PIPELINE_LAYOUT,
+        .setLayoutCount = 2,
+        .pSetLayouts = (VkDescriptorSetLayout[2]) { bindless_descriptor_set_layout, descriptor_set_layout }
+    }, NULL, &pipeline_layout) != VK_SUCCESS) {
+        return "Failed to create pipeline layout\n";
+    }
+
+    return NULL;
+}
+
+// Runs on a pipeline job thread, everything it uses was created by init_light_cluster_pipeline
+const char* create_light_cluster_pipeline(void) {
+    VkShaderModule compute_shader_module;
+    if (create_shader_module("light_cluster_pipeline_compute", &compute_shader_module) != result_success) {
+        return "Failed to create compute shader module\n";
+    }
+
+    uint32_t max_light_cluster_lights = MAX_LIGHT_CLUSTER_LIGHTS;
+    VkResult result = vkCreateComputePipelines(device, pipeline_cache, 1, &(VkComputePipelineCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            DEFAULT_VK_SHADER_STAGE,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = compute_shader_module,
+            .pSpecializationInfo = &(VkSpecializationInfo) {
+                .mapEntryCount = 1,
+                .pMapEntries = &(VkSpecializationMapEntry) { .constantID = 0, .offset = 0, .size = sizeof(uint32_t) },
+                .dataSize = sizeof(max_light_cluster_lights),
+                .pData = &max_light_cluster_lights
+            }
+        },
+        .layout = pipeline_layout,
+        .basePipelineHandle = VK_NULL_HANDLE,
+        .basePipelineIndex = -1
+    }, NULL, &pipeline);
+
+    vkDestroyShaderModule(device, compute_shader_module, NULL);
+
+    if (result != VK_SUCCESS) {
+        return "Failed to create compute pipeline\n";
+    }
+    SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_PIPELINE, pipeline, "Light cluster pipeline");
+
+    return NULL;
+}
+
+// Keeps the current pipeline when the new one fails, so a broken shader edit does not stop the app
+const char* recreate_light_cluster_pipeline(void) {
+    VkPipeline old_pipeline = pipeline;
+
+    const char* msg = create_light_cluster_pipeline();
+    if (msg != NULL) {
+        pipeline = old_pipeline;
+        return msg;
+    }
+
+    vkDestroyPipeline(device, old_pipeline, NULL);
+    return NULL;
+}
+
+void dispatch_light_cluster_pipeline(VkCommandBuffer command_buffer, uint32_t frame_index, uint32_t frame_uniform_offset) {
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &bindless_descriptor_set, 0, NULL);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 1, 1, &descriptor_set, 1, &frame_uniform_offset);
+
+    // One workgroup per cluster, its invocations test the lights in parallel
+    vkCmdDispatch(command_buffer, LIGHT_CLUSTER_TILES_X, LIGHT_CLUSTER_TILES_Y, LIGHT_CLUSTER_SLICES);
+
+    // The color pass of the same frame reads the slot, the previous reader of the slot finished before the frame's fence was signaled
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 1, &(VkBufferMemoryBarrier) {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = light_cluster_buffer,
+        .offset = frame_index*LIGHT_CLUSTER_SLOT_BYTES,
+        .size = LIGHT_CLUSTER_SLOT_BYTES
+    }, 0, NULL);
+}
+
+void term_light_cluster_pipeline(void) {
+    vkDestroyPipeline(device, pipeline, NULL);
+    vkDestroyPipelineLayout(device, pipeline_layout, NULL);
+    vkDestroyDescriptorPool(device, descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(device, descriptor_set_layout, NULL);
+    vmaDestroyBuffer(allocator, light_cluster_buffer, light_cluster_allocation);
+}
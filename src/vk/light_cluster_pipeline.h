@@ -0,0 +1,32 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include <assert.h>
+
+// Screen tiles by exponential view depth slices, the color fragment shader only iterates the lights of its cluster
+#define LIGHT_CLUSTER_TILES_X 16
+#define LIGHT_CLUSTER_TILES_Y 9
+#define LIGHT_CLUSTER_SLICES 24
+#define NUM_LIGHT_CLUSTERS (LIGHT_CLUSTER_TILES_X*LIGHT_CLUSTER_TILES_Y*LIGHT_CLUSTER_SLICES)
+// The first slice reaches from the camera to about 1.3 times the near depth, the last one from about 0.77 times the far depth on without end
+#define LIGHT_CLUSTER_NEAR 0.5f
+#define LIGHT_CLUSTER_FAR 300.0f
+// Further lights of a cluster are dropped, a cluster fills 1 KiB
+#define MAX_LIGHT_CLUSTER_LIGHTS 255
+
+// Mirrored as a flat array of words by the light cluster and color fragment shaders
+typedef struct {
+    uint32_t num_lights;
+    uint32_t light_indices[MAX_LIGHT_CLUSTER_LIGHTS];
+} light_cluster_t;
+static_assert(sizeof(light_cluster_t) == 1024, "Light clusters must match the stride of the shaders");
+
+// One slot of clusters per frame in flight, reached through the bindless table and the offset in the frame uniforms
+extern VkBuffer light_cluster_buffer;
+
+const char* init_light_cluster_pipeline(void);
+const char* create_light_cluster_pipeline(void);
+const char* recreate_light_cluster_pipeline(void);
+// Assigns the lights to the clusters of the frame's slot and makes them visible to fragment shaders, the lights have to be uploaded
+void dispatch_light_cluster_pipeline(VkCommandBuffer command_buffer, uint32_t frame_index, uint32_t frame_uniform_offset);
+void term_light_cluster_pipeline(void);
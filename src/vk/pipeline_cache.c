@@ -0,0 +1,178 @@
+#define _GNU_SOURCE
+#include "pipeline_cache.h"
+#include "core.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <malloc.h>
+#include <stdalign.h>
+
+#define PIPELINE_CACHE_PATH "pipeline_cache.bin"
+#define PIPELINE_CACHE_TEMP_PATH "pipeline_cache.bin.tmp"
+#define PIPELINE_CACHE_MAGIC 0x48434c50u // "PLCH"
+
+// Written in front of the data returned by vkGetPipelineCacheData
+typedef struct {
+    uint32_t magic;
+    uint32_t driver_version;
+    uint64_t num_data_bytes;
+} pipeline_cache_file_header_t;
+
+alignas(64)
+VkPipelineCache pipeline_cache;
+bool pipeline_cache_warm = false;
+
+static uint32_t driver_version;
+
+static const char* validate_pipeline_cache_data(const VkPhysicalDeviceProperties* physical_device_properties, const pipeline_cache_file_header_t* file_header, size_t num_data_bytes, const void* data) {
+    if (file_header->magic != PIPELINE_CACHE_MAGIC) {
+        return "unrecognized file";
+    }
+    if (file_header->num_data_bytes != num_data_bytes || num_data_bytes < sizeof(VkPipelineCacheHeaderVersionOne)) {
+        return "truncated file";
+    }
+    if (file_header->driver_version != physical_device_properties->driverVersion) {
+        return "driver version changed";
+    }
+
+    // The driver's own header at the start of the data identifies the device but not the driver version
+    VkPipelineCacheHeaderVersionOne data_header;
+    memcpy(&data_header, data, sizeof(data_header));
+
+    if (data_header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || data_header.headerSize < sizeof(data_header)) {
+        return "unsupported cache header";
+    }
+    if (data_header.vendorID != physical_device_properties->vendorID || data_header.deviceID != physical_device_properties->deviceID) {
+        return "device changed";
+    }
+    if (memcmp(data_header.pipelineCacheUUID, physical_device_properties->pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+        return "pipeline cache UUID changed";
+    }
+
+    return NULL;
+}
+
+// Returns NULL when there is no usable cache on disk, the reason is printed so cold starts can be told apart from invalidated ones
+static void* load_pipeline_cache_data(const VkPhysicalDeviceProperties* physical_device_properties, size_t* out_num_data_bytes) {
+    FILE* file = fopen(PIPELINE_CACHE_PATH, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0) {
+        fclose(file);
+        printf("Discarded pipeline cache (unreadable file)\n");
+        return NULL;
+    }
+
+    pipeline_cache_file_header_t file_header;
+    if ((size_t)st.st_size < sizeof(file_header) || fread(&file_header, sizeof(file_header), 1, file) != 1) {
+        fclose(file);
+        printf("Discarded pipeline cache (truncated file)\n");
+        return NULL;
+    }
+
+    size_t num_data_bytes = (size_t)st.st_size - sizeof(file_header);
+    void* data = memalign(64, num_data_bytes > 0 ? num_data_bytes : 1);
+    if (data == NULL) {
+        fclose(file);
+        printf("Discarded pipeline cache (out of memory)\n");
+        return NULL;
+    }
+    if (num_data_bytes > 0 && fread(data, num_data_bytes, 1, file) != 1) {
+        fclose(file);
+        free(data);
+        printf("Discarded pipeline cache (truncated file)\n");
+        return NULL;
+    }
+
+    fclose(file);
+
+    const char* reason = validate_pipeline_cache_data(physical_device_properties, &file_header, num_data_bytes, data);
+    if (reason != NULL) {
+        free(data);
+        printf("Discarded pipeline cache (%s)\n", reason);
+        return NULL;
+    }
+
+    *out_num_data_bytes = num_data_bytes;
+    return data;
+}
+
+const char* init_vulkan_pipeline_cache(const VkPhysicalDeviceProperties* physical_device_properties) {
+    driver_version = physical_device_properties->driverVersion;
+
+    size_t num_data_bytes = 0;
+    void* data = load_pipeline_cache_data(physical_device_properties, &num_data_bytes);
+
+    VkResult result = vkCreatePipelineCache(device, &(VkPipelineCacheCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = num_data_bytes,
+        .pInitialData = data
+    }, NULL, &pipeline_cache);
+
+    // Drivers are allowed to reject data that passed the header checks, fall back to an empty cache
+    if (result != VK_SUCCESS && data != NULL) {
+        printf("Discarded pipeline cache (rejected by driver)\n");
+        free(data);
+        data = NULL;
+        result = vkCreatePipelineCache(device, &(VkPipelineCacheCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO
+        }, NULL, &pipeline_cache);
+    }
+
+    if (result != VK_SUCCESS) {
+        return "Failed to create pipeline cache\n";
+    }
+
+    pipeline_cache_warm = data != NULL;
+    free(data);
+
+    return NULL;
+}
+
+static void save_pipeline_cache(void) {
+    size_t num_data_bytes;
+    if (vkGetPipelineCacheData(device, pipeline_cache, &num_data_bytes, NULL) != VK_SUCCESS || num_data_bytes == 0) {
+        return;
+    }
+
+    void* data = memalign(64, num_data_bytes);
+    if (data == NULL) {
+        printf("Failed to save pipeline cache\n");
+        return;
+    }
+    if (vkGetPipelineCacheData(device, pipeline_cache, &num_data_bytes, data) != VK_SUCCESS) {
+        free(data);
+        return;
+    }
+
+    pipeline_cache_file_header_t file_header = {
+        .magic = PIPELINE_CACHE_MAGIC,
+        .driver_version = driver_version,
+        .num_data_bytes = num_data_bytes
+    };
+
+    // Written to a temporary file first so a crash mid write never leaves a corrupt cache behind
+    FILE* file = fopen(PIPELINE_CACHE_TEMP_PATH, "wb");
+    if (file == NULL) {
+        free(data);
+        return;
+    }
+
+    bool written = fwrite(&file_header, sizeof(file_header), 1, file) == 1 && fwrite(data, num_data_bytes, 1, file) == 1;
+    written = fclose(file) == 0 && written;
+    free(data);
+
+    if (!written || rename(PIPELINE_CACHE_TEMP_PATH, PIPELINE_CACHE_PATH) != 0) {
+        remove(PIPELINE_CACHE_TEMP_PATH);
+        printf("Failed to save pipeline cache\n");
+    }
+}
+
+void term_vulkan_pipeline_cache(void) {
+    save_pipeline_cache();
+    vkDestroyPipelineCache(device, pipeline_cache, NULL);
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdbool.h>
+
+extern VkPipelineCache pipeline_cache;
+// Whether the cache was seeded with data saved by a previous run on the same device and driver
+extern bool pipeline_cache_warm;
+
+const char* init_vulkan_pipeline_cache(const VkPhysicalDeviceProperties* physical_device_properties);
+void term_vulkan_pipeline_cache(void);
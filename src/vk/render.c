@@ -2,27 +2,443 @@
 #include "core.h"
 #include "gfx_pipeline.h"
 #include "color_pipeline.h"
+#include "shadow_pipeline.h"
+#include "upscale_pipeline.h"
+#include "light_cluster_pipeline.h"
+#include "upload.h"
+#include "frame_uniforms.h"
+#include "defaults.h"
 #include "gfx_core.h"
 #include "asset.h"
 #include "result.h"
 #include "util.h"
+#include "shader_reload.h"
+#include "render_graph.h"
+#include "render_scale.h"
+#include "job.h"
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdalign.h>
 
+typedef enum {
+    frame_shadow_pass,
+    frame_depth_prepass,
+    frame_color_pass,
+    // Recorded into the present command buffer, so only the passes before it are timed and none of them wait for the swapchain image
+    frame_upscale_pass,
+    NUM_FRAME_PASSES
+} frame_pass_t;
+
+typedef struct {
+    uint32_t image_index;
+    uint32_t frame_index;
+    uint32_t frame_uniform_offset;
+    bool assets_ready;
+    bool depth_prepassed;
+} frame_context_t;
+
+static void record_shadow_pass(VkCommandBuffer command_buffer, const void*) {
+    draw_shadow_pipeline(command_buffer);
+}
+
+static void record_depth_prepass(VkCommandBuffer command_buffer, const void* context) {
+    const frame_context_t* frame = context;
+    draw_depth_prepass(command_buffer, frame->frame_uniform_offset);
+}
+
+static void record_color_pass(VkCommandBuffer command_buffer, const void* context) {
+    const frame_context_t* frame = context;
+    draw_color_pipeline(command_buffer, frame->frame_uniform_offset, frame->assets_ready, frame->depth_prepassed);
+}
+
+static void record_upscale_pass(VkCommandBuffer command_buffer, const void* context) {
+    const frame_context_t* frame = context;
+    draw_upscale_pipeline(command_buffer, frame->frame_index, frame->image_index);
+}
+
+// The CPU side of a frame once its fence has been waited on and its swapchain image acquired
+// Writing the uniforms copies the instance order of the snapshot, which runs alongside recording since only the slot offset is recorded
+// The present command buffer continues the render graph state the scene left, so it is recorded after it
+typedef enum {
+    frame_uniforms_job,
+    frame_scene_record_job,
+    frame_present_record_job,
+    NUM_FRAME_JOBS
+} frame_job_t;
+
+typedef struct {
+    frame_context_t frame;
+    const frame_snapshot_t* snapshot;
+    VkCommandBuffer scene_command_buffer;
+    VkCommandBuffer present_command_buffer;
+    // Written by the scene job, the shadow pass depends on whether instances changed
+    bool passes_enabled[NUM_FRAME_PASSES];
+} frame_jobs_context_t;
+
+static void run_frame_uniforms_job(void* context, uint32_t, uint32_t);
+static void run_scene_record_job(void* context, uint32_t, uint32_t);
+static void run_present_record_job(void* context, uint32_t, uint32_t);
+
+static const job_graph_node_t frame_job_nodes[NUM_FRAME_JOBS] = {
+    [frame_uniforms_job] = { .name = "frame uniforms", .function = run_frame_uniforms_job, .num_items = 1, .batch_size = 1 },
+    [frame_scene_record_job] = { .name = "record scene", .function = run_scene_record_job, .num_items = 1, .batch_size = 1 },
+    [frame_present_record_job] = {
+        .name = "record present",
+        .function = run_present_record_job,
+        .num_items = 1,
+        .batch_size = 1,
+        .num_dependencies = 1,
+        .dependencies = { frame_scene_record_job }
+    }
+};
+
+alignas(64)
+static VkCommandBuffer scene_command_buffers[NUM_FRAMES_IN_FLIGHT];
+static VkCommandBuffer present_command_buffers[NUM_FRAMES_IN_FLIGHT];
 static uint32_t frame_index = 0;
+// Counts submitted frames, resources retired during a frame are destroyed once its fence has been waited on
+static uint64_t frame_number = 0;
+
+// Bounds the low latency wait, presents of a hidden window may never be shown
+#define PRESENT_WAIT_TIMEOUT 100000000ul
+
+// Presents not yet seen to be shown, oldest first, all to pending_present_swapchain
+#define MAX_PENDING_PRESENTS 8
+typedef struct {
+    uint64_t present_id;
+    microseconds_t input_microseconds;
+} pending_present_t;
+
+static uint32_t num_pending_presents = 0;
+static pending_present_t pending_presents[MAX_PENDING_PRESENTS];
+static VkSwapchainKHR pending_present_swapchain = VK_NULL_HANDLE;
+
+present_latency_t present_latency;
+gpu_scene_time_t gpu_scene_time;
+
+// Two timestamps per frame in flight around the scene passes, read back once the frame's fence has been waited on
+static bool gpu_timing_enabled = false;
+static VkQueryPool timestamp_query_pool;
+static float timestamp_period_nanoseconds;
+static bool timestamps_written[NUM_FRAMES_IN_FLIGHT];
+
+static bool shadow_image_drawn = false;
+static bool depth_prepass_enabled = false;
+
+static job_graph_t frame_job_graph;
+
+render_graph_resource_t frame_resources[NUM_FRAME_RESOURCES] = {
+    [frame_shadow_image] = { .name = "Shadow image", .type = render_graph_resource_imported },
+    [frame_color_image] = { .name = "Color pass multisampled color image", .type = render_graph_resource_transient },
+    [frame_depth_image] = { .name = "Color pass depth image", .type = render_graph_resource_transient },
+    [frame_scene_image] = { .name = "Scene image", .type = render_graph_resource_transient },
+    [frame_swapchain_image] = { .name = "Swapchain image", .type = render_graph_resource_presented, .aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT }
+};
+
+static render_graph_pass_t frame_passes[NUM_FRAME_PASSES] = {
+    [frame_shadow_pass] = {
+        .name = "shadow",
+        .num_uses = 1,
+        .uses = {
+            { frame_shadow_image, render_graph_access_depth_attachment }
+        },
+        .record = record_shadow_pass
+    },
+    [frame_depth_prepass] = {
+        .name = "depth prepass",
+        .num_uses = 1,
+        .uses = {
+            { frame_depth_image, render_graph_access_depth_attachment }
+        },
+        .record = record_depth_prepass
+    },
+    [frame_color_pass] = {
+        .name = "color",
+        // The multisampled image is the last use, so it can be left out when rendering without multisampling
+        .num_uses = 4,
+        .uses = {
+            { frame_shadow_image, render_graph_access_fragment_sampled },
+            { frame_depth_image, render_graph_access_depth_attachment },
+            { frame_scene_image, render_graph_access_color_attachment },
+            { frame_color_image, render_graph_access_color_attachment }
+        },
+        .record = record_color_pass
+    },
+    [frame_upscale_pass] = {
+        .name = "upscale",
+        .num_uses = 2,
+        .uses = {
+            { frame_scene_image, render_graph_access_fragment_sampled },
+            { frame_swapchain_image, render_graph_access_color_attachment }
+        },
+        .record = record_upscale_pass
+    }
+};
+
+const char* init_vulkan_render(const VkPhysicalDeviceProperties* physical_device_properties) {
+    if (vkAllocateCommandBuffers(device, &(VkCommandBufferAllocateInfo) {
+        DEFAULT_VK_COMMAND_BUFFER,
+        .commandPool = command_pool,
+        .commandBufferCount = NUM_FRAMES_IN_FLIGHT
+    }, scene_command_buffers) != VK_SUCCESS) {
+        return "Failed to allocate command buffers\n";
+    }
+
+    if (vkAllocateCommandBuffers(device, &(VkCommandBufferAllocateInfo) {
+        DEFAULT_VK_COMMAND_BUFFER,
+        .commandPool = command_pool,
+        .commandBufferCount = NUM_FRAMES_IN_FLIGHT
+    }, present_command_buffers) != VK_SUCCESS) {
+        return "Failed to allocate command buffers\n";
+    }
+
+    // The scale is only adjusted when there is a GPU time to adjust it by
+    gpu_timing_enabled = physical_device_properties->limits.timestampComputeAndGraphics;
+    if (gpu_timing_enabled) {
+        if (vkCreateQueryPool(device, &(VkQueryPoolCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = 2*NUM_FRAMES_IN_FLIGHT
+        }, NULL, &timestamp_query_pool) != VK_SUCCESS) {
+            return "Failed to create timestamp query pool\n";
+        }
+        timestamp_period_nanoseconds = physical_device_properties->limits.timestampPeriod;
+    }
+
+    // VULKAN_GPU_BUDGET_MS sets the target, otherwise it leaves some headroom below the refresh interval of the primary monitor
+    const char* gpu_budget_env = getenv("VULKAN_GPU_BUDGET_MS");
+    float gpu_budget_milliseconds;
+    if (gpu_budget_env != NULL) {
+        gpu_budget_milliseconds = strtof(gpu_budget_env, NULL);
+    } else {
+        const GLFWvidmode* video_mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+        int refresh_rate = video_mode != NULL && video_mode->refreshRate > 0 ? video_mode->refreshRate : 60;
+        gpu_budget_milliseconds = 0.85f*1000.0f/(float)refresh_rate;
+    }
+
+    // VULKAN_DYNAMIC_RESOLUTION=0 keeps rendering at the swapchain extent
+    const char* dynamic_resolution_env = getenv("VULKAN_DYNAMIC_RESOLUTION");
+    bool dynamic_resolution_enabled = gpu_timing_enabled && gpu_budget_milliseconds > 0.0f && (dynamic_resolution_env == NULL || strcmp(dynamic_resolution_env, "0") != 0);
+    init_render_scale(dynamic_resolution_enabled, gpu_budget_milliseconds);
+
+    // The prepass pays off when the heavy color fragment shader runs several times per pixel, VULKAN_DEPTH_PREPASS=0 or 1 overrides the scene's choice to compare
+    const char* depth_prepass_env = getenv("VULKAN_DEPTH_PREPASS");
+    depth_prepass_enabled = depth_prepass_env == NULL ? scene_depth_prepass : strcmp(depth_prepass_env, "0") != 0;
+    printf("Depth prepass %s\n", depth_prepass_enabled ? "enabled" : "disabled");
+
+    if (compile_job_graph(NUM_FRAME_JOBS, frame_job_nodes, &frame_job_graph) != result_success) {
+        return "Failed to compile frame job graph\n";
+    }
+
+    return NULL;
+}
+
+result_t init_frame_graph(void) {
+    frame_resources[frame_shadow_image].aspect_mask = depth_image_aspect_flags;
+    frame_resources[frame_shadow_image].image = shadow_image;
+    frame_resources[frame_shadow_image].view = shadow_image_view;
+
+    frame_resources[frame_color_image].aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT;
+    frame_resources[frame_color_image].info = (VkImageCreateInfo) {
+        DEFAULT_VK_IMAGE,
+        .extent.width = swap_image_extent.width,
+        .extent.height = swap_image_extent.height,
+        .format = surface_format.format,
+        .samples = render_multisample_flags,
+        .usage = VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+    };
+
+    frame_resources[frame_depth_image].aspect_mask = depth_image_aspect_flags;
+    frame_resources[frame_depth_image].info = (VkImageCreateInfo) {
+        DEFAULT_VK_IMAGE,
+        .extent.width = swap_image_extent.width,
+        .extent.height = swap_image_extent.height,
+        .format = depth_image_format,
+        .samples = render_multisample_flags,
+        .usage = VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT
+    };
+
+    // Sampled by the upscale pass, so it can not be lazily allocated like the attachments above
+    frame_resources[frame_scene_image].aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT;
+    frame_resources[frame_scene_image].info = (VkImageCreateInfo) {
+        DEFAULT_VK_IMAGE,
+        .extent.width = swap_image_extent.width,
+        .extent.height = swap_image_extent.height,
+        .format = surface_format.format,
+        .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+    };
+
+    frame_passes[frame_color_pass].num_uses = render_multisample_flags == VK_SAMPLE_COUNT_1_BIT ? 3 : 4;
+
+    return compile_render_graph(NUM_FRAME_RESOURCES, frame_resources, NUM_FRAME_PASSES, frame_passes);
+}
+
+void retire_frame_graph(render_graph_transients_t* transients) {
+    retire_render_graph(transients);
+}
+
+void term_vulkan_render(void) {
+    if (gpu_timing_enabled) {
+        vkDestroyQueryPool(device, timestamp_query_pool, NULL);
+    }
+}
+
+// The frame's fence has been waited on, so its timestamps are available unless the frame was never submitted
+static void read_gpu_scene_time(void) {
+    if (!gpu_timing_enabled || !timestamps_written[frame_index]) {
+        return;
+    }
+    timestamps_written[frame_index] = false;
+
+    uint64_t timestamps[2];
+    if (vkGetQueryPoolResults(device, timestamp_query_pool, 2*frame_index, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+        return;
+    }
+
+    microseconds_t scene_microseconds = (microseconds_t)((double)(timestamps[1] - timestamps[0])*(double)timestamp_period_nanoseconds/1000.0);
+    gpu_scene_time.num_frames++;
+    gpu_scene_time.total_microseconds += scene_microseconds;
+    if (scene_microseconds > gpu_scene_time.max_microseconds) {
+        gpu_scene_time.max_microseconds = scene_microseconds;
+    }
+
+    update_render_scale((float)scene_microseconds/1000.0f);
+}
+
+static void collect_shown_presents(void) {
+    // Presents of a replaced swapchain can not be waited on anymore
+    if (pending_present_swapchain != swapchain) {
+        num_pending_presents = 0;
+        pending_present_swapchain = swapchain;
+    }
+
+    microseconds_t now = get_current_microseconds();
+    uint32_t num_shown = 0;
+    for (; num_shown < num_pending_presents; num_shown++) {
+        VkResult result = wait_for_present(swapchain, pending_presents[num_shown].present_id, 0);
+        if (result == VK_TIMEOUT) {
+            break;
+        } else if (result != VK_SUCCESS) {
+            num_pending_presents = 0;
+            return;
+        }
+
+        microseconds_t latency = now - pending_presents[num_shown].input_microseconds;
+        present_latency.num_presents++;
+        present_latency.total_microseconds += latency;
+        if (latency > present_latency.max_microseconds) {
+            present_latency.max_microseconds = latency;
+        }
+    }
+
+    num_pending_presents -= num_shown;
+    memmove(pending_presents, &pending_presents[num_shown], num_pending_presents*sizeof(pending_present_t));
+}
+
+void pace_vulkan_frame(void) {
+    if (present_wait_enabled) {
+        // Waiting on the newest present means nothing is queued behind the frame being shown, so the next one starts from fresh input
+        if (present_policy == present_policy_low_latency && num_pending_presents > 0 && pending_present_swapchain == swapchain) {
+            wait_for_present(swapchain, pending_presents[num_pending_presents - 1].present_id, PRESENT_WAIT_TIMEOUT);
+        }
+        collect_shown_presents();
+    } else if (present_policy == present_policy_low_latency) {
+        // Without present wait, the previous frame finishing on the GPU is the closest point to wait for
+        vkWaitForFences(device, 1, &in_flight_fences[(frame_index + NUM_FRAMES_IN_FLIGHT - 1) % NUM_FRAMES_IN_FLIGHT], VK_TRUE, UINT64_MAX);
+    }
+}
+
+static void run_frame_uniforms_job(void* context, uint32_t, uint32_t) {
+    const frame_jobs_context_t* jobs = context;
+    write_frame_uniforms(jobs->frame.frame_index, jobs->snapshot);
+}
+
+static void run_scene_record_job(void* context, uint32_t, uint32_t) {
+    frame_jobs_context_t* jobs = context;
+    VkCommandBuffer command_buffer = jobs->scene_command_buffer;
+    bool assets_ready = jobs->frame.assets_ready;
+
+    if (gpu_timing_enabled) {
+        vkCmdResetQueryPool(command_buffer, timestamp_query_pool, 2*jobs->frame.frame_index, 2);
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamp_query_pool, 2*jobs->frame.frame_index);
+    }
+
+    if (assets_ready && record_instance_updates(command_buffer, jobs->frame.frame_index)) {
+        shadow_image_drawn = false;
+    }
+
+    // Only the color pass reads the clusters, and only once there are models to shade
+    if (assets_ready) {
+        dispatch_light_cluster_pipeline(command_buffer, jobs->frame.frame_index, jobs->frame.frame_uniform_offset);
+    }
+
+    // The shadow map only depends on the instances and static geometry, so it is drawn again only after instances changed
+    jobs->passes_enabled[frame_shadow_pass] = assets_ready && !shadow_image_drawn;
+    jobs->passes_enabled[frame_depth_prepass] = assets_ready && depth_prepass_enabled;
+    jobs->passes_enabled[frame_color_pass] = true;
+    jobs->passes_enabled[frame_upscale_pass] = true;
+    shadow_image_drawn |= jobs->passes_enabled[frame_shadow_pass];
+    jobs->frame.depth_prepassed = jobs->passes_enabled[frame_depth_prepass];
+
+    execute_render_graph_passes(command_buffer, 0, frame_upscale_pass, jobs->passes_enabled, &jobs->frame);
+    if (gpu_timing_enabled) {
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamp_query_pool, 2*jobs->frame.frame_index + 1);
+        timestamps_written[jobs->frame.frame_index] = true;
+    }
+}
+
+static void run_present_record_job(void* context, uint32_t, uint32_t) {
+    const frame_jobs_context_t* jobs = context;
+    execute_render_graph_passes(jobs->present_command_buffer, frame_upscale_pass, NUM_FRAME_PASSES, jobs->passes_enabled, &jobs->frame);
+}
+
+const char* draw_vulkan_frame(const frame_snapshot_t* snapshot, bool* frame_drawn) {
+    *frame_drawn = false;
+    // Applied before anything can return early, so changes of skipped frames still reach the next one drawn
+    apply_instance_updates(&snapshot->instance_updates);
+    window_extent = snapshot->window_extent;
+    framebuffer_resized |= snapshot->window_resized;
+    if (snapshot->present_policy != present_policy) {
+        set_present_policy(snapshot->present_policy);
+    }
 
-const char* draw_vulkan_frame(void) {
     VkSemaphore image_available_semaphore = image_available_semaphores[frame_index];
     VkSemaphore render_finished_semaphore = render_finished_semaphores[frame_index];
     VkFence in_flight_fence = in_flight_fences[frame_index];
+    const char* msg;
+
+#ifdef SHADER_HOT_RELOAD
+    // Frame boundary, nothing is recording and waiting for the device makes sure no submitted frame still uses the old pipelines
+    uint32_t pending_reloads = take_pending_shader_reloads();
+    if (pending_reloads != 0) {
+        vkDeviceWaitIdle(device);
+        for (uint32_t i = 0; i < NUM_GRAPHICS_PIPELINES; i++) {
+            if (pending_reloads & (1u << i)) {
+                reload_graphics_pipeline((graphics_pipeline_t)i);
+            }
+        }
+        if (pending_reloads & (1u << shadow_graphics_pipeline)) {
+            shadow_image_drawn = false;
+        }
+    }
+#endif
 
     vkWaitForFences(device, 1, &in_flight_fence, VK_TRUE, UINT64_MAX);
+    destroy_retired_swapchains(frame_number);
+    read_gpu_scene_time();
+
+    // Resized since the last present or still minimized, nothing is drawn until the window has a size again
+    if (framebuffer_resized) {
+        msg = reinit_swapchain(frame_number);
+        if (msg != NULL || framebuffer_resized) { return msg; }
+    }
 
     uint32_t image_index;
     {
         VkResult result = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, image_available_semaphore, VK_NULL_HANDLE, &image_index);
         if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-            reinit_swapchain();
-            return NULL;
+            return reinit_swapchain(frame_number);
         } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
             return "Failed to acquire swapchain image";
         }
@@ -30,30 +446,110 @@ const char* draw_vulkan_frame(void) {
 
     vkResetFences(device, 1, &in_flight_fence);
 
-    VkCommandBuffer command_buffer;
-    const char* msg = draw_color_pipeline(frame_index, image_index, &command_buffer);
-    if (msg != NULL) {
-        return msg;
+    msg = wait_for_graphics_pipeline(color_graphics_pipeline);
+    if (msg != NULL) { return msg; }
+
+    msg = wait_for_graphics_pipeline(upscale_graphics_pipeline);
+    if (msg != NULL) { return msg; }
+
+    update_uploads();
+    bool assets_ready = are_vulkan_assets_ready();
+
+    // Moving instances redraw the shadow map, so it is waited for as soon as there is anything to draw
+    if (assets_ready) {
+        msg = wait_for_graphics_pipeline(shadow_graphics_pipeline);
+        if (msg != NULL) { return msg; }
+
+        msg = wait_for_graphics_pipeline(light_cluster_compute_pipeline);
+        if (msg != NULL) { return msg; }
+    }
+
+    VkCommandBuffer scene_command_buffer = scene_command_buffers[frame_index];
+    VkCommandBuffer present_command_buffer = present_command_buffers[frame_index];
+
+    vkResetCommandBuffer(scene_command_buffer, 0);
+    vkResetCommandBuffer(present_command_buffer, 0);
+    if (vkBeginCommandBuffer(scene_command_buffer, &(VkCommandBufferBeginInfo) {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
+    }) != VK_SUCCESS || vkBeginCommandBuffer(present_command_buffer, &(VkCommandBufferBeginInfo) {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
+    }) != VK_SUCCESS) {
+        return "Failed to begin writing to command buffer\n";
+    }
+
+    frame_resources[frame_swapchain_image].image = swapchain_images[image_index];
+    frame_resources[frame_swapchain_image].view = swapchain_image_views[image_index];
+
+    // Taken from the scale the last finished frame left, the upscale pass of this frame reads the same extent
+    update_render_extent(swap_image_extent);
+
+    // The uniform slot of this frame is free now that its previous use has finished, the main thread runs jobs until the graph is done
+    frame_jobs_context_t frame_jobs_context = {
+        .frame = {
+            .image_index = image_index,
+            .frame_index = frame_index,
+            .frame_uniform_offset = get_frame_uniform_offset(frame_index),
+            .assets_ready = assets_ready
+        },
+        .snapshot = snapshot,
+        .scene_command_buffer = scene_command_buffer,
+        .present_command_buffer = present_command_buffer
+    };
+    run_job_graph(&frame_job_graph, NULL, &frame_jobs_context);
+
+    if (vkEndCommandBuffer(scene_command_buffer) != VK_SUCCESS || vkEndCommandBuffer(present_command_buffer) != VK_SUCCESS) {
+        return "Failed to end command buffer\n";
     }
 
     VkPipelineStageFlags wait_stage_flags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 
-    if (vkQueueSubmit(graphics_queue, 1, &(VkSubmitInfo) {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &image_available_semaphore,
-        .pWaitDstStageMask = &wait_stage_flags,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &command_buffer,
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &render_finished_semaphore
+    // The scene is submitted without waiting for the swapchain image, so its GPU time does not include waiting for a present
+    if (vkQueueSubmit(graphics_queue, 2, (VkSubmitInfo[2]) {
+        {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &scene_command_buffer
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &image_available_semaphore,
+            .pWaitDstStageMask = &wait_stage_flags,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &present_command_buffer,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores = &render_finished_semaphore
+        }
     }, in_flight_fence) != VK_SUCCESS) {
         return "Failed to submit to graphics queue\n";
     }
+    *frame_drawn = true;
+
+    // Ids only have to increase within a swapchain, the frame number does across all of them
+    uint64_t present_id = frame_number + 1;
+    if (present_wait_enabled) {
+        if (pending_present_swapchain != swapchain) {
+            num_pending_presents = 0;
+            pending_present_swapchain = swapchain;
+        }
+        if (num_pending_presents == MAX_PENDING_PRESENTS) {
+            num_pending_presents--;
+            memmove(pending_presents, &pending_presents[1], num_pending_presents*sizeof(pending_present_t));
+        }
+        pending_presents[num_pending_presents++] = (pending_present_t) {
+            .present_id = present_id,
+            .input_microseconds = snapshot->input_microseconds
+        };
+    }
 
     {
         VkResult result = vkQueuePresentKHR(presentation_queue, &(VkPresentInfoKHR) {
             .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+            .pNext = present_wait_enabled ? &(VkPresentIdKHR) {
+                .sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR,
+                .swapchainCount = 1,
+                .pPresentIds = &present_id
+            } : NULL,
             .waitSemaphoreCount = 1,
             .pWaitSemaphores = &render_finished_semaphore,
             .swapchainCount = 1,
@@ -61,10 +557,10 @@ const char* draw_vulkan_frame(void) {
             .pImageIndices = &image_index
         });
         
+        // This frame is still in flight, the old swapchain's resources are destroyed after it finishes
         if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebuffer_resized) {
-            framebuffer_resized = false;
-            vkWaitForFences(device, 1, &in_flight_fence, VK_TRUE, UINT64_MAX);
-            reinit_swapchain();
+            msg = reinit_swapchain(frame_number);
+            if (msg != NULL) { return msg; }
         } else if (result != VK_SUCCESS) {
             return "Failed to present swap chain image";
         }
@@ -72,6 +568,7 @@ const char* draw_vulkan_frame(void) {
 
     frame_index += 1;
     frame_index %= NUM_FRAMES_IN_FLIGHT;
+    frame_number += 1;
 
     return NULL;
 }
\ No newline at end of file
@@ -1,3 +1,52 @@
 #pragma once
+#include "render_graph.h"
+#include "chrono.h"
+#include "frame_pipeline.h"
+#include <stddef.h>
 
-const char* draw_vulkan_frame(void);
\ No newline at end of file
+typedef enum {
+    frame_shadow_image,
+    frame_color_image,
+    frame_depth_image,
+    // Color pass output at render_extent, upscaled into the swapchain image
+    frame_scene_image,
+    frame_swapchain_image,
+    NUM_FRAME_RESOURCES
+} frame_resource_t;
+
+// Images of the frame graph, transient ones are recreated by init_frame_graph
+extern render_graph_resource_t frame_resources[NUM_FRAME_RESOURCES];
+
+const char* init_vulkan_render(const VkPhysicalDeviceProperties* physical_device_properties);
+// Sizes the transient attachments to the swapchain, so it is called again after the swapchain is recreated
+result_t init_frame_graph(void);
+// Called on the render thread before it takes the next snapshot, the low latency policy waits here for the previous frame to be shown
+// The simulation samples input for the next frame only after this returns when it waits for the render thread, see begin_frame_snapshot
+void pace_vulkan_frame(void);
+// Render thread only, applies the window state, present policy and instance changes of the snapshot before drawing it
+// frame_drawn is false when nothing was submitted, e.g. while minimized, nothing blocks then so the caller has to pace itself
+const char* draw_vulkan_frame(const frame_snapshot_t* snapshot, bool* frame_drawn);
+// Hands over the transient attachments, frames in flight may still use them while the graph is compiled again, see reinit_swapchain
+void retire_frame_graph(render_graph_transients_t* transients);
+void term_vulkan_render(void);
+
+
+// From the input of the frame being sampled to the present being shown, observed at the start of a later frame unless the low latency policy waited on it
+typedef struct {
+    size_t num_presents;
+    microseconds_t total_microseconds;
+    microseconds_t max_microseconds;
+} present_latency_t;
+
+// Only measured when present_wait_enabled
+extern present_latency_t present_latency;
+
+// GPU time of the passes before the upscale pass, which the dynamic resolution scale is adjusted by
+typedef struct {
+    size_t num_frames;
+    microseconds_t total_microseconds;
+    microseconds_t max_microseconds;
+} gpu_scene_time_t;
+
+// Only measured when the device supports timestamps on the graphics queue
+extern gpu_scene_time_t gpu_scene_time;
\ No newline at end of file
@@ -0,0 +1,385 @@
+#include "render_graph.h"
+#include "core.h"
+#include "defaults.h"
+#include "debug.h"
+#include "util.h"
+#include <vk_mem_alloc.h>
+#include <stdalign.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    VkPipelineStageFlags stage_flags;
+    VkAccessFlags access_flags;
+    VkImageLayout layout;
+    // Color attachments are expected to be cleared or fully overwritten, so they never read
+    bool read;
+    bool write;
+} access_info_t;
+
+static const access_info_t access_infos[NUM_RENDER_GRAPH_ACCESSES] = {
+    [render_graph_access_color_attachment] = {
+        .stage_flags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .access_flags = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .read = false,
+        .write = true
+    },
+    [render_graph_access_depth_attachment] = {
+        .stage_flags = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        .access_flags = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        .read = true,
+        .write = true
+    },
+    [render_graph_access_fragment_sampled] = {
+        .stage_flags = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        .access_flags = VK_ACCESS_SHADER_READ_BIT,
+        .layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .read = true,
+        .write = false
+    }
+};
+
+#define WRITE_ACCESS_FLAGS (VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT)
+
+// Memory shared by transient images whose lifetimes do not overlap
+typedef struct {
+    VkMemoryRequirements requirements;
+    VmaAllocation allocation;
+    // Last use of any image placed in it, the first use of the next image has to wait for it
+    VkPipelineStageFlags stage_flags;
+    VkAccessFlags access_flags;
+} alias_block_t;
+
+// Tile based GPUs only commit lazily allocated memory when an attachment actually leaves tile memory, which for transient ones may be never
+static const VmaAllocationCreateInfo lazy_allocation_create_info = {
+    .usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED
+};
+
+static const VmaAllocationCreateInfo transient_allocation_create_info = {
+    .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+};
+
+alignas(64)
+static uint32_t num_resources;
+static render_graph_resource_t* resources;
+static uint32_t num_passes;
+static const render_graph_pass_t* passes;
+static bool live_passes[MAX_RENDER_GRAPH_PASSES];
+
+static uint32_t num_alias_blocks;
+static alias_block_t alias_blocks[MAX_RENDER_GRAPH_RESOURCES];
+static uint32_t resource_alias_blocks[MAX_RENDER_GRAPH_RESOURCES];
+
+// The graph is compiled again on every swapchain resize, the culled passes are only reported the first time
+static bool culled_passes_printed = false;
+
+static void cull_passes(void) {
+    // Walks backwards, so every reader of a resource is known before its writers are visited
+    bool needed_resources[MAX_RENDER_GRAPH_RESOURCES] = { 0 };
+
+    for (uint32_t i = num_passes; i-- > 0;) {
+        const render_graph_pass_t* pass = &passes[i];
+
+        bool live = false;
+        for (uint32_t j = 0; j < pass->num_uses; j++) {
+            const render_graph_use_t* use = &pass->uses[j];
+            if (access_infos[use->access].write && (resources[use->resource].type != render_graph_resource_transient || needed_resources[use->resource])) {
+                live = true;
+            }
+        }
+
+        live_passes[i] = live;
+        if (!live) {
+            if (!culled_passes_printed) {
+                printf("Render graph culled the %s pass\n", pass->name);
+            }
+            continue;
+        }
+
+        for (uint32_t j = 0; j < pass->num_uses; j++) {
+            const render_graph_use_t* use = &pass->uses[j];
+            if (access_infos[use->access].read) {
+                needed_resources[use->resource] = true;
+            }
+        }
+    }
+}
+
+static result_t init_transient_resources(void) {
+    uint32_t first_uses[MAX_RENDER_GRAPH_RESOURCES];
+    uint32_t last_uses[MAX_RENDER_GRAPH_RESOURCES];
+    memset(first_uses, 0xFF, sizeof(first_uses));
+    memset(last_uses, 0xFF, sizeof(last_uses));
+
+    for (uint32_t i = 0; i < num_passes; i++) {
+        if (!live_passes[i]) {
+            continue;
+        }
+        for (uint32_t j = 0; j < passes[i].num_uses; j++) {
+            uint32_t resource_index = passes[i].uses[j].resource;
+            if (first_uses[resource_index] == NULL_UINT32) {
+                first_uses[resource_index] = i;
+            }
+            last_uses[resource_index] = i;
+        }
+    }
+
+    // Images are created without memory first, so their requirements decide the placement
+    uint32_t num_transient_resources = 0;
+    uint32_t transient_resource_indices[MAX_RENDER_GRAPH_RESOURCES];
+    VkMemoryRequirements requirements[MAX_RENDER_GRAPH_RESOURCES];
+    VkDeviceSize num_unaliased_bytes = 0;
+
+    for (uint32_t i = 0; i < num_resources; i++) {
+        render_graph_resource_t* resource = &resources[i];
+        if (resource->type != render_graph_resource_transient || first_uses[i] == NULL_UINT32) {
+            continue;
+        }
+
+        if (vkCreateImage(device, &resource->info, NULL, &resource->image) != VK_SUCCESS) {
+            return result_failure;
+        }
+        SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_IMAGE, resource->image, resource->name);
+
+        vkGetImageMemoryRequirements(device, resource->image, &requirements[i]);
+        num_unaliased_bytes += requirements[i].size;
+
+        // Sorted from largest to smallest, so large images claim the blocks smaller ones then fit in
+        uint32_t insert_index = num_transient_resources++;
+        while (insert_index > 0 && requirements[transient_resource_indices[insert_index - 1]].size < requirements[i].size) {
+            transient_resource_indices[insert_index] = transient_resource_indices[insert_index - 1];
+            insert_index--;
+        }
+        transient_resource_indices[insert_index] = i;
+    }
+
+    for (uint32_t i = 0; i < num_transient_resources; i++) {
+        uint32_t resource_index = transient_resource_indices[i];
+        const VkMemoryRequirements* resource_requirements = &requirements[resource_index];
+
+        uint32_t block_index = num_alias_blocks;
+        for (uint32_t j = 0; j < num_alias_blocks && block_index == num_alias_blocks; j++) {
+            if (!(alias_blocks[j].requirements.memoryTypeBits & resource_requirements->memoryTypeBits)) {
+                continue;
+            }
+
+            bool overlaps = false;
+            for (uint32_t k = 0; k < i; k++) {
+                uint32_t other_index = transient_resource_indices[k];
+                if (resource_alias_blocks[other_index] == j && first_uses[other_index] <= last_uses[resource_index] && first_uses[resource_index] <= last_uses[other_index]) {
+                    overlaps = true;
+                    break;
+                }
+            }
+            if (!overlaps) {
+                block_index = j;
+            }
+        }
+
+        resource_alias_blocks[resource_index] = block_index;
+        if (block_index == num_alias_blocks) {
+            alias_blocks[num_alias_blocks++] = (alias_block_t) {
+                .requirements = *resource_requirements,
+                .stage_flags = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT
+            };
+            continue;
+        }
+
+        VkMemoryRequirements* block_requirements = &alias_blocks[block_index].requirements;
+        block_requirements->size = block_requirements->size > resource_requirements->size ? block_requirements->size : resource_requirements->size;
+        block_requirements->alignment = block_requirements->alignment > resource_requirements->alignment ? block_requirements->alignment : resource_requirements->alignment;
+        block_requirements->memoryTypeBits &= resource_requirements->memoryTypeBits;
+    }
+
+    VkDeviceSize num_aliased_bytes = 0;
+    VkDeviceSize num_lazy_bytes = 0;
+    for (uint32_t i = 0; i < num_alias_blocks; i++) {
+        // Fails without a lazily allocated memory type, or when an image in the block is not a transient attachment
+        if (
+            vmaAllocateMemory(allocator, &alias_blocks[i].requirements, &lazy_allocation_create_info, &alias_blocks[i].allocation, NULL) != VK_SUCCESS &&
+            vmaAllocateMemory(allocator, &alias_blocks[i].requirements, &transient_allocation_create_info, &alias_blocks[i].allocation, NULL) != VK_SUCCESS
+        ) {
+            return result_failure;
+        }
+        num_aliased_bytes += alias_blocks[i].requirements.size;
+
+        VkMemoryPropertyFlags memory_property_flags;
+        vmaGetAllocationMemoryProperties(allocator, alias_blocks[i].allocation, &memory_property_flags);
+        if (memory_property_flags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) {
+            num_lazy_bytes += alias_blocks[i].requirements.size;
+        }
+    }
+
+    for (uint32_t i = 0; i < num_transient_resources; i++) {
+        render_graph_resource_t* resource = &resources[transient_resource_indices[i]];
+
+        if (vmaBindImageMemory2(allocator, alias_blocks[resource_alias_blocks[transient_resource_indices[i]]].allocation, 0, resource->image, NULL) != VK_SUCCESS) {
+            return result_failure;
+        }
+
+        if (vkCreateImageView(device, &(VkImageViewCreateInfo) {
+            DEFAULT_VK_IMAGE_VIEW,
+            .image = resource->image,
+            .format = resource->info.format,
+            .subresourceRange.aspectMask = resource->aspect_mask
+        }, NULL, &resource->view) != VK_SUCCESS) {
+            return result_failure;
+        }
+    }
+
+    printf(
+        "Render graph placed %u transient images in %u allocations, %.1f MiB instead of %.1f MiB, %.1f MiB of it lazily allocated\n",
+        num_transient_resources, num_alias_blocks, (double)num_aliased_bytes/(1024.0*1024.0), (double)num_unaliased_bytes/(1024.0*1024.0), (double)num_lazy_bytes/(1024.0*1024.0)
+    );
+
+    return result_success;
+}
+
+result_t compile_render_graph(uint32_t graph_num_resources, render_graph_resource_t graph_resources[], uint32_t graph_num_passes, const render_graph_pass_t graph_passes[]) {
+    if (graph_num_resources > MAX_RENDER_GRAPH_RESOURCES || graph_num_passes > MAX_RENDER_GRAPH_PASSES) {
+        return result_failure;
+    }
+
+    num_resources = graph_num_resources;
+    resources = graph_resources;
+    num_passes = graph_num_passes;
+    passes = graph_passes;
+
+    for (uint32_t i = 0; i < num_resources; i++) {
+        render_graph_resource_t* resource = &resources[i];
+        if (resource->type == render_graph_resource_transient) {
+            resource->image = VK_NULL_HANDLE;
+            resource->view = VK_NULL_HANDLE;
+        } else if (resource->stage_flags == 0) {
+            // Never used before, imported state survives compiling again
+            resource->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+            resource->stage_flags = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+            resource->access_flags = 0;
+        }
+    }
+
+    cull_passes();
+    culled_passes_printed = true;
+
+    return init_transient_resources();
+}
+
+void execute_render_graph_passes(VkCommandBuffer command_buffer, uint32_t first_pass, uint32_t end_pass, const bool passes_enabled[], const void* context) {
+    // Nothing carries over from the previous frame for these, only the memory of transient images is still waited on
+    for (uint32_t i = 0; first_pass == 0 && i < num_resources; i++) {
+        render_graph_resource_t* resource = &resources[i];
+        if (resource->type == render_graph_resource_transient) {
+            resource->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        } else if (resource->type == render_graph_resource_presented) {
+            // Chains with the image available semaphore, which is waited on at this stage
+            resource->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+            resource->stage_flags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            resource->access_flags = 0;
+        }
+    }
+
+    for (uint32_t i = first_pass; i < end_pass; i++) {
+        if (!live_passes[i] || !passes_enabled[i]) {
+            continue;
+        }
+        const render_graph_pass_t* pass = &passes[i];
+
+        uint32_t num_barriers = 0;
+        VkImageMemoryBarrier barriers[MAX_RENDER_GRAPH_PASS_USES];
+        VkPipelineStageFlags src_stage_flags = 0;
+        VkPipelineStageFlags dst_stage_flags = 0;
+
+        for (uint32_t j = 0; j < pass->num_uses; j++) {
+            const render_graph_use_t* use = &pass->uses[j];
+            const access_info_t* info = &access_infos[use->access];
+            render_graph_resource_t* resource = &resources[use->resource];
+
+            // Transient images wait on their memory, which an aliased image before them may have used last
+            bool transient = resource->type == render_graph_resource_transient;
+            VkPipelineStageFlags* stage_flags = transient ? &alias_blocks[resource_alias_blocks[use->resource]].stage_flags : &resource->stage_flags;
+            VkAccessFlags* access_flags = transient ? &alias_blocks[resource_alias_blocks[use->resource]].access_flags : &resource->access_flags;
+
+            // Reads after reads need no barrier, their stages are added so the next write waits on all of them
+            if (resource->layout == info->layout && !info->write && !(*access_flags & WRITE_ACCESS_FLAGS)) {
+                *stage_flags |= info->stage_flags;
+                *access_flags |= info->access_flags;
+                continue;
+            }
+
+            barriers[num_barriers++] = (VkImageMemoryBarrier) {
+                DEFAULT_VK_IMAGE_MEMORY_BARRIER,
+                .image = resource->image,
+                .subresourceRange.aspectMask = resource->aspect_mask,
+                .oldLayout = resource->layout,
+                .newLayout = info->layout,
+                .srcAccessMask = *access_flags & WRITE_ACCESS_FLAGS,
+                .dstAccessMask = info->access_flags
+            };
+            src_stage_flags |= *stage_flags;
+            dst_stage_flags |= info->stage_flags;
+
+            resource->layout = info->layout;
+            *stage_flags = info->stage_flags;
+            *access_flags = info->access_flags;
+        }
+
+        if (num_barriers > 0) {
+            vkCmdPipelineBarrier(command_buffer, src_stage_flags, dst_stage_flags, 0, 0, NULL, 0, NULL, num_barriers, barriers);
+        }
+
+        pass->record(command_buffer, context);
+    }
+
+    // Presentation waits on the render finished semaphore, so no destination stage is needed
+    for (uint32_t i = 0; end_pass == num_passes && i < num_resources; i++) {
+        render_graph_resource_t* resource = &resources[i];
+        if (resource->type != render_graph_resource_presented) {
+            continue;
+        }
+
+        vkCmdPipelineBarrier(command_buffer, resource->stage_flags, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &(VkImageMemoryBarrier) {
+            DEFAULT_VK_IMAGE_MEMORY_BARRIER,
+            .image = resource->image,
+            .subresourceRange.aspectMask = resource->aspect_mask,
+            .oldLayout = resource->layout,
+            .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+            .srcAccessMask = resource->access_flags & WRITE_ACCESS_FLAGS
+        });
+        resource->layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    }
+}
+
+void retire_render_graph(render_graph_transients_t* transients) {
+    transients->num_images = 0;
+    for (uint32_t i = 0; i < num_resources; i++) {
+        render_graph_resource_t* resource = &resources[i];
+        if (resource->type != render_graph_resource_transient) {
+            continue;
+        }
+
+        transients->images[transients->num_images] = resource->image;
+        transients->views[transients->num_images] = resource->view;
+        transients->num_images++;
+        resource->image = VK_NULL_HANDLE;
+        resource->view = VK_NULL_HANDLE;
+    }
+
+    for (uint32_t i = 0; i < num_alias_blocks; i++) {
+        transients->allocations[i] = alias_blocks[i].allocation;
+    }
+    transients->num_allocations = num_alias_blocks;
+    num_alias_blocks = 0;
+}
+
+void destroy_render_graph_transients(const render_graph_transients_t* transients) {
+    for (uint32_t i = 0; i < transients->num_images; i++) {
+        vkDestroyImageView(device, transients->views[i], NULL);
+        vkDestroyImage(device, transients->images[i], NULL);
+    }
+
+    for (uint32_t i = 0; i < transients->num_allocations; i++) {
+        vmaFreeMemory(allocator, transients->allocations[i]);
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vk_mem_alloc.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "result.h"
+
+#define MAX_RENDER_GRAPH_RESOURCES 16
+#define MAX_RENDER_GRAPH_PASSES 16
+#define MAX_RENDER_GRAPH_PASS_USES 8
+
+typedef enum {
+    // Created by the graph when compiled, contents only live within a frame, so images with disjoint lifetimes share memory
+    render_graph_resource_transient,
+    // Owned elsewhere, contents and layout persist between frames
+    render_graph_resource_imported,
+    // Swapchain image, set before every execute and transitioned for presentation after its last use
+    render_graph_resource_presented
+} render_graph_resource_type_t;
+
+typedef struct {
+    const char* name;
+    render_graph_resource_type_t type;
+    VkImageAspectFlags aspect_mask;
+    // Transient only, describes the image the graph creates
+    VkImageCreateInfo info;
+
+    // Created by the graph for transient resources, set by the owner otherwise
+    VkImage image;
+    VkImageView view;
+
+    // Maintained by the graph, the state after the last recorded use
+    VkImageLayout layout;
+    VkPipelineStageFlags stage_flags;
+    VkAccessFlags access_flags;
+} render_graph_resource_t;
+
+typedef enum {
+    render_graph_access_color_attachment,
+    render_graph_access_depth_attachment,
+    render_graph_access_fragment_sampled,
+    NUM_RENDER_GRAPH_ACCESSES
+} render_graph_access_t;
+
+typedef struct {
+    uint32_t resource;
+    render_graph_access_t access;
+} render_graph_use_t;
+
+// The record function begins and ends its own rendering, every use has its layout when it is called
+typedef struct {
+    const char* name;
+    uint32_t num_uses;
+    render_graph_use_t uses[MAX_RENDER_GRAPH_PASS_USES];
+    void (*record)(VkCommandBuffer command_buffer, const void* context);
+} render_graph_pass_t;
+
+// Passes run in the given order, ones that neither write an imported or presented resource nor feed a pass that does are culled
+// Both arrays have to outlive the graph, compiling again after retire_render_graph picks up new transient image infos
+result_t compile_render_graph(uint32_t num_resources, render_graph_resource_t resources[], uint32_t num_passes, const render_graph_pass_t passes[]);
+// Records passes [first_pass, end_pass), a frame's ranges are recorded in order and submitted in the same order
+// Disabled passes are skipped for this frame only, imported resources keep the contents of their last write
+// Presented resources are transitioned at the end of the last range, so earlier ranges can be submitted without waiting for the swapchain image
+void execute_render_graph_passes(VkCommandBuffer command_buffer, uint32_t first_pass, uint32_t end_pass, const bool passes_enabled[], const void* context);
+// Transient images and memory of a compiled graph, owned by the caller after retire_render_graph
+typedef struct {
+    uint32_t num_images;
+    VkImage images[MAX_RENDER_GRAPH_RESOURCES];
+    VkImageView views[MAX_RENDER_GRAPH_RESOURCES];
+    uint32_t num_allocations;
+    VmaAllocation allocations[MAX_RENDER_GRAPH_RESOURCES];
+} render_graph_transients_t;
+
+// Hands the transient resources over instead of destroying them, so the graph can be compiled again while frames in flight still use them
+void retire_render_graph(render_graph_transients_t* transients);
+// The device must not be using the transient resources anymore
+void destroy_render_graph_transients(const render_graph_transients_t* transients);
@@ -0,0 +1,56 @@
+#include "render_scale.h"
+#include "util.h"
+#include <math.h>
+#include <stdio.h>
+
+#define MIN_RENDER_SCALE 0.5f
+#define MAX_RENDER_SCALE 1.0f
+
+// Single frame times are too noisy to react to, the average of roughly the last 10 frames is used instead
+#define GPU_TIME_SMOOTHING 0.1f
+// The scale only moves when the average is this far off the budget, so the resolution does not change every frame
+#define BUDGET_TOLERANCE 0.1f
+// Fraction of the way to the target scale taken per frame
+#define SCALE_RESPONSE 0.25f
+
+float render_scale = 1.0f;
+VkExtent2D render_extent;
+
+static bool scale_dynamic = false;
+static float budget_milliseconds;
+static float average_gpu_milliseconds = 0.0f;
+
+void init_render_scale(bool dynamic_resolution_enabled, float gpu_budget_milliseconds) {
+    scale_dynamic = dynamic_resolution_enabled;
+    budget_milliseconds = gpu_budget_milliseconds;
+    render_scale = 1.0f;
+
+    if (scale_dynamic) {
+        printf("Dynamic resolution targeting %.2fms of GPU time per frame\n", (double)budget_milliseconds);
+    } else {
+        printf("Dynamic resolution disabled\n");
+    }
+}
+
+void update_render_scale(float gpu_milliseconds) {
+    if (!scale_dynamic) {
+        return;
+    }
+
+    average_gpu_milliseconds = average_gpu_milliseconds == 0.0f ? gpu_milliseconds : average_gpu_milliseconds + (gpu_milliseconds - average_gpu_milliseconds)*GPU_TIME_SMOOTHING;
+    if (fabsf(average_gpu_milliseconds - budget_milliseconds) < budget_milliseconds*BUDGET_TOLERANCE) {
+        return;
+    }
+
+    // GPU time grows with the pixel count, which is the square of the scale
+    float target_scale = render_scale*sqrtf(budget_milliseconds/average_gpu_milliseconds);
+    render_scale += (target_scale - render_scale)*SCALE_RESPONSE;
+    render_scale = fminf(fmaxf(render_scale, MIN_RENDER_SCALE), MAX_RENDER_SCALE);
+}
+
+void update_render_extent(VkExtent2D swap_image_extent) {
+    render_extent = (VkExtent2D) {
+        clamp_uint32((uint32_t)lroundf((float)swap_image_extent.width*render_scale), 1, swap_image_extent.width),
+        clamp_uint32((uint32_t)lroundf((float)swap_image_extent.height*render_scale), 1, swap_image_extent.height)
+    };
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdbool.h>
+
+// Fraction of the swapchain extent the scene is rendered at, per axis
+extern float render_scale;
+// Scene passes render into the top left of their full size attachments, so changing the scale never recreates anything
+extern VkExtent2D render_extent;
+
+// Without dynamic resolution the scale stays at 1
+void init_render_scale(bool dynamic_resolution_enabled, float gpu_budget_milliseconds);
+// Called once per finished frame with the GPU time of its scene passes
+void update_render_scale(float gpu_milliseconds);
+// Derives render_extent from render_scale, called before recording a frame
+void update_render_extent(VkExtent2D swap_image_extent);
@@ -0,0 +1,55 @@
+#include "shader.h"
+#include "util.h"
+#include <string.h>
+#include <stdalign.h>
+
+const char* shader_override_dir = NULL;
+
+alignas(64) static const uint32_t color_pipeline_vertex_code[] =
+#include "color_pipeline_vertex.spv.inc"
+;
+
+alignas(64) static const uint32_t color_pipeline_fragment_code[] =
+#include "color_pipeline_fragment.spv.inc"
+;
+
+alignas(64) static const uint32_t depth_prepass_pipeline_vertex_code[] =
+#include "depth_prepass_pipeline_vertex.spv.inc"
+;
+
+alignas(64) static const uint32_t shadow_pipeline_vertex_code[] =
+#include "shadow_pipeline_vertex.spv.inc"
+;
+
+alignas(64) static const uint32_t upscale_pipeline_vertex_code[] =
+#include "upscale_pipeline_vertex.spv.inc"
+;
+
+alignas(64) static const uint32_t upscale_pipeline_fragment_code[] =
+#include "upscale_pipeline_fragment.spv.inc"
+;
+
+alignas(64) static const uint32_t light_cluster_pipeline_compute_code[] =
+#include "light_cluster_pipeline_compute.spv.inc"
+;
+
+#define SHADER_CODE(NAME) { #NAME, sizeof(NAME##_code), NAME##_code }
+
+static const shader_code_t shader_codes[] = {
+    SHADER_CODE(color_pipeline_vertex),
+    SHADER_CODE(color_pipeline_fragment),
+    SHADER_CODE(depth_prepass_pipeline_vertex),
+    SHADER_CODE(shadow_pipeline_vertex),
+    SHADER_CODE(upscale_pipeline_vertex),
+    SHADER_CODE(upscale_pipeline_fragment),
+    SHADER_CODE(light_cluster_pipeline_compute)
+};
+
+const shader_code_t* get_embedded_shader_code(const char* name) {
+    for (size_t i = 0; i < NUM_ELEMS(shader_codes); i++) {
+        if (strcmp(shader_codes[i].name, name) == 0) {
+            return &shader_codes[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    const char* name;
+    size_t num_bytes;
+    const uint32_t* code;
+} shader_code_t;
+
+// When set, <dir>/<name>.spv takes precedence over the embedded code, from SHADER_OVERRIDE_DIR or the hot reload output
+extern const char* shader_override_dir;
+
+// SPIR-V compiled from shader/ by the build, looked up by the shader file name without its extension
+const shader_code_t* get_embedded_shader_code(const char* name);
@@ -0,0 +1,228 @@
+#define _GNU_SOURCE
+#include "shader_reload.h"
+
+#ifdef SHADER_HOT_RELOAD
+#include "shader.h"
+#include "gfx_pipeline.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <stdalign.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <poll.h>
+#include <dirent.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+typedef struct {
+    const char* name;
+    graphics_pipeline_t pipeline;
+} shader_pipeline_t;
+
+static const shader_pipeline_t shader_pipelines[] = {
+    { "color_pipeline_vertex", color_graphics_pipeline },
+    { "color_pipeline_fragment", color_graphics_pipeline },
+    { "depth_prepass_pipeline_vertex", color_graphics_pipeline },
+    { "shadow_pipeline_vertex", shadow_graphics_pipeline },
+    { "upscale_pipeline_vertex", upscale_graphics_pipeline },
+    { "upscale_pipeline_fragment", upscale_graphics_pipeline },
+    { "light_cluster_pipeline_compute", light_cluster_compute_pipeline }
+};
+
+alignas(64)
+static atomic_uint_least32_t pending_reloads = 0;
+static int inotify_fd = -1;
+static int stop_pipe[2] = { -1, -1 };
+static pthread_t watch_thread;
+static bool watch_thread_started = false;
+
+static void clear_reload_dir(void) {
+    DIR* dir = opendir(SHADER_RELOAD_DIR);
+    if (dir == NULL) {
+        return;
+    }
+
+    // Output of a previous session may be older than the code embedded by the last build
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t num_chars = strlen(entry->d_name);
+        if (num_chars > 4 && strcmp(entry->d_name + num_chars - 4, ".spv") == 0) {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s", SHADER_RELOAD_DIR, entry->d_name);
+            unlink(path);
+        }
+    }
+    closedir(dir);
+}
+
+static bool compile_shader(const char* file_name, const char* name) {
+    char source_path[4096];
+    snprintf(source_path, sizeof(source_path), "%s/%s", SHADER_SOURCE_DIR, file_name);
+    char output_path[4096];
+    snprintf(output_path, sizeof(output_path), "%s/%s.spv", SHADER_RELOAD_DIR, name);
+
+    char* argv[] = { GLSLC_PATH, GLSLC_TARGET_ENV, source_path, "-o", output_path, NULL };
+
+    pid_t pid;
+    if (posix_spawn(&pid, GLSLC_PATH, NULL, NULL, argv, environ) != 0) {
+        return false;
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool is_shader_stage(const char* extension) {
+    return strcmp(extension, ".vert") == 0 || strcmp(extension, ".frag") == 0 || strcmp(extension, ".comp") == 0;
+}
+
+static void handle_shader_change(const char* file_name) {
+    const char* extension = strrchr(file_name, '.');
+    if (extension == NULL || !is_shader_stage(extension)) {
+        return;
+    }
+
+    char name[256];
+    size_t num_name_chars = (size_t)(extension - file_name);
+    if (num_name_chars >= sizeof(name)) {
+        return;
+    }
+    memcpy(name, file_name, num_name_chars);
+    name[num_name_chars] = '\0';
+
+    // glslc prints its own diagnostics, the previous pipeline stays in use when compilation fails
+    if (!compile_shader(file_name, name)) {
+        printf("Failed to recompile %s\n", file_name);
+        return;
+    }
+
+    uint32_t pipeline_mask = 0;
+    for (size_t i = 0; i < NUM_ELEMS(shader_pipelines); i++) {
+        if (strcmp(shader_pipelines[i].name, name) == 0) {
+            pipeline_mask |= 1u << shader_pipelines[i].pipeline;
+        }
+    }
+
+    printf("Recompiled %s\n", file_name);
+    atomic_fetch_or(&pending_reloads, pipeline_mask);
+}
+
+// Includes do not track who includes them, so every shader is recompiled and the unaffected ones reload unchanged
+static void handle_include_change(void) {
+    DIR* dir = opendir(SHADER_SOURCE_DIR);
+    if (dir == NULL) {
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char* extension = strrchr(entry->d_name, '.');
+        if (extension != NULL && is_shader_stage(extension)) {
+            handle_shader_change(entry->d_name);
+        }
+    }
+    closedir(dir);
+}
+
+static void* run_watch_thread(void*) {
+    alignas(struct inotify_event) char events[4096];
+
+    for (;;) {
+        struct pollfd poll_fds[2] = {
+            { .fd = inotify_fd, .events = POLLIN },
+            { .fd = stop_pipe[0], .events = POLLIN }
+        };
+        if (poll(poll_fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (poll_fds[1].revents != 0) {
+            break;
+        }
+
+        ssize_t num_bytes = read(inotify_fd, events, sizeof(events));
+        if (num_bytes <= 0) {
+            continue;
+        }
+
+        for (char* cur = events; cur < events + num_bytes;) {
+            const struct inotify_event* event = (const struct inotify_event*)cur;
+            if (event->len > 0) {
+                const char* extension = strrchr(event->name, '.');
+                if (extension != NULL && strcmp(extension, ".glsl") == 0) {
+                    handle_include_change();
+                } else {
+                    handle_shader_change(event->name);
+                }
+            }
+            cur += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return NULL;
+}
+
+const char* init_vulkan_shader_reload(void) {
+    if (mkdir(SHADER_RELOAD_DIR, 0755) != 0 && errno != EEXIST) {
+        return "Failed to create shader reload directory\n";
+    }
+    clear_reload_dir();
+
+    // Editors either write in place or rename a temporary file over the original
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0 || inotify_add_watch(inotify_fd, SHADER_SOURCE_DIR, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        return "Failed to watch shader directory\n";
+    }
+
+    if (pipe2(stop_pipe, O_CLOEXEC) != 0) {
+        return "Failed to create shader reload pipe\n";
+    }
+
+    if (pthread_create(&watch_thread, NULL, run_watch_thread, NULL) != 0) {
+        return "Failed to start shader reload thread\n";
+    }
+    watch_thread_started = true;
+
+    shader_override_dir = SHADER_RELOAD_DIR;
+    printf("Watching %s for shader changes\n", SHADER_SOURCE_DIR);
+
+    return NULL;
+}
+
+uint32_t take_pending_shader_reloads(void) {
+    return atomic_exchange(&pending_reloads, 0);
+}
+
+void term_vulkan_shader_reload(void) {
+    if (watch_thread_started) {
+        ssize_t num_written = write(stop_pipe[1], "", 1);
+        (void)num_written;
+        pthread_join(watch_thread, NULL);
+    }
+
+    for (size_t i = 0; i < 2; i++) {
+        if (stop_pipe[i] >= 0) {
+            close(stop_pipe[i]);
+        }
+    }
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+    }
+}
+#endif
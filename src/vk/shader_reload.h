@@ -0,0 +1,10 @@
+#pragma once
+#include <stdint.h>
+
+#ifdef SHADER_HOT_RELOAD
+// Watches the shader sources and recompiles changed ones into the shader override directory on a background thread
+const char* init_vulkan_shader_reload(void);
+// Bit mask of graphics_pipeline_t whose shaders were recompiled since the last call, to be recreated at a frame boundary
+uint32_t take_pending_shader_reloads(void);
+void term_vulkan_shader_reload(void);
+#endif
@@ -5,6 +5,8 @@
 #include "util.h"
 #include "mesh.h"
 #include "defaults.h"
+#include "pipeline_cache.h"
+#include "debug.h"
 #include <vk_mem_alloc.h>
 #include <stdalign.h>
 #include <cglm/struct/mat4.h>
@@ -22,9 +24,47 @@ static VkPipeline pipeline;
 
 #define SHADOW_IMAGE_SIZE 4096
 
-static VkImage shadow_image;
+VkImage shadow_image;
 static VmaAllocation shadow_image_allocation;
 VkImageView shadow_image_view;
+static VkFramebuffer shadow_image_framebuffer;
+
+static const char* init_shadow_pipeline_descriptors(void) {
+    if (create_descriptor_set(
+        &(VkDescriptorSetLayoutCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .bindingCount = 1,
+            .pBindings = &(VkDescriptorSetLayoutBinding) {
+                DEFAULT_VK_DESCRIPTOR_BINDING,
+                .binding = 0,
+                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                .stageFlags = VK_SHADER_STAGE_VERTEX_BIT
+            }
+        },
+        
+        &(descriptor_info_t) {
+            .type = descriptor_info_type_buffer,
+            .buffer = {
+                .buffer = shadow_view_projection_buffer,
+                .offset = 0,
+                .range = sizeof(shadow_view_projection)
+            }
+        },
+
+        &descriptor_set_layout, &descriptor_pool, &descriptor_set
+    ) != result_success) {
+        return "Failed to create descriptor set\n";
+    }
+
+    if (vkCreatePipelineLayout(device, &(VkPipelineLayoutCreateInfo) {
+        DEFAULT_VK_PIPELINE_LAYOUT,
+        .pSetLayouts = &descriptor_set_layout
+    }, NULL, &pipeline_layout) != VK_SUCCESS) {
+        return "Failed to create pipeline layout\n";
+    }
+
+    return NULL;
+}
 
 const char* init_shadow_pipeline(void) {
     if (vmaCreateImage(allocator, &(VkImageCreateInfo) {
@@ -36,16 +76,22 @@ const char* init_shadow_pipeline(void) {
     }, &device_allocation_create_info, &shadow_image, &shadow_image_allocation, NULL) != VK_SUCCESS) {
         return "Failed to create shadow image\n";
     }
+    SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_IMAGE, shadow_image, "Shadow image");
 
     if (vkCreateImageView(device, &(VkImageViewCreateInfo) {
         DEFAULT_VK_IMAGE_VIEW,
         .image = shadow_image,
         .format = depth_image_format,
-        .subresourceRange.aspectMask = (depth_image_format == VK_FORMAT_D32_SFLOAT_S8_UINT || depth_image_format == VK_FORMAT_D24_UNORM_S8_UINT) ? VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT : VK_IMAGE_ASPECT_DEPTH_BIT
+        .subresourceRange.aspectMask = depth_image_aspect_flags
     }, NULL, &shadow_image_view) != VK_SUCCESS) {
         return "Failed to create shadow image view\n";
     }
 
+    // Dynamic rendering needs neither the render pass nor the framebuffer
+    if (dynamic_rendering_enabled) {
+        return init_shadow_pipeline_descriptors();
+    }
+
     if (vkCreateRenderPass(device, &(VkRenderPassCreateInfo) {
         DEFAULT_VK_RENDER_PASS,
 
@@ -55,7 +101,9 @@ const char* init_shadow_pipeline(void) {
             .format = depth_image_format,
             .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
             .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-            .finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+            // The frame graph transitions the shadow image around the pass
+            .initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
         },
 
         .pSubpasses = &(VkSubpassDescription) {
@@ -68,46 +116,31 @@ const char* init_shadow_pipeline(void) {
     }, NULL, &render_pass) != VK_SUCCESS) {
         return "Failed to create render pass\n";
     }
+    SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_RENDER_PASS, render_pass, "Shadow render pass");
 
-    if (create_descriptor_set(
-        &(VkDescriptorSetLayoutCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-            .bindingCount = 1,
-            .pBindings = &(VkDescriptorSetLayoutBinding) {
-                DEFAULT_VK_DESCRIPTOR_BINDING,
-                .binding = 0,
-                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                .stageFlags = VK_SHADER_STAGE_VERTEX_BIT
-            }
-        },
-        
-        &(descriptor_info_t) {
-            .type = descriptor_info_type_buffer,
-            .buffer = {
-                .buffer = shadow_view_projection_buffer,
-                .offset = 0,
-                .range = sizeof(shadow_view_projection)
-            }
-        },
-
-        &descriptor_set_layout, &descriptor_pool, &descriptor_set
-    ) != result_success) {
-        return "Failed to create descriptor set\n";
+    if (vkCreateFramebuffer(device, &(VkFramebufferCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+        .renderPass = render_pass,
+        .attachmentCount = 1,
+        .pAttachments = &shadow_image_view,
+        .width = SHADOW_IMAGE_SIZE,
+        .height = SHADOW_IMAGE_SIZE,
+        .layers = 1
+    }, NULL, &shadow_image_framebuffer) != VK_SUCCESS) {
+        return "Failed to create shadow image framebuffer\n";
     }
 
-    if (vkCreatePipelineLayout(device, &(VkPipelineLayoutCreateInfo) {
-        DEFAULT_VK_PIPELINE_LAYOUT,
-        .pSetLayouts = &descriptor_set_layout
-    }, NULL, &pipeline_layout) != VK_SUCCESS) {
-        return "Failed to create pipeline layout\n";
-    }
+    return init_shadow_pipeline_descriptors();
+}
 
+// Runs on a pipeline job thread, everything it uses was created by init_shadow_pipeline
+const char* create_shadow_pipeline(void) {
     VkShaderModule vertex_shader_module;
-    if (create_shader_module("shader/shadow_pipeline_vertex.spv", &vertex_shader_module) != result_success) {
+    if (create_shader_module("shadow_pipeline_vertex", &vertex_shader_module) != result_success) {
         return "Failed to create vertex shader module\n";
     }
 
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &(VkGraphicsPipelineCreateInfo) {
+    VkResult result = vkCreateGraphicsPipelines(device, pipeline_cache, 1, &(VkGraphicsPipelineCreateInfo) {
         DEFAULT_VK_GRAPHICS_PIPELINE,
 
         .stageCount = 1,
@@ -124,7 +157,7 @@ const char* init_shadow_pipeline(void) {
             .pVertexBindingDescriptions = (VkVertexInputBindingDescription[2]) {
                 {
                     .binding = 0,
-                    .stride = sizeof(mat4s),
+                    .stride = sizeof(instance_t),
                     .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE
                 },
                 {
@@ -134,36 +167,25 @@ const char* init_shadow_pipeline(void) {
                 }
             },
 
-            .vertexAttributeDescriptionCount = 5,
-            .pVertexAttributeDescriptions = (VkVertexInputAttributeDescription[5]) {
+            .vertexAttributeDescriptionCount = 3,
+            .pVertexAttributeDescriptions = (VkVertexInputAttributeDescription[3]) {
+                // Position and scale together
                 {
                     .binding = 0,
                     .location = 0,
                     .format = VK_FORMAT_R32G32B32A32_SFLOAT,
-                    .offset = 0*sizeof(vec4s)
+                    .offset = offsetof(instance_t, position)
                 },
                 {
                     .binding = 0,
                     .location = 1,
-                    .format = VK_FORMAT_R32G32B32A32_SFLOAT,
-                    .offset = 1*sizeof(vec4s)
-                },
-                {
-                    .binding = 0,
-                    .location = 2,
-                    .format = VK_FORMAT_R32G32B32A32_SFLOAT,
-                    .offset = 2*sizeof(vec4s)
-                },
-                {
-                    .binding = 0,
-                    .location = 3,
-                    .format = VK_FORMAT_R32G32B32A32_SFLOAT,
-                    .offset = 3*sizeof(vec4s)
+                    .format = VK_FORMAT_R16G16B16A16_SFLOAT,
+                    .offset = offsetof(instance_t, rotation)
                 },
                 //
                 {
                     .binding = 1,
-                    .location = 4,
+                    .location = 2,
                     .format = VK_FORMAT_R32G32B32_SFLOAT,
                     .offset = offsetof(general_pipeline_vertex_t, position)
                 }
@@ -179,86 +201,74 @@ const char* init_shadow_pipeline(void) {
         .pMultisampleState = &(VkPipelineMultisampleStateCreateInfo) { DEFAULT_VK_MULTISAMPLE },
         .pColorBlendState = NULL,
         .layout = pipeline_layout,
-        .renderPass = render_pass
-    }, NULL, &pipeline) != VK_SUCCESS) {
-        return "Failed to create graphics pipeline\n";
-    }
+        .renderPass = render_pass,
+        .pNext = dynamic_rendering_enabled ? &(VkPipelineRenderingCreateInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR,
+            .depthAttachmentFormat = depth_image_format
+        } : NULL
+    }, NULL, &pipeline);
 
     vkDestroyShaderModule(device, vertex_shader_module, NULL);
 
+    if (result != VK_SUCCESS) {
+        return "Failed to create graphics pipeline\n";
+    }
+    SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_PIPELINE, pipeline, "Shadow pipeline");
+
     return NULL;
 }
 
-const char* draw_shadow_pipeline(void) {
-    VkFence render_fence;
-    if (vkCreateFence(device, &(VkFenceCreateInfo) {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO
-    }, NULL, &render_fence) != VK_SUCCESS) {
-        return "Failed to create render fence\n";
-    }
+// Keeps the current pipeline when the new one fails, so a broken shader edit does not stop the app
+const char* recreate_shadow_pipeline(void) {
+    VkPipeline old_pipeline = pipeline;
 
-    VkCommandBuffer command_buffer;
-    if (vkAllocateCommandBuffers(device, &(VkCommandBufferAllocateInfo) {
-        DEFAULT_VK_COMMAND_BUFFER,
-        .commandPool = command_pool
-    }, &command_buffer) != VK_SUCCESS) {
-        return "Failed to create command buffer\n";
+    const char* msg = create_shadow_pipeline();
+    if (msg != NULL) {
+        pipeline = old_pipeline;
+        return msg;
     }
 
-    if (vkBeginCommandBuffer(command_buffer, &(VkCommandBufferBeginInfo) {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
-    }) != VK_SUCCESS) {
-        return "Failed to write to command buffer\n";
-    }
+    vkDestroyPipeline(device, old_pipeline, NULL);
+    return NULL;
+}
 
-    VkFramebuffer framebuffer;
-    if (vkCreateFramebuffer(device, &(VkFramebufferCreateInfo) {
-        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-        .renderPass = render_pass,
-        .attachmentCount = 1,
-        .pAttachments = &shadow_image_view,
-        .width = SHADOW_IMAGE_SIZE,
-        .height = SHADOW_IMAGE_SIZE,
-        .layers = 1
-    }, NULL, &framebuffer) != VK_SUCCESS) {
-        return "Failed to create shadow image framebuffer\n";
+void draw_shadow_pipeline(VkCommandBuffer command_buffer) {
+    if (dynamic_rendering_enabled) {
+        begin_rendering_pipeline(command_buffer, &(VkRenderingInfoKHR) {
+            DEFAULT_VK_RENDERING,
+            .renderArea.extent = { .width = SHADOW_IMAGE_SIZE, .height = SHADOW_IMAGE_SIZE },
+            .pDepthAttachment = &(VkRenderingAttachmentInfoKHR) {
+                DEFAULT_VK_RENDERING_ATTACHMENT,
+                .imageView = shadow_image_view,
+                .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                .clearValue = { .depthStencil = { .depth = 1.0f, .stencil = 0 } }
+            }
+        }, descriptor_set, pipeline_layout, pipeline);
+    } else {
+        begin_pipeline(
+            command_buffer,
+            shadow_image_framebuffer, (VkExtent2D) { .width = SHADOW_IMAGE_SIZE, .height = SHADOW_IMAGE_SIZE },
+            1, &(VkClearValue) { .depthStencil = { .depth = 1.0f, .stencil = 0 } },
+            render_pass, descriptor_set, pipeline_layout, pipeline
+        );
     }
 
-    begin_pipeline(
-        command_buffer,
-        framebuffer, (VkExtent2D) { .width = SHADOW_IMAGE_SIZE, .height = SHADOW_IMAGE_SIZE },
-        1, &(VkClearValue) { .depthStencil = { .depth = 1.0f, .stencil = 0 } },
-        render_pass, descriptor_set, pipeline_layout, pipeline
-    );
-
     for (size_t i = 0; i < NUM_MODELS; i++) {
         bind_vertex_buffers(command_buffer, 2, (VkBuffer[2]) {
-            instance_buffers[i],
+            instance_buffer,
             vertex_buffer_arrays[i][GENERAL_PIPELINE_VERTEX_ARRAY_INDEX]
         });
         vkCmdBindIndexBuffer(command_buffer, index_buffers[i], 0, VK_INDEX_TYPE_UINT16);
-        vkCmdDrawIndexed(command_buffer, num_indices_array[i], num_instances_array[i], 0, 0, 0);
+        vkCmdDrawIndexed(command_buffer, num_indices_array[i], num_instances_array[i], 0, 0, first_instances_array[i]);
     }
 
-    end_pipeline(command_buffer);
-
-    if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
-        return "Failed to write to transfer command buffer\n";
+    if (dynamic_rendering_enabled) {
+        end_rendering_pipeline(command_buffer);
+    } else {
+        end_pipeline(command_buffer);
     }
-
-    vkQueueSubmit(graphics_queue, 1, &(VkSubmitInfo) {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &command_buffer
-    }, render_fence);
-    vkWaitForFences(device, 1, &render_fence, VK_TRUE, UINT64_MAX);
-
-    vkDestroyFence(device, render_fence, NULL);
-
-    vkDestroyFramebuffer(device, framebuffer, NULL);
-
-    return NULL;
 }
 
 void term_shadow_pipeline(void) {
@@ -268,7 +278,7 @@ void term_shadow_pipeline(void) {
     vkDestroyDescriptorPool(device, descriptor_pool, NULL);
     vkDestroyDescriptorSetLayout(device, descriptor_set_layout, NULL);
 
-
+    vkDestroyFramebuffer(device, shadow_image_framebuffer, NULL);
     vkDestroyImageView(device, shadow_image_view, NULL);
     vmaDestroyImage(allocator, shadow_image, shadow_image_allocation);
 }
\ No newline at end of file
@@ -1,8 +1,11 @@
 #pragma once
 #include <vulkan/vulkan.h>
 
+extern VkImage shadow_image;
 extern VkImageView shadow_image_view;
 
 const char* init_shadow_pipeline(void);
-const char* draw_shadow_pipeline(void);
+const char* create_shadow_pipeline(void);
+const char* recreate_shadow_pipeline(void);
+void draw_shadow_pipeline(VkCommandBuffer command_buffer);
 void term_shadow_pipeline(void);
\ No newline at end of file
@@ -0,0 +1,360 @@
+#include "upload.h"
+#include "core.h"
+#include "defaults.h"
+#include "debug.h"
+#include <vk_mem_alloc.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+// Enough batches to keep recording while earlier uploads are still in flight on the transfer queue
+#define NUM_UPLOAD_BATCHES 4
+#define STAGING_RING_SIZE (64ul << 20)
+
+typedef struct {
+    VkBuffer buffer;
+    VmaAllocation allocation;
+} staging_t;
+
+typedef struct {
+    VkBuffer src_buffer;
+    VkBuffer dst_buffer;
+    VkBufferCopy region;
+} buffer_copy_t;
+
+typedef struct {
+    VkCommandPool command_pool;
+    VkCommandBuffer command_buffer;
+    VkFence fence;
+    upload_id_t upload_id;
+    bool pending;
+    // Everything before this ring position is free once the batch retires
+    VkDeviceSize ring_end;
+    size_t num_stagings;
+    size_t max_num_stagings;
+    staging_t* stagings;
+    size_t num_copies;
+    size_t max_num_copies;
+    buffer_copy_t* copies;
+} upload_batch_t;
+
+alignas(64)
+static upload_batch_t batches[NUM_UPLOAD_BATCHES];
+static size_t batch_index = 0;
+static upload_id_t next_upload_id = 1;
+static upload_id_t completed_upload_id = 0;
+
+// Ring positions only ever increase, the offset into the buffer is the position modulo the ring size
+static VkBuffer staging_ring_buffer;
+static VmaAllocation staging_ring_allocation;
+static void* staging_ring_data;
+static VkDeviceSize staging_ring_head = 0;
+static VkDeviceSize staging_ring_tail = 0;
+
+const char* init_vulkan_uploads(void) {
+    VmaAllocationCreateInfo staging_ring_allocation_create_info = staging_allocation_create_info;
+    staging_ring_allocation_create_info.flags |= VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VmaAllocationInfo staging_ring_allocation_info;
+    if (vmaCreateBuffer(allocator, &(VkBufferCreateInfo) {
+        DEFAULT_VK_STAGING_BUFFER,
+        .size = STAGING_RING_SIZE
+    }, &staging_ring_allocation_create_info, &staging_ring_buffer, &staging_ring_allocation, &staging_ring_allocation_info) != VK_SUCCESS) {
+        return "Failed to create staging ring buffer\n";
+    }
+    staging_ring_data = staging_ring_allocation_info.pMappedData;
+    SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_BUFFER, staging_ring_buffer, "Staging ring");
+
+    for (size_t i = 0; i < NUM_UPLOAD_BATCHES; i++) {
+        upload_batch_t* batch = &batches[i];
+
+        if (vkCreateCommandPool(device, &(VkCommandPoolCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = queue_family_indices.transfer
+        }, NULL, &batch->command_pool) != VK_SUCCESS) {
+            return "Failed to create upload command pool\n";
+        }
+
+        if (vkAllocateCommandBuffers(device, &(VkCommandBufferAllocateInfo) {
+            DEFAULT_VK_COMMAND_BUFFER,
+            .commandPool = batch->command_pool
+        }, &batch->command_buffer) != VK_SUCCESS) {
+            return "Failed to allocate upload command buffer\n";
+        }
+
+        if (vkCreateFence(device, &(VkFenceCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO
+        }, NULL, &batch->fence) != VK_SUCCESS) {
+            return "Failed to create upload fence\n";
+        }
+    }
+
+    return NULL;
+}
+
+static void* reserve_elements(void* array, size_t num_elements, size_t num_new_elements, size_t* max_num_elements, size_t num_element_bytes) {
+    if (num_elements + num_new_elements <= *max_num_elements) {
+        return array;
+    }
+
+    size_t new_max_num_elements = *max_num_elements == 0 ? 16 : *max_num_elements;
+    while (num_elements + num_new_elements > new_max_num_elements) {
+        new_max_num_elements *= 2;
+    }
+
+    void* new_array = memalign(64, new_max_num_elements*num_element_bytes);
+    if (array != NULL) {
+        memcpy(new_array, array, num_elements*num_element_bytes);
+        free(array);
+    }
+
+    *max_num_elements = new_max_num_elements;
+    return new_array;
+}
+
+static void destroy_batch_stagings(upload_batch_t* batch) {
+    for (size_t i = 0; i < batch->num_stagings; i++) {
+        vmaDestroyBuffer(allocator, batch->stagings[i].buffer, batch->stagings[i].allocation);
+    }
+    batch->num_stagings = 0;
+}
+
+static void retire_batch(upload_batch_t* batch) {
+    destroy_batch_stagings(batch);
+
+    vkResetFences(device, 1, &batch->fence);
+    batch->pending = false;
+
+    // Fences can be observed out of submission order here, so only the newest batch moves the ring tail
+    if (batch->upload_id > completed_upload_id) {
+        completed_upload_id = batch->upload_id;
+        staging_ring_tail = batch->ring_end;
+    }
+}
+
+void update_uploads(void) {
+    for (size_t i = 0; i < NUM_UPLOAD_BATCHES; i++) {
+        upload_batch_t* batch = &batches[i];
+        if (batch->pending && vkGetFenceStatus(device, batch->fence) == VK_SUCCESS) {
+            retire_batch(batch);
+        }
+    }
+}
+
+bool is_upload_complete(upload_id_t upload_id) {
+    return upload_id <= completed_upload_id;
+}
+
+static upload_batch_t* get_oldest_pending_batch(void) {
+    upload_batch_t* oldest_batch = NULL;
+    for (size_t i = 0; i < NUM_UPLOAD_BATCHES; i++) {
+        upload_batch_t* batch = &batches[i];
+        if (batch->pending && (oldest_batch == NULL || batch->upload_id < oldest_batch->upload_id)) {
+            oldest_batch = batch;
+        }
+    }
+    return oldest_batch;
+}
+
+result_t begin_upload(VkCommandBuffer* out_command_buffer) {
+    upload_batch_t* batch = &batches[batch_index];
+
+    // Only blocks when every batch is still in flight
+    if (batch->pending) {
+        vkWaitForFences(device, 1, &batch->fence, VK_TRUE, UINT64_MAX);
+        retire_batch(batch);
+    }
+
+    batch->num_copies = 0;
+
+    vkResetCommandPool(device, batch->command_pool, 0);
+    if (vkBeginCommandBuffer(batch->command_buffer, &(VkCommandBufferBeginInfo) {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    }) != VK_SUCCESS) {
+        return result_failure;
+    }
+
+    *out_command_buffer = batch->command_buffer;
+    return result_success;
+}
+
+static bool try_allocate_from_ring(VkDeviceSize num_bytes, VkDeviceSize alignment, VkDeviceSize* out_offset) {
+    VkDeviceSize base = staging_ring_head - (staging_ring_head % STAGING_RING_SIZE);
+    VkDeviceSize offset = staging_ring_head % STAGING_RING_SIZE;
+    offset = offset % alignment == 0 ? offset : offset + (alignment - (offset % alignment));
+
+    // Allocations never straddle the end of the ring so each one stays a single contiguous copy source
+    if (offset + num_bytes > STAGING_RING_SIZE) {
+        base += STAGING_RING_SIZE;
+        offset = 0;
+    }
+
+    VkDeviceSize head = base + offset + num_bytes;
+    if (head - staging_ring_tail > STAGING_RING_SIZE) {
+        return false;
+    }
+
+    staging_ring_head = head;
+    *out_offset = offset;
+    return true;
+}
+
+static result_t allocate_dedicated_staging(VkDeviceSize num_bytes, staging_region_t* out_region) {
+    upload_batch_t* batch = &batches[batch_index];
+
+    VmaAllocationCreateInfo allocation_create_info = staging_allocation_create_info;
+    allocation_create_info.flags |= VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    staging_t staging;
+    VmaAllocationInfo allocation_info;
+    if (vmaCreateBuffer(allocator, &(VkBufferCreateInfo) {
+        DEFAULT_VK_STAGING_BUFFER,
+        .size = num_bytes
+    }, &allocation_create_info, &staging.buffer, &staging.allocation, &allocation_info) != VK_SUCCESS) {
+        return result_failure;
+    }
+
+    batch->stagings = reserve_elements(batch->stagings, batch->num_stagings, 1, &batch->max_num_stagings, sizeof(staging_t));
+    batch->stagings[batch->num_stagings++] = staging;
+
+    *out_region = (staging_region_t) {
+        .buffer = staging.buffer,
+        .offset = 0,
+        .data = allocation_info.pMappedData
+    };
+    return result_success;
+}
+
+result_t allocate_upload_staging(VkDeviceSize num_bytes, VkDeviceSize alignment, staging_region_t* out_region) {
+    if (num_bytes <= STAGING_RING_SIZE) {
+        VkDeviceSize offset;
+        bool allocated = try_allocate_from_ring(num_bytes, alignment, &offset);
+
+        // Wait on in flight batches for ring space, if the current batch alone fills the ring fall through to a dedicated buffer
+        upload_batch_t* oldest_batch;
+        while (!allocated && (oldest_batch = get_oldest_pending_batch()) != NULL) {
+            vkWaitForFences(device, 1, &oldest_batch->fence, VK_TRUE, UINT64_MAX);
+            retire_batch(oldest_batch);
+            allocated = try_allocate_from_ring(num_bytes, alignment, &offset);
+        }
+
+        if (allocated) {
+            *out_region = (staging_region_t) {
+                .buffer = staging_ring_buffer,
+                .offset = offset,
+                .data = staging_ring_data + offset
+            };
+            return result_success;
+        }
+    }
+
+    return allocate_dedicated_staging(num_bytes, out_region);
+}
+
+void queue_upload_buffer_copy(const staging_region_t* region, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize num_bytes) {
+    upload_batch_t* batch = &batches[batch_index];
+
+    batch->copies = reserve_elements(batch->copies, batch->num_copies, 1, &batch->max_num_copies, sizeof(buffer_copy_t));
+    batch->copies[batch->num_copies++] = (buffer_copy_t) {
+        .src_buffer = region->buffer,
+        .dst_buffer = buffer,
+        .region = {
+            .srcOffset = region->offset,
+            .dstOffset = offset,
+            .size = num_bytes
+        }
+    };
+}
+
+static int compare_buffer_copies(const void* a_ptr, const void* b_ptr) {
+    const buffer_copy_t* a = a_ptr;
+    const buffer_copy_t* b = b_ptr;
+
+    if (a->src_buffer != b->src_buffer) { return a->src_buffer < b->src_buffer ? -1 : 1; }
+    if (a->dst_buffer != b->dst_buffer) { return a->dst_buffer < b->dst_buffer ? -1 : 1; }
+    if (a->region.dstOffset != b->region.dstOffset) { return a->region.dstOffset < b->region.dstOffset ? -1 : 1; }
+    return 0;
+}
+
+static void record_buffer_copies(upload_batch_t* batch) {
+    if (batch->num_copies == 0) {
+        return;
+    }
+
+    buffer_copy_t* copies = batch->copies;
+    qsort(copies, batch->num_copies, sizeof(buffer_copy_t), compare_buffer_copies);
+
+    VkBufferCopy regions[batch->num_copies];
+    size_t num_regions = 0;
+
+    for (size_t i = 0; i < batch->num_copies; i++) {
+        const buffer_copy_t* copy = &copies[i];
+
+        // Copies that are contiguous in both the staging and the destination buffer collapse into one region
+        VkBufferCopy* last_region = num_regions > 0 ? &regions[num_regions - 1] : NULL;
+        if (
+            last_region != NULL &&
+            last_region->srcOffset + last_region->size == copy->region.srcOffset &&
+            last_region->dstOffset + last_region->size == copy->region.dstOffset
+        ) {
+            last_region->size += copy->region.size;
+        } else {
+            regions[num_regions++] = copy->region;
+        }
+
+        bool is_last_copy_of_pair = i + 1 == batch->num_copies || copies[i + 1].src_buffer != copy->src_buffer || copies[i + 1].dst_buffer != copy->dst_buffer;
+        if (is_last_copy_of_pair) {
+            vkCmdCopyBuffer(batch->command_buffer, copy->src_buffer, copy->dst_buffer, (uint32_t)num_regions, regions);
+            num_regions = 0;
+        }
+    }
+
+    batch->num_copies = 0;
+}
+
+result_t end_upload(upload_id_t* out_upload_id) {
+    upload_batch_t* batch = &batches[batch_index];
+
+    record_buffer_copies(batch);
+
+    if (vkEndCommandBuffer(batch->command_buffer) != VK_SUCCESS) {
+        return result_failure;
+    }
+
+    if (vkQueueSubmit(transfer_queue, 1, &(VkSubmitInfo) {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &batch->command_buffer
+    }, batch->fence) != VK_SUCCESS) {
+        return result_failure;
+    }
+
+    batch->upload_id = next_upload_id++;
+    batch->ring_end = staging_ring_head;
+    batch->pending = true;
+    *out_upload_id = batch->upload_id;
+
+    batch_index += 1;
+    batch_index %= NUM_UPLOAD_BATCHES;
+
+    return result_success;
+}
+
+void term_vulkan_uploads(void) {
+    for (size_t i = 0; i < NUM_UPLOAD_BATCHES; i++) {
+        upload_batch_t* batch = &batches[i];
+
+        // Also destroys the stagings of a batch that was begun but never submitted
+        destroy_batch_stagings(batch);
+        free(batch->stagings);
+        free(batch->copies);
+
+        vkDestroyFence(device, batch->fence, NULL);
+        vkDestroyCommandPool(device, batch->command_pool, NULL);
+    }
+
+    vmaDestroyBuffer(allocator, staging_ring_buffer, staging_ring_allocation);
+}
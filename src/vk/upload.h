@@ -0,0 +1,27 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdbool.h>
+#include "result.h"
+
+// Identifies a submitted upload batch, batches complete in submission order
+typedef uint64_t upload_id_t;
+
+typedef struct {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    void* data;
+} staging_region_t;
+
+const char* init_vulkan_uploads(void);
+void term_vulkan_uploads(void);
+
+result_t begin_upload(VkCommandBuffer* out_command_buffer);
+// Returns persistently mapped staging memory that stays valid until the current batch has finished executing, uploads that don't fit in the staging ring get a dedicated buffer
+result_t allocate_upload_staging(VkDeviceSize num_bytes, VkDeviceSize alignment, staging_region_t* out_region);
+// Buffer copies are gathered and recorded by end_upload, merged into as few regions as possible
+void queue_upload_buffer_copy(const staging_region_t* region, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize num_bytes);
+result_t end_upload(upload_id_t* out_upload_id);
+
+// Retires finished batches without blocking, call once per frame
+void update_uploads(void);
+bool is_upload_complete(upload_id_t upload_id);
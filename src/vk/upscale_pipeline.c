@@ -0,0 +1,264 @@
+#include "upscale_pipeline.h"
+#include "core.h"
+#include "gfx_core.h"
+#include "util.h"
+#include "defaults.h"
+#include "pipeline_cache.h"
+#include "debug.h"
+#include "render.h"
+#include "render_scale.h"
+#include <stdalign.h>
+
+alignas(64)
+VkRenderPass upscale_pipeline_render_pass;
+static VkSampler sampler;
+static VkDescriptorSetLayout descriptor_set_layout;
+static VkDescriptorPool descriptor_pool;
+// One per frame in flight, rewritten before each use since the scene image is recreated with the swapchain
+static VkDescriptorSet descriptor_sets[NUM_FRAMES_IN_FLIGHT];
+static VkPipelineLayout pipeline_layout;
+static VkPipeline pipeline;
+
+// Mirrors upscale_constants_t in the fragment shader
+typedef struct {
+    float tex_coord_scale[2];
+    float max_tex_coord[2];
+} upscale_constants_t;
+
+const char* init_upscale_pipeline(void) {
+    // The whole image is written, so nothing is loaded
+    if (!dynamic_rendering_enabled && vkCreateRenderPass(device, &(VkRenderPassCreateInfo) {
+        DEFAULT_VK_RENDER_PASS,
+
+        .attachmentCount = 1,
+        // The frame graph transitions the swapchain image around the pass
+        .pAttachments = &(VkAttachmentDescription) {
+            DEFAULT_VK_ATTACHMENT,
+            .format = surface_format.format,
+            .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+            .initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+        },
+
+        .pSubpasses = &(VkSubpassDescription) {
+            .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+            .colorAttachmentCount = 1,
+            .pColorAttachments = &(VkAttachmentReference) {
+                .attachment = 0,
+                .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+            }
+        }
+    }, NULL, &upscale_pipeline_render_pass) != VK_SUCCESS) {
+        return "Failed to create render pass\n";
+    }
+    SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_RENDER_PASS, upscale_pipeline_render_pass, "Upscale render pass");
+
+    // Bilinear is the whole filter, the shader keeps it inside the rendered region
+    if (vkCreateSampler(device, &(VkSamplerCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .minFilter = VK_FILTER_LINEAR,
+        .magFilter = VK_FILTER_LINEAR,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .anisotropyEnable = VK_FALSE,
+        .compareEnable = VK_FALSE,
+        .unnormalizedCoordinates = VK_FALSE
+    }, NULL, &sampler) != VK_SUCCESS) {
+        return "Failed to create upscale sampler\n";
+    }
+
+    if (vkCreateDescriptorSetLayout(device, &(VkDescriptorSetLayoutCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 1,
+        .pBindings = &(VkDescriptorSetLayoutBinding) {
+            DEFAULT_VK_DESCRIPTOR_BINDING,
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
+        }
+    }, NULL, &descriptor_set_layout) != VK_SUCCESS) {
+        return "Failed to create descriptor set layout\n";
+    }
+
+    if (vkCreateDescriptorPool(device, &(VkDescriptorPoolCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .poolSizeCount = 1,
+        .pPoolSizes = &(VkDescriptorPoolSize) {
+            .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = NUM_FRAMES_IN_FLIGHT
+        },
+        .maxSets = NUM_FRAMES_IN_FLIGHT
+    }, NULL, &descriptor_pool) != VK_SUCCESS) {
+        return "Failed to create descriptor pool\n";
+    }
+
+    VkDescriptorSetLayout descriptor_set_layouts[NUM_FRAMES_IN_FLIGHT];
+    for (size_t i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        descriptor_set_layouts[i] = descriptor_set_layout;
+    }
+
+    if (vkAllocateDescriptorSets(device, &(VkDescriptorSetAllocateInfo) {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = descriptor_pool,
+        .descriptorSetCount = NUM_FRAMES_IN_FLIGHT,
+        .pSetLayouts = descriptor_set_layouts
+    }, descriptor_sets) != VK_SUCCESS) {
+        return "Failed to allocate descriptor sets\n";
+    }
+
+    if (vkCreatePipelineLayout(device, &(VkPipelineLayoutCreateInfo) {
+        DEFAULT_VK_PIPELINE_LAYOUT,
+        .pSetLayouts = &descriptor_set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &(VkPushConstantRange) {
+            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .offset = 0,
+            .size = sizeof(upscale_constants_t)
+        }
+    }, NULL, &pipeline_layout) != VK_SUCCESS) {
+        return "Failed to create pipeline layout\n";
+    }
+
+    return NULL;
+}
+
+// Runs on a pipeline job thread, everything it uses was created by init_upscale_pipeline
+const char* create_upscale_pipeline(void) {
+    VkShaderModule vertex_shader_module;
+    if (create_shader_module("upscale_pipeline_vertex", &vertex_shader_module) != result_success) {
+        return "Failed to create vertex shader module\n";
+    }
+
+    VkShaderModule fragment_shader_module;
+    if (create_shader_module("upscale_pipeline_fragment", &fragment_shader_module) != result_success) {
+        vkDestroyShaderModule(device, vertex_shader_module, NULL);
+        return "Failed to create fragment shader module\n";
+    }
+
+    VkResult result = vkCreateGraphicsPipelines(device, pipeline_cache, 1, &(VkGraphicsPipelineCreateInfo) {
+        DEFAULT_VK_GRAPHICS_PIPELINE,
+
+        .stageCount = 2,
+        .pStages = (VkPipelineShaderStageCreateInfo[2]) {
+            {
+                DEFAULT_VK_SHADER_STAGE,
+                .stage = VK_SHADER_STAGE_VERTEX_BIT,
+                .module = vertex_shader_module
+            },
+            {
+                DEFAULT_VK_SHADER_STAGE,
+                .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+                .module = fragment_shader_module
+            }
+        },
+
+        // The triangle comes from the vertex index alone
+        .pVertexInputState = &(VkPipelineVertexInputStateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO
+        },
+        .pRasterizationState = &(VkPipelineRasterizationStateCreateInfo) {
+            DEFAULT_VK_RASTERIZATION,
+            .cullMode = VK_CULL_MODE_NONE
+        },
+        .pMultisampleState = &(VkPipelineMultisampleStateCreateInfo) { DEFAULT_VK_MULTISAMPLE },
+        .pDepthStencilState = NULL,
+        .layout = pipeline_layout,
+        .renderPass = upscale_pipeline_render_pass,
+        .pNext = dynamic_rendering_enabled ? &(VkPipelineRenderingCreateInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR,
+            .colorAttachmentCount = 1,
+            .pColorAttachmentFormats = &surface_format.format
+        } : NULL
+    }, NULL, &pipeline);
+
+    vkDestroyShaderModule(device, vertex_shader_module, NULL);
+    vkDestroyShaderModule(device, fragment_shader_module, NULL);
+
+    if (result != VK_SUCCESS) {
+        return "Failed to create graphics pipeline\n";
+    }
+    SET_DEBUG_OBJECT_NAME(VK_OBJECT_TYPE_PIPELINE, pipeline, "Upscale pipeline");
+
+    return NULL;
+}
+
+// Keeps the current pipeline when the new one fails, so a broken shader edit does not stop the app
+const char* recreate_upscale_pipeline(void) {
+    VkPipeline old_pipeline = pipeline;
+
+    const char* msg = create_upscale_pipeline();
+    if (msg != NULL) {
+        pipeline = old_pipeline;
+        return msg;
+    }
+
+    vkDestroyPipeline(device, old_pipeline, NULL);
+    return NULL;
+}
+
+void draw_upscale_pipeline(VkCommandBuffer command_buffer, uint32_t frame_index, size_t image_index) {
+    // The previous use of this frame's set has finished, its fence was waited on
+    VkDescriptorSet descriptor_set = descriptor_sets[frame_index];
+    vkUpdateDescriptorSets(device, 1, &(VkWriteDescriptorSet) {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = descriptor_set,
+        .dstBinding = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = 1,
+        .pImageInfo = &(VkDescriptorImageInfo) {
+            .sampler = sampler,
+            .imageView = frame_resources[frame_scene_image].view,
+            .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+        }
+    }, 0, NULL);
+
+    if (dynamic_rendering_enabled) {
+        begin_rendering_pipeline(command_buffer, &(VkRenderingInfoKHR) {
+            DEFAULT_VK_RENDERING,
+            .renderArea.extent = swap_image_extent,
+            .colorAttachmentCount = 1,
+            .pColorAttachments = &(VkRenderingAttachmentInfoKHR) {
+                DEFAULT_VK_RENDERING_ATTACHMENT,
+                .imageView = swapchain_image_views[image_index],
+                .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                .storeOp = VK_ATTACHMENT_STORE_OP_STORE
+            }
+        }, descriptor_set, pipeline_layout, pipeline);
+    } else {
+        begin_pipeline(
+            command_buffer,
+            swapchain_framebuffers[image_index], swap_image_extent,
+            0, NULL,
+            upscale_pipeline_render_pass, descriptor_set, pipeline_layout, pipeline
+        );
+    }
+
+    float width = (float)swap_image_extent.width;
+    float height = (float)swap_image_extent.height;
+    upscale_constants_t constants = {
+        .tex_coord_scale = { (float)render_extent.width/width, (float)render_extent.height/height },
+        .max_tex_coord = { ((float)render_extent.width - 0.5f)/width, ((float)render_extent.height - 0.5f)/height }
+    };
+    vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(constants), &constants);
+
+    vkCmdDraw(command_buffer, 3, 1, 0, 0);
+
+    if (dynamic_rendering_enabled) {
+        end_rendering_pipeline(command_buffer);
+    } else {
+        end_pipeline(command_buffer);
+    }
+}
+
+void term_upscale_pipeline(void) {
+    vkDestroyPipeline(device, pipeline, NULL);
+    vkDestroyPipelineLayout(device, pipeline_layout, NULL);
+    vkDestroyDescriptorPool(device, descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(device, descriptor_set_layout, NULL);
+    vkDestroySampler(device, sampler, NULL);
+    vkDestroyRenderPass(device, upscale_pipeline_render_pass, NULL);
+}
\ No newline at end of file
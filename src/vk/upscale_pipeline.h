@@ -0,0 +1,13 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stddef.h>
+#include <stdint.h>
+
+extern VkRenderPass upscale_pipeline_render_pass;
+
+const char* init_upscale_pipeline(void);
+const char* create_upscale_pipeline(void);
+const char* recreate_upscale_pipeline(void);
+// Stretches the render_extent region of the scene image over the swapchain image, the scene image view may change between frames
+void draw_upscale_pipeline(VkCommandBuffer command_buffer, uint32_t frame_index, size_t image_index);
+void term_upscale_pipeline(void);
\ No newline at end of file